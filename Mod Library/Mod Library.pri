@@ -8,15 +8,48 @@ message("You are running qmake on a generated .pro file. This may not work!")
 
 
 HEADERS += ./resource.h \
+    ./modulecache.h \
+    ./thumbnaildelegate.h \
+    ./thumbnails.h \
+    ./analyzers.h \
+    ./audioexport.h \
+    ./queueplayer.h \
+    ./previews.h \
+    ./ringbuffer.h \
+    ./facets.h \
+    ./sqlregexp.h \
+    ./smartplaylists.h \
+    ./resultcache.h \
+    ./parallelsort.h \
+    ./searchworker.h \
+    ./notesimilarity.h \
+    ./clusters.h \
+    ./fingerprint.h \
     ./database.h \
     ./modlibrary.h \
     ./settings.h \
     ./tablemodel.h \
     ./about.h \
-    ./audioplayer.h \
+    ./audioengine.h \
     ./qcheckboxex.h \
     ./modinfo.h
 SOURCES += ./about.cpp \
+    ./modulecache.cpp \
+    ./thumbnaildelegate.cpp \
+    ./thumbnails.cpp \
+    ./analyzers.cpp \
+    ./audioexport.cpp \
+    ./queueplayer.cpp \
+    ./previews.cpp \
+    ./audioengine.cpp \
+    ./facets.cpp \
+    ./sqlregexp.cpp \
+    ./smartplaylists.cpp \
+    ./resultcache.cpp \
+    ./searchworker.cpp \
+    ./notesimilarity.cpp \
+    ./clusters.cpp \
+    ./fingerprint.cpp \
     ./database.cpp \
     ./main.cpp \
     ./modinfo.cpp \
@@ -5,16 +5,17 @@
 TEMPLATE = app
 TARGET = Mod Library
 DESTDIR = ../bin/Win32/Release
-QT += core multimedia sql widgets gui
+QT += core multimedia sql widgets gui concurrent
 CONFIG += debug
-DEFINES += WIN64 CHROMAPRINT_NODLL QT_DLL QT_WIDGETS_LIB QT_SQL_LIB QT_MULTIMEDIA_LIB LIBOPENMPT_USE_DLL
+DEFINES += WIN64 CHROMAPRINT_NODLL QT_DLL QT_WIDGETS_LIB QT_SQL_LIB QT_MULTIMEDIA_LIB QT_CONCURRENT_LIB LIBOPENMPT_USE_DLL
 INCLUDEPATH += ./GeneratedFiles \
     . \
     ./GeneratedFiles/Release \
     ./../lib \
     ./../lib/libopenmpt \
-    ./../lib/libopenmpt/include/portaudio/include
-LIBS += -lksuser
+    ./../lib/libopenmpt/include/portaudio/include \
+    ./../lib/sqlite
+LIBS += -lksuser -lsqlite3
 DEPENDPATH += .
 MOC_DIR += ./GeneratedFiles/release
 OBJECTS_DIR += release
@@ -0,0 +1,305 @@
+/*
+ * analyzers.cpp
+ * -------------
+ * Purpose: Audio analysis of modules, computed from a single render pass.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "analyzers.h"
+#include <QVariant>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+static constexpr double PI = 3.14159265358979323846;
+
+
+static QVariant Decibels(double value)
+{
+	// NULL for digital silence
+	return (value > 0.0) ? QVariant(10.0 * std::log10(value)) : QVariant();
+}
+
+
+void AnalysisPipeline::Run(openmpt::module &mod)
+{
+	for(auto &analyzer : analyzers)
+	{
+		analyzer->Start(mod, SAMPLE_RATE);
+	}
+
+	std::vector<int16_t> data(512);
+	double modLength = mod.get_duration_seconds() * SAMPLE_RATE;	// Prevent endless pattern loops
+	mod.set_render_param(openmpt::module::RENDER_INTERPOLATIONFILTER_LENGTH, 2);
+	while(modLength >= 0.0)
+	{
+		const std::size_t count = mod.read(SAMPLE_RATE, data.size(), data.data());
+		if(!count)
+		{
+			break;
+		}
+		modLength -= count;
+		for(auto &analyzer : analyzers)
+		{
+			analyzer->Feed(mod, data.data(), count);
+		}
+	}
+
+	for(auto &analyzer : analyzers)
+	{
+		analyzer->Finish();
+	}
+}
+
+
+void AnalysisPipeline::Bind(QVariantMap &values) const
+{
+	for(const auto &analyzer : analyzers)
+	{
+		analyzer->Bind(values);
+	}
+	values[":analysis_version"] = VERSION;
+}
+
+
+ChromaprintAnalyzer::ChromaprintAnalyzer() : ctx(chromaprint_new(CHROMAPRINT_ALGORITHM_DEFAULT))
+{
+}
+
+
+ChromaprintAnalyzer::~ChromaprintAnalyzer()
+{
+	chromaprint_free(ctx);
+}
+
+
+void ChromaprintAnalyzer::Start(openmpt::module &, int32_t sampleRate)
+{
+	chromaprint_start(ctx, sampleRate, 1);
+}
+
+
+void ChromaprintAnalyzer::Feed(openmpt::module &, const int16_t *data, size_t count)
+{
+	if(feeding && !chromaprint_feed(ctx, data, static_cast<int>(count)))
+	{
+		feeding = false;
+	}
+}
+
+
+void ChromaprintAnalyzer::Finish()
+{
+	chromaprint_finish(ctx);
+
+	int rawFingerprintSize = 0, encodedFingerprintSize = 0;
+	uint32_t *rawFingerprint = nullptr;
+	char *encodedFingerprint = nullptr;
+	if(chromaprint_get_raw_fingerprint(ctx, &rawFingerprint, &rawFingerprintSize))
+	{
+		chromaprint_encode_fingerprint(rawFingerprint, rawFingerprintSize, CHROMAPRINT_ALGORITHM_DEFAULT, &encodedFingerprint, &encodedFingerprintSize, 0);
+	}
+	encoded = QByteArray(encodedFingerprint, encodedFingerprintSize);
+	fingerprint.assign(rawFingerprint, rawFingerprint + std::max(rawFingerprintSize, 0));
+	chromaprint_dealloc(rawFingerprint);
+	chromaprint_dealloc(encodedFingerprint);
+}
+
+
+void ChromaprintAnalyzer::Bind(QVariantMap &values) const
+{
+	values[":fingerprint"] = encoded;
+}
+
+
+// K-weighting filter coefficients for any sample rate, as derived in libebur128
+void LoudnessAnalyzer::Start(openmpt::module &, int32_t sampleRate)
+{
+	{
+		const double f0 = 1681.974450955533, G = 3.999843853973347, Q = 0.7071752369554196;
+		const double K = std::tan(PI * f0 / sampleRate);
+		const double Vh = std::pow(10.0, G / 20.0), Vb = std::pow(Vh, 0.4996667741545416);
+		const double a0 = 1.0 + K / Q + K * K;
+		shelf.b0 = (Vh + Vb * K / Q + K * K) / a0;
+		shelf.b1 = 2.0 * (K * K - Vh) / a0;
+		shelf.b2 = (Vh - Vb * K / Q + K * K) / a0;
+		shelf.a1 = 2.0 * (K * K - 1.0) / a0;
+		shelf.a2 = (1.0 - K / Q + K * K) / a0;
+	}
+	{
+		const double f0 = 38.13547087602444, Q = 0.5003270373238773;
+		const double K = std::tan(PI * f0 / sampleRate);
+		const double a0 = 1.0 + K / Q + K * K;
+		highpass.b0 = 1.0;
+		highpass.b1 = -2.0;
+		highpass.b2 = 1.0;
+		highpass.a1 = 2.0 * (K * K - 1.0) / a0;
+		highpass.a2 = (1.0 - K / Q + K * K) / a0;
+	}
+	subBlockLength = static_cast<size_t>(sampleRate / 10);
+}
+
+
+void LoudnessAnalyzer::Feed(openmpt::module &, const int16_t *data, size_t count)
+{
+	for(size_t i = 0; i < count; i++)
+	{
+		peak = std::max(peak, std::abs(static_cast<int32_t>(data[i])));
+		const double y = highpass.Process(shelf.Process(data[i] / 32768.0));
+		energy += y * y;
+		if(++subBlockPos == subBlockLength)
+		{
+			subBlocks.push_back(energy / subBlockLength);
+			energy = 0.0;
+			subBlockPos = 0;
+		}
+	}
+}
+
+
+// Gated loudness over 400ms blocks overlapping by 75%: Blocks below -70 LUFS are ignored,
+// and then those more than 10 LU below the loudness of the remaining blocks.
+void LoudnessAnalyzer::Finish()
+{
+	std::vector<double> blocks;
+	for(size_t i = 3; i < subBlocks.size(); i++)
+	{
+		blocks.push_back((subBlocks[i - 3] + subBlocks[i - 2] + subBlocks[i - 1] + subBlocks[i]) / 4.0);
+	}
+	const auto gatedMean = [&blocks](double threshold)
+	{
+		double sum = 0.0;
+		size_t num = 0;
+		for(const auto block : blocks)
+		{
+			if(block > threshold)
+			{
+				sum += block;
+				num++;
+			}
+		}
+		return num ? sum / num : 0.0;
+	};
+	// -0.691 + 10 * log10(energy) = loudness
+	const auto energyOf = [](double lufs) { return std::pow(10.0, (lufs + 0.691) / 10.0); };
+	const double absoluteGated = gatedMean(energyOf(-70.0));
+	if(absoluteGated <= 0.0)
+	{
+		return;
+	}
+	const double relativeGated = gatedMean(absoluteGated * std::pow(10.0, -10.0 / 10.0));
+	if(relativeGated > 0.0)
+	{
+		loudness = -0.691 + 10.0 * std::log10(relativeGated);
+		valid = true;
+	}
+}
+
+
+void LoudnessAnalyzer::Bind(QVariantMap &values) const
+{
+	values[":loudness"] = valid ? QVariant(loudness) : QVariant();
+	const double peakValue = peak / 32768.0;
+	values[":peak"] = Decibels(peakValue * peakValue);
+}
+
+
+void SilenceAnalyzer::Start(openmpt::module &, int32_t sampleRate)
+{
+	this->sampleRate = sampleRate;
+}
+
+
+void SilenceAnalyzer::Feed(openmpt::module &, const int16_t *data, size_t count)
+{
+	for(size_t i = 0; i < count; i++, position++)
+	{
+		if(std::abs(static_cast<int32_t>(data[i])) > SILENCE_THRESHOLD)
+		{
+			if(firstSound < 0)
+				firstSound = position;
+			lastSound = position;
+		}
+		const double sample = data[i] / 32768.0;
+		energy += sample * sample;
+		if((position + 1) % sampleRate == 0)
+		{
+			seconds.push_back(energy / sampleRate);
+			energy = 0.0;
+		}
+	}
+}
+
+
+void SilenceAnalyzer::Finish()
+{
+	if(firstSound < 0)
+	{
+		leadingSilence = static_cast<int>(position * 1000 / std::max(sampleRate, 1));
+		return;
+	}
+	leadingSilence = static_cast<int>(firstSound * 1000 / sampleRate);
+	trailingSilence = static_cast<int>((position - 1 - lastSound) * 1000 / sampleRate);
+
+	// The intro ends once the level first comes close to the median level of all non-silent seconds
+	std::vector<double> levels;
+	const double silence = std::pow(static_cast<double>(SILENCE_THRESHOLD) / 32768.0, 2.0);
+	for(const auto level : seconds)
+	{
+		if(level > silence)
+			levels.push_back(level);
+	}
+	if(levels.empty())
+	{
+		return;
+	}
+	std::nth_element(levels.begin(), levels.begin() + levels.size() / 2, levels.end());
+	const double typical = levels[levels.size() / 2] * std::pow(10.0, -INTRO_RANGE_DB / 10.0);
+	const size_t firstSecond = static_cast<size_t>(firstSound / sampleRate);
+	for(size_t s = firstSecond; s < seconds.size(); s++)
+	{
+		if(seconds[s] >= typical)
+		{
+			introLength = static_cast<int>(std::max(int64_t(0), static_cast<int64_t>(s) * sampleRate - firstSound) * 1000 / sampleRate);
+			break;
+		}
+	}
+}
+
+
+void SilenceAnalyzer::Bind(QVariantMap &values) const
+{
+	values[":leading_silence"] = leadingSilence;
+	values[":trailing_silence"] = trailingSilence;
+	values[":intro_length"] = introLength;
+}
+
+
+void TempoAnalyzer::Feed(openmpt::module &mod, const int16_t *, size_t count)
+{
+	const int32_t tempo = mod.get_current_tempo(), speed = mod.get_current_speed();
+	if(tempo > 0 && speed > 0)
+	{
+		// A row lasts speed ticks of 2.5 / tempo seconds, so at four rows per beat, speed 6 turns the tempo into BPM.
+		const double beatsPerMinute = 6.0 * tempo / speed;
+		histogram[static_cast<int>(std::lround(beatsPerMinute * 10.0))] += count;
+	}
+}
+
+
+void TempoAnalyzer::Finish()
+{
+	const auto mostCommon = std::max_element(histogram.begin(), histogram.end(), [](const auto &a, const auto &b) { return a.second < b.second; });
+	if(mostCommon != histogram.end())
+	{
+		bpm = mostCommon->first / 10.0;
+	}
+}
+
+
+void TempoAnalyzer::Bind(QVariantMap &values) const
+{
+	values[":bpm"] = (bpm > 0.0) ? QVariant(bpm) : QVariant();
+}
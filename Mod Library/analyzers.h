@@ -0,0 +1,151 @@
+/*
+ * analyzers.h
+ * -----------
+ * Purpose: Audio analysis of modules, computed from a single render pass.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QVariant>
+#include <libopenmpt/libopenmpt.hpp>
+#include <chromaprint.h>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Receives the audio of the analysis render pass. The module can be queried for its playback state,
+// which corresponds to the end of the block that has just been rendered.
+class AudioAnalyzer
+{
+public:
+	virtual ~AudioAnalyzer() = default;
+	virtual void Start(openmpt::module & /*mod*/, int32_t /*sampleRate*/) { }
+	// Mono audio in the order it is rendered
+	virtual void Feed(openmpt::module &mod, const int16_t *data, size_t count) = 0;
+	virtual void Finish() { }
+	// Add the results to the values of the insert / update query
+	virtual void Bind(QVariantMap & /*values*/) const { }
+};
+
+
+// Renders a module once and hands every block to all analyzers, so that adding another analyzer never adds another render pass.
+class AnalysisPipeline
+{
+public:
+	// Stored with every module. Increase this when adding an analyzer, so that existing modules are analyzed again when they are updated.
+	// 2: Waveform thumbnails
+	static constexpr int VERSION = 2;
+	static constexpr int32_t SAMPLE_RATE = 22050;
+
+protected:
+	std::vector<std::unique_ptr<AudioAnalyzer>> analyzers;
+
+public:
+	template<typename T, typename... Args>
+	T &Add(Args &&...args)
+	{
+		analyzers.push_back(std::make_unique<T>(std::forward<Args>(args)...));
+		return static_cast<T &>(*analyzers.back());
+	}
+
+	void Run(openmpt::module &mod);
+	void Bind(QVariantMap &values) const;
+};
+
+
+class ChromaprintAnalyzer : public AudioAnalyzer
+{
+protected:
+	ChromaprintContext *ctx;
+	std::vector<uint32_t> fingerprint;
+	QByteArray encoded;
+	bool feeding = true;
+
+public:
+	ChromaprintAnalyzer();
+	~ChromaprintAnalyzer();
+	ChromaprintAnalyzer(const ChromaprintAnalyzer &) = delete;
+	ChromaprintAnalyzer &operator=(const ChromaprintAnalyzer &) = delete;
+
+	void Start(openmpt::module &mod, int32_t sampleRate) override;
+	void Feed(openmpt::module &mod, const int16_t *data, size_t count) override;
+	void Finish() override;
+	void Bind(QVariantMap &values) const override;
+
+	const std::vector<uint32_t> &GetFingerprint() const { return fingerprint; }
+};
+
+
+// EBU R128 / ITU-R BS.1770 integrated loudness and the sample peak.
+// As the analysis render is mono, this is the loudness of the mono downmix.
+class LoudnessAnalyzer : public AudioAnalyzer
+{
+protected:
+	struct Biquad
+	{
+		double b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+		double z1 = 0.0, z2 = 0.0;
+		double Process(double x)
+		{
+			const double y = b0 * x + z1;
+			z1 = b1 * x - a1 * y + z2;
+			z2 = b2 * x - a2 * y;
+			return y;
+		}
+	};
+
+	Biquad shelf, highpass;	// K-weighting
+	std::vector<double> subBlocks;	// Mean square of every 100ms of K-weighted audio
+	double energy = 0.0;
+	size_t subBlockLength = 0, subBlockPos = 0;
+	int32_t peak = 0;
+	double loudness = 0.0;
+	bool valid = false;
+
+public:
+	void Start(openmpt::module &mod, int32_t sampleRate) override;
+	void Feed(openmpt::module &mod, const int16_t *data, size_t count) override;
+	void Finish() override;
+	void Bind(QVariantMap &values) const override;
+};
+
+
+// Silence at the start and end, and the length of a quiet intro, i.e. the time until the song first reaches its typical level.
+class SilenceAnalyzer : public AudioAnalyzer
+{
+public:
+	static constexpr int SILENCE_THRESHOLD = 33;	// About -60 dBFS
+	static constexpr double INTRO_RANGE_DB = 6.0;
+
+protected:
+	std::vector<double> seconds;	// Mean square of every second
+	double energy = 0.0;
+	int64_t position = 0, firstSound = -1, lastSound = -1;
+	int32_t sampleRate = 0;
+	int leadingSilence = 0, trailingSilence = 0, introLength = 0;
+
+public:
+	void Start(openmpt::module &mod, int32_t sampleRate) override;
+	void Feed(openmpt::module &mod, const int16_t *data, size_t count) override;
+	void Finish() override;
+	void Bind(QVariantMap &values) const override;
+};
+
+
+// The tempo that is active for most of the song. Assumes four rows per beat, which is by far the most common choice.
+class TempoAnalyzer : public AudioAnalyzer
+{
+protected:
+	std::map<int, size_t> histogram;	// Tenths of BPM => rendered frames
+	double bpm = 0.0;
+
+public:
+	void Feed(openmpt::module &mod, const int16_t *data, size_t count) override;
+	void Finish() override;
+	void Bind(QVariantMap &values) const override;
+};
@@ -0,0 +1,381 @@
+/*
+ * audioengine.cpp
+ * ---------------
+ * Purpose: Implementation of the Mod Library audio playback engine.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "audioengine.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+AudioEngine AudioEngine::instance;
+
+
+ModuleSource::ModuleSource(const QByteArray &content, bool loop)
+	: content(content), mod(content.begin(), content.end()), loop(loop)
+{
+	SetupRendering(mod);
+	mod.set_repeat_count(loop ? -1 : 0);
+}
+
+
+void ModuleSource::SetupRendering(openmpt::module &mod)
+{
+	mod.select_subsong(-1);	// Play all subsongs consecutively
+}
+
+
+size_t ModuleSource::Render(float *interleaved, size_t frames, int32_t sampleRate)
+{
+	return mod.read_interleaved_stereo(sampleRate, frames, interleaved);
+}
+
+
+void ModuleSource::Seek(double seconds)
+{
+	mod.set_position_seconds(seconds);
+}
+
+
+int64_t ModuleSource::GetRemainingFrames(int32_t sampleRate)
+{
+	if(loop)
+	{
+		return -1;
+	}
+	return static_cast<int64_t>(std::max(0.0, mod.get_duration_seconds() - mod.get_position_seconds()) * sampleRate);
+}
+
+
+AudioEngine::~AudioEngine()
+{
+	if(!initialized)
+	{
+		return;
+	}
+	Post({ Command::QUIT, 0, nullptr, 0.0 });
+	renderThread.join();
+	// Sources that were queued but never picked up by the render thread
+	Command command;
+	while(commands.Pop(command))
+	{
+		delete command.source;
+	}
+	if(stream != nullptr)
+	{
+		Pa_StopStream(stream);
+		Pa_CloseStream(stream);
+	}
+	if(paInitialized)
+	{
+		Pa_Terminate();
+	}
+}
+
+
+// PortAudio and the render thread are only started once a file is actually played, and then stay around until the program exits.
+bool AudioEngine::Open()
+{
+	if(initialized)
+	{
+		return stream != nullptr;
+	}
+	// The render thread also runs without an audio device, as Stop, Seek and SetVolume post commands once the engine is initialized
+	initialized = true;
+	renderThread = std::thread(&AudioEngine::RenderThread, this);
+
+	if(Pa_Initialize() != paNoError)
+	{
+		return false;
+	}
+	paInitialized = true;
+	PaStreamParameters streamparameters;
+	memset(&streamparameters, 0, sizeof(PaStreamParameters));
+	streamparameters.device = Pa_GetDefaultOutputDevice();
+	if(streamparameters.device == paNoDevice)
+	{
+		return false;
+	}
+	streamparameters.channelCount = 2;
+	streamparameters.sampleFormat = paFloat32;
+	streamparameters.suggestedLatency = Pa_GetDeviceInfo(streamparameters.device)->defaultLowOutputLatency;
+	if(Pa_OpenStream(&stream, nullptr, &streamparameters, SAMPLE_RATE, paFramesPerBufferUnspecified, paNoFlag, Callback, this) != paNoError)
+	{
+		stream = nullptr;
+		return false;
+	}
+	if(Pa_StartStream(stream) != paNoError)
+	{
+		Pa_CloseStream(stream);
+		stream = nullptr;
+		return false;
+	}
+	return true;
+}
+
+
+uint64_t AudioEngine::Play(std::unique_ptr<AudioSource> source)
+{
+	if(!Open())
+	{
+		return 0;
+	}
+	const uint64_t id = ++nextId;
+	Post({ Command::PLAY, id, source.release(), 0.0 });
+	return id;
+}
+
+
+uint64_t AudioEngine::Queue(uint64_t after, std::unique_ptr<AudioSource> source, double crossfadeSeconds)
+{
+	if(!Open())
+	{
+		return 0;
+	}
+	const uint64_t id = ++nextId;
+	Post({ Command::QUEUE, id, source.release(), crossfadeSeconds, after });
+	return id;
+}
+
+
+void AudioEngine::Stop(uint64_t id)
+{
+	if(initialized)
+	{
+		Post({ Command::STOP, id, nullptr, 0.0 });
+	}
+}
+
+
+void AudioEngine::Seek(uint64_t id, double seconds)
+{
+	if(initialized)
+	{
+		Post({ Command::SEEK, id, nullptr, seconds });
+	}
+}
+
+
+void AudioEngine::SetVolume(int volume)
+{
+	// Same scale as libopenmpt's master gain was set up with: 0.5 dB per percent
+	const double value = std::pow(10.0, (volume - 100) * 50 / 2000.0);
+	if(initialized)
+	{
+		Post({ Command::VOLUME, 0, nullptr, value });
+	} else
+	{
+		// Nobody would ever take the command out of the queue, but the render thread will start with this volume once it exists
+		gain = targetGain = static_cast<float>(value);
+	}
+}
+
+
+void AudioEngine::Post(const Command &command)
+{
+	// The render thread empties the queue every few milliseconds, so it can only be full for a very short time
+	while(!commands.Push(command))
+	{
+		std::this_thread::yield();
+	}
+	std::lock_guard<std::mutex> lock(wakeMutex);
+	wakeCondition.notify_one();
+}
+
+
+void AudioEngine::RenderThread()
+{
+	std::vector<float> block(RENDER_FRAMES * 2), nextBlock(RENDER_FRAMES * 2);
+	while(ProcessCommands())
+	{
+		const bool bufferFull = samples.WriteAvailable() < block.size() || samples.ReadAvailable() >= BUFFERED_FRAMES * 2;
+		if(source == nullptr || bufferFull)
+		{
+			// Wait for the audio device to consume some audio. Without a source, only a new command can change anything.
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			if(source == nullptr)
+				wakeCondition.wait(lock, [this]() { return commands.ReadAvailable() != 0; });
+			else
+				wakeCondition.wait_for(lock, std::chrono::milliseconds(2), [this]() { return commands.ReadAvailable() != 0; });
+			continue;
+		}
+
+		const size_t frames = RenderBlock(block, nextBlock);
+		if(frames == 0)
+		{
+			// Continue with the queued source without leaving a gap
+			if(next != nullptr)
+			{
+				StartNext();
+			} else
+			{
+				source.reset();
+				endedId = sourceId;
+				emit Finished(sourceId, false);
+			}
+			continue;
+		}
+		// Ramp volume changes over one block to avoid clicks
+		const float step = (targetGain - gain) / frames;
+		for(size_t i = 0; i < frames; i++)
+		{
+			gain += step;
+			block[i * 2] *= gain;
+			block[i * 2 + 1] *= gain;
+		}
+		gain = targetGain;
+		samples.Write(block.data(), frames * 2);
+	}
+	source.reset();
+	next.reset();
+}
+
+
+size_t AudioEngine::RenderBlock(std::vector<float> &block, std::vector<float> &nextBlock)
+{
+	if(next != nullptr && !fading && crossfadeFrames > 0)
+	{
+		const int64_t remaining = source->GetRemainingFrames(SAMPLE_RATE);
+		if(remaining >= 0 && remaining <= crossfadeFrames)
+		{
+			fading = true;
+			fadePosition = 0;
+			fadeLength = std::max(remaining, int64_t(1));
+		}
+	}
+
+	const size_t frames = source->Render(block.data(), RENDER_FRAMES, SAMPLE_RATE);
+	if(!fading)
+	{
+		return frames;
+	}
+
+	// Mix the end of the current source with the beginning of the queued one
+	std::fill(block.begin() + frames * 2, block.end(), 0.0f);
+	const size_t nextFrames = next->Render(nextBlock.data(), RENDER_FRAMES, SAMPLE_RATE);
+	for(size_t i = 0; i < nextFrames; i++)
+	{
+		const float t = std::min(1.0f, static_cast<float>(fadePosition + static_cast<int64_t>(i)) / fadeLength);
+		block[i * 2] = block[i * 2] * (1.0f - t) + nextBlock[i * 2] * t;
+		block[i * 2 + 1] = block[i * 2 + 1] * (1.0f - t) + nextBlock[i * 2 + 1] * t;
+	}
+	fadePosition += nextFrames;
+	if(frames == 0 || fadePosition >= fadeLength)
+	{
+		StartNext();
+	}
+	return std::max(frames, nextFrames);
+}
+
+
+void AudioEngine::StartNext()
+{
+	const uint64_t previousId = sourceId;
+	source = std::move(next);
+	sourceId = nextSourceId;
+	nextSourceId = 0;
+	fading = false;
+	emit Finished(previousId, false);
+	emit Started(sourceId);
+}
+
+
+void AudioEngine::DropNext()
+{
+	fading = false;
+	if(next != nullptr)
+	{
+		next.reset();
+		emit Finished(nextSourceId, true);
+		nextSourceId = 0;
+	}
+}
+
+
+// Returns false if the render thread should quit
+bool AudioEngine::ProcessCommands()
+{
+	Command command;
+	while(commands.Pop(command))
+	{
+		switch(command.type)
+		{
+		case Command::PLAY:
+			DropNext();
+			if(source != nullptr)
+			{
+				emit Finished(sourceId, true);
+			}
+			source.reset(command.source);
+			sourceId = command.id;
+			Discard();
+			break;
+		case Command::QUEUE:
+			if(command.after == sourceId && source != nullptr)
+			{
+				DropNext();
+				next.reset(command.source);
+				nextSourceId = command.id;
+				crossfadeFrames = static_cast<int64_t>(command.value * SAMPLE_RATE);
+			} else if(command.after == endedId && source == nullptr)
+			{
+				// The previous source has just ended, so start right away
+				source.reset(command.source);
+				sourceId = command.id;
+				emit Started(sourceId);
+			} else
+			{
+				delete command.source;
+				emit Finished(command.id, true);
+			}
+			break;
+		case Command::STOP:
+			if(command.id == sourceId && source != nullptr)
+			{
+				source.reset();
+				DropNext();
+				Discard();
+			}
+			break;
+		case Command::SEEK:
+			if(command.id == sourceId && source != nullptr)
+			{
+				fading = false;
+				source->Seek(command.value);
+				Discard();
+			}
+			break;
+		case Command::VOLUME:
+			targetGain = static_cast<float>(command.value);
+			break;
+		case Command::QUIT:
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// Let the callback skip over everything that has not been played yet, so that a new source or position is heard immediately.
+void AudioEngine::Discard()
+{
+	discardPosition.store(samples.WritePosition(), std::memory_order_release);
+}
+
+
+int AudioEngine::Callback(const void *, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *, PaStreamCallbackFlags, void *userData)
+{
+	AudioEngine &engine = *static_cast<AudioEngine *>(userData);
+	engine.samples.DiscardUntil(engine.discardPosition.load(std::memory_order_acquire));
+	float *out = static_cast<float *>(output);
+	const size_t count = frameCount * 2;
+	const size_t read = engine.samples.Read(out, count);
+	// Output silence on underruns and while nothing is playing
+	std::fill(out + read, out + count, 0.0f);
+	return paContinue;
+}
@@ -0,0 +1,138 @@
+/*
+ * audioengine.h
+ * -------------
+ * Purpose: Implementation of the Mod Library audio playback engine.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QByteArray>
+#include <libopenmpt/libopenmpt.hpp>
+#include <portaudio.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ringbuffer.h"
+
+// Anything that can be played by the audio engine. Sources are only ever used by the engine's render thread once they have been handed over.
+class AudioSource
+{
+public:
+	virtual ~AudioSource() = default;
+	// Render interleaved stereo audio, returns the number of frames rendered (0 at the end of the source)
+	virtual size_t Render(float *interleaved, size_t frames, int32_t sampleRate) = 0;
+	virtual void Seek(double /*seconds*/) { }
+	// Number of frames left until the end of the source, or -1 if unknown (e.g. because the source loops forever)
+	virtual int64_t GetRemainingFrames(int32_t /*sampleRate*/) { return -1; }
+};
+
+
+class ModuleSource : public AudioSource
+{
+protected:
+	QByteArray content;
+	openmpt::module mod;
+	bool loop;
+
+public:
+	// Throws openmpt::exception if the module cannot be loaded
+	ModuleSource(const QByteArray &content, bool loop);
+
+	size_t Render(float *interleaved, size_t frames, int32_t sampleRate) override;
+	void Seek(double seconds) override;
+	int64_t GetRemainingFrames(int32_t sampleRate) override;
+
+	// Render settings shared by everything that turns modules into audio
+	static void SetupRendering(openmpt::module &mod);
+};
+
+
+// A single, process-wide PortAudio output stream that is opened on first use and kept running.
+// A render thread pulls audio from the current source into a lock-free ring buffer, from which the
+// PortAudio callback copies the audio into the device buffers without ever blocking.
+// All public functions must be called from the same (GUI) thread; they only queue a command for the render thread.
+class AudioEngine : public QObject
+{
+	Q_OBJECT
+
+public:
+	static constexpr int32_t SAMPLE_RATE = 48000;
+	// Audio is rendered in small blocks so that new sources are heard quickly
+	static constexpr size_t RENDER_FRAMES = 512;
+	// How far the render thread stays ahead of the audio device, about 40ms
+	static constexpr size_t BUFFERED_FRAMES = 2048;
+
+protected:
+	struct Command
+	{
+		enum Type { PLAY, QUEUE, STOP, SEEK, VOLUME, QUIT };
+		Type type;
+		uint64_t id;
+		AudioSource *source;
+		double value;
+		uint64_t after = 0;	// For QUEUE: The playback that the source should follow
+	};
+
+	static AudioEngine instance;
+
+	PaStream *stream = nullptr;
+	std::thread renderThread;
+	std::mutex wakeMutex;
+	std::condition_variable wakeCondition;
+	SpscRingBuffer<Command> commands{ 64 };
+	SpscRingBuffer<float> samples{ 4 * BUFFERED_FRAMES };
+	std::atomic<size_t> discardPosition{ 0 };	// Audio written before this position is dropped by the callback
+	uint64_t nextId = 0;
+	bool initialized = false;
+	bool paInitialized = false;	// Pa_Terminate must only be called after Pa_Initialize succeeded
+
+	// Render thread state
+	std::unique_ptr<AudioSource> source, next;
+	uint64_t sourceId = 0, nextSourceId = 0, endedId = 0;
+	int64_t crossfadeFrames = 0, fadePosition = 0, fadeLength = 0;
+	bool fading = false;
+	float gain = 1.0f, targetGain = 1.0f;
+
+public:
+	static AudioEngine &Instance() { return instance; }
+
+	// Start playing the source, replacing whatever is playing. Returns an ID that identifies this playback in the other calls and signals, or 0 if no audio device is available.
+	uint64_t Play(std::unique_ptr<AudioSource> source);
+	// Play the source as soon as the given playback has ended, without any gap or with a crossfade of the given length.
+	// Replaces any source that was already queued for that playback. If the playback has already been stopped or replaced, the queued source is dropped as well.
+	uint64_t Queue(uint64_t after, std::unique_ptr<AudioSource> source, double crossfadeSeconds);
+	// Stop playback if the given playback is still running
+	void Stop(uint64_t id);
+	void Seek(uint64_t id, double seconds);
+	// Volume in percent of the full level, as shown by the volume sliders
+	void SetVolume(int volume);
+
+signals:
+	// Emitted from the render thread when a playback has ended, either because its source has been rendered completely (also when a queued source takes over)
+	// or because it was replaced by another one or dropped before it could start
+	void Finished(quint64 id, bool replaced);
+	// Emitted from the render thread when a queued source starts playing
+	void Started(quint64 id);
+
+protected:
+	AudioEngine() = default;
+	~AudioEngine();
+
+	bool Open();
+	void Post(const Command &command);
+	void RenderThread();
+	bool ProcessCommands();
+	size_t RenderBlock(std::vector<float> &block, std::vector<float> &nextBlock);
+	void StartNext();
+	void DropNext();
+	void Discard();
+	static int Callback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags, void *userData);
+};
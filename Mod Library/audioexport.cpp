@@ -0,0 +1,212 @@
+/*
+ * audioexport.cpp
+ * ---------------
+ * Purpose: Rendering modules to WAV files.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "audioexport.h"
+#include "audioengine.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QSet>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+static constexpr int HEADER_SIZE = 44;
+static constexpr size_t RENDER_FRAMES = 4096;
+
+
+static void PutLE(char *out, uint32_t value, int bytes)
+{
+	for(int i = 0; i < bytes; i++)
+	{
+		out[i] = static_cast<char>(value >> (i * 8));
+	}
+}
+
+
+bool WavWriter::Open(const QString &fileName, int32_t sampleRate, Format format)
+{
+	this->format = format;
+	dataSize = 0;
+	file.setFileName(fileName);
+	if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+	{
+		return false;
+	}
+	buffer.reserve(BUFFER_SIZE);
+	buffer.clear();
+	WriteHeader(sampleRate);
+	return true;
+}
+
+
+// The RIFF and data chunk sizes are filled in by Finish once they are known
+void WavWriter::WriteHeader(int32_t sampleRate)
+{
+	const uint32_t bytesPerSample = (format == FLOAT_32) ? 4 : 2;
+	char header[HEADER_SIZE];
+	memcpy(header, "RIFF", 4);
+	PutLE(header + 4, 0, 4);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	PutLE(header + 16, 16, 4);
+	PutLE(header + 20, (format == FLOAT_32) ? 3 : 1, 2);	// WAVE_FORMAT_IEEE_FLOAT / WAVE_FORMAT_PCM
+	PutLE(header + 22, 2, 2);
+	PutLE(header + 24, sampleRate, 4);
+	PutLE(header + 28, sampleRate * 2 * bytesPerSample, 4);
+	PutLE(header + 32, 2 * bytesPerSample, 2);
+	PutLE(header + 34, bytesPerSample * 8, 2);
+	memcpy(header + 36, "data", 4);
+	PutLE(header + 40, 0, 4);
+	buffer.insert(buffer.end(), header, header + HEADER_SIZE);
+}
+
+
+bool WavWriter::Write(const float *interleaved, size_t frames)
+{
+	const size_t count = frames * 2;
+	const size_t bytes = count * ((format == FLOAT_32) ? 4 : 2);
+	if(buffer.size() + bytes > BUFFER_SIZE && !Flush())
+	{
+		return false;
+	}
+	const size_t offset = buffer.size();
+	buffer.resize(offset + bytes);
+	char *out = buffer.data() + offset;
+	if(format == FLOAT_32)
+	{
+		for(size_t i = 0; i < count; i++, out += 4)
+		{
+			uint32_t value;
+			memcpy(&value, interleaved + i, 4);
+			PutLE(out, value, 4);
+		}
+	} else
+	{
+		for(size_t i = 0; i < count; i++, out += 2)
+		{
+			const long value = std::lround(std::clamp(interleaved[i], -1.0f, 1.0f) * 32767.0f);
+			PutLE(out, static_cast<uint32_t>(value), 2);
+		}
+	}
+	dataSize += bytes;
+	return true;
+}
+
+
+bool WavWriter::Flush()
+{
+	if(buffer.empty())
+	{
+		return true;
+	}
+	const bool ok = file.write(buffer.data(), buffer.size()) == static_cast<qint64>(buffer.size());
+	buffer.clear();
+	return ok;
+}
+
+
+bool WavWriter::Finish()
+{
+	if(!Flush() || dataSize > std::numeric_limits<uint32_t>::max() - HEADER_SIZE)
+	{
+		Abort();
+		return false;
+	}
+	char size[4];
+	PutLE(size, static_cast<uint32_t>(dataSize + HEADER_SIZE - 8), 4);
+	bool ok = file.seek(4) && file.write(size, 4) == 4;
+	PutLE(size, static_cast<uint32_t>(dataSize), 4);
+	ok = ok && file.seek(40) && file.write(size, 4) == 4;
+	file.close();
+	if(!ok)
+	{
+		file.remove();
+	}
+	return ok;
+}
+
+
+void WavWriter::Abort()
+{
+	buffer.clear();
+	file.close();
+	file.remove();
+}
+
+
+bool AudioExport::ExportModule(const Job &job, int32_t sampleRate, WavWriter::Format format)
+{
+	QFile file(job.source);
+	if(!file.open(QIODevice::ReadOnly))
+	{
+		return false;
+	}
+	const QByteArray content = file.readAll();
+	file.close();
+
+	try
+	{
+		openmpt::module mod(content.cbegin(), content.cend());
+		ModuleSource::SetupRendering(mod);
+		mod.set_repeat_count(0);
+
+		WavWriter writer;
+		if(!writer.Open(job.target, sampleRate, format))
+		{
+			return false;
+		}
+		std::vector<float> block(RENDER_FRAMES * 2);
+		double remaining = mod.get_duration_seconds() * sampleRate;	// Prevent endless pattern loops
+		while(remaining >= 0.0)
+		{
+			const size_t count = mod.read_interleaved_stereo(sampleRate, RENDER_FRAMES, block.data());
+			if(!count)
+			{
+				break;
+			}
+			remaining -= count;
+			if(!writer.Write(block.data(), count))
+			{
+				writer.Abort();
+				return false;
+			}
+		}
+		return writer.Finish();
+	} catch(const openmpt::exception &)
+	{
+		QFile::remove(job.target);
+		return false;
+	}
+}
+
+
+std::vector<AudioExport::Job> AudioExport::CreateJobs(const std::vector<QString> &fileNames, const QString &targetDir)
+{
+	std::vector<Job> jobs;
+	jobs.reserve(fileNames.size());
+	QSet<QString> used;
+	const QDir dir(targetDir);
+	for(const auto &fileName : fileNames)
+	{
+		if(fileName.isEmpty())
+		{
+			continue;
+		}
+		// Modules from different folders often share the same name
+		const QString baseName = QFileInfo(fileName).fileName();
+		QString name = baseName + ".wav";
+		for(int i = 2; used.contains(name.toLower()); i++)
+		{
+			name = QString("%1 (%2).wav").arg(baseName).arg(i);
+		}
+		used.insert(name.toLower());
+		jobs.push_back({ fileName, dir.filePath(name) });
+	}
+	return jobs;
+}
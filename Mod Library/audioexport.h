@@ -0,0 +1,57 @@
+/*
+ * audioexport.h
+ * -------------
+ * Purpose: Rendering modules to WAV files.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QFile>
+#include <QString>
+#include <cstdint>
+#include <vector>
+
+// Streams interleaved stereo audio into a WAV file. Samples are collected in a large buffer,
+// so that many exports running in parallel still write big sequential chunks instead of lots of small ones.
+class WavWriter
+{
+public:
+	enum Format { PCM_16, FLOAT_32 };
+
+	static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+protected:
+	QFile file;
+	std::vector<char> buffer;
+	Format format = PCM_16;
+	uint64_t dataSize = 0;
+
+public:
+	bool Open(const QString &fileName, int32_t sampleRate, Format format);
+	bool Write(const float *interleaved, size_t frames);
+	// Flush the buffer and fill in the chunk sizes
+	bool Finish();
+	void Abort();
+
+protected:
+	bool Flush();
+	void WriteHeader(int32_t sampleRate);
+};
+
+
+class AudioExport
+{
+public:
+	struct Job
+	{
+		QString source, target;
+	};
+
+	// Render a module from start to end using the same setup as playback. Incomplete files are removed.
+	static bool ExportModule(const Job &job, int32_t sampleRate, WavWriter::Format format);
+	// Pick an output file name for every module that does not clash with any other one
+	static std::vector<Job> CreateJobs(const std::vector<QString> &fileNames, const QString &targetDir);
+};
@@ -0,0 +1,1029 @@
+/*
+ * librarygenerator.cpp
+ * --------------------
+ * Purpose: Synthetic module libraries and module files for scale testing.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "librarygenerator.h"
+#include "analyzers.h"
+#include "database.h"
+#include "notesimilarity.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QtConcurrent/QtConcurrent>
+#include <QtSql/QSqlQuery>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <utility>
+#include <chromaprint.h>
+#include <sqlite3.h>
+
+// Chromaprint produces about eight sub-fingerprints per second of audio
+static constexpr double FINGERPRINT_RATE = 8.0;
+// What Analyze stores for modules without a date (an invalid QDateTime)
+static constexpr int64_t UNDATED = 0xFFFFFFFF;
+static constexpr int BATCH_SIZE = 1024;
+static constexpr int NUM_ARTISTS = 20000, NUM_GROUPS = 2000;
+// Lowest and highest note of the ProTracker period table, as libopenmpt numbers them. All generated notes are in this range.
+static constexpr int MIN_NOTE = 49, MAX_NOTE = 84;
+
+static constexpr uint16_t PERIODS[MAX_NOTE - MIN_NOTE + 1] =
+{
+	856, 808, 762, 720, 678, 640, 604, 570, 538, 508, 480, 453,
+	428, 404, 381, 360, 339, 320, 302, 285, 269, 254, 240, 226,
+	214, 202, 190, 180, 170, 160, 151, 143, 135, 127, 120, 113,
+};
+
+// Roughly the distribution of formats and channel counts found in large module archives
+static const char *const FORMATS[] = { "mod", "xm", "it", "s3m", "mptm", "mtm", "669" };
+static constexpr int FORMAT_WEIGHTS[] = { 40, 30, 15, 11, 2, 1, 1 };
+static constexpr int CHANNELS[] = { 4, 6, 8, 10, 12, 16, 24, 32 };
+static constexpr int CHANNEL_WEIGHTS[] = { 15, 10, 35, 5, 10, 15, 5, 5 };
+static constexpr int NUM_FORMATS = static_cast<int>(std::size(FORMATS));
+static constexpr int NUM_CHANNEL_CHOICES = static_cast<int>(std::size(CHANNELS));
+
+static constexpr int MAJOR_SCALE[7] = { 0, 2, 4, 5, 7, 9, 11 };
+static constexpr int MINOR_SCALE[7] = { 0, 2, 3, 5, 7, 8, 10 };
+
+// Every channel plays one of these parts, which also determines its sample in written module files
+struct Voice
+{
+	int base;	// Lowest note
+	int step;	// Rows between notes
+	double density;	// Probability of a note on every step
+	int leap;	// Largest change of the scale degree between two notes
+	int maxDegree;
+};
+static constexpr Voice VOICES[] =
+{
+	{ 49, 4, 0.8, 2, 6 },	// Bass
+	{ 61, 2, 0.6, 0, 0 },	// Drums
+	{ 61, 8, 0.9, 3, 6 },	// Chords
+	{ 61, 1, 0.35, 2, 9 },	// Lead
+};
+static constexpr int NUM_VOICES = static_cast<int>(std::size(VOICES));
+
+static const char *const TITLE_WORDS[] =
+{
+	"acid", "air", "alien", "amiga", "angel", "another", "autumn", "bass", "beat", "beyond", "black", "blast", "blue", "boogie", "bounce", "breeze",
+	"chip", "city", "cold", "cosmic", "crazy", "crystal", "cyber", "dance", "dark", "day", "deep", "desert", "digital", "disco", "doom", "dream",
+	"drive", "dust", "echo", "electric", "elysium", "emotion", "end", "escape", "eternal", "fantasy", "final", "fire", "flight", "forest", "forever", "freedom",
+	"funk", "funky", "future", "galaxy", "ghost", "glory", "gold", "green", "groove", "happy", "hardcore", "heaven", "hero", "house", "hyper", "ice",
+	"illusion", "intro", "island", "journey", "jump", "jungle", "key", "killer", "land", "laser", "last", "life", "light", "lost", "love", "lunar",
+	"machine", "magic", "mega", "melody", "memories", "midnight", "mind", "mirror", "moon", "morning", "music", "mystery", "neon", "new", "night", "ninja",
+	"nova", "ocean", "orbit", "paradise", "party", "pixel", "planet", "power", "pulse", "quest", "radio", "rain", "rave", "red", "remix", "retro",
+	"rhythm", "river", "road", "rock", "royal", "secret", "shadow", "sky", "slow", "smooth", "snow", "song", "soul", "space", "speed", "spirit",
+	"spring", "star", "steel", "stone", "storm", "street", "summer", "sun", "sweet", "synth", "techno", "theme", "time", "trance", "tribute", "tropical",
+	"tune", "twilight", "universe", "velvet", "vision", "voyage", "wave", "wild", "wind", "winter", "world", "zero", "zone",
+};
+static const char *const INSTRUMENT_WORDS[] =
+{
+	"bass", "bassdrum", "kick", "snare", "hihat", "hat", "crash", "ride", "tom", "clap", "lead", "pad", "strings", "choir", "piano", "guitar",
+	"flute", "organ", "brass", "arp", "fx", "sweep", "vox", "synth", "chord", "bell", "sitar", "slap", "pluck", "drum", "loop", "noise",
+};
+static const char *const CREDITS[] =
+{
+	"by %1", "composed by %1", "(c) %3 %1", "greets to %1", "hi to %1", "%2 rules!", "%1 of %2", "made in protracker", "call the %2 bbs", "contact me!", "spread this tune", "%1/%2",
+};
+static const char *const SYLLABLES[] =
+{
+	"ja", "ko", "mi", "ra", "zen", "tor", "lu", "ne", "vi", "sa", "dro", "ka", "li", "mo", "rex", "ti", "fa", "bo", "gel", "ron",
+	"dan", "el", "ax", "qu", "sy", "pho", "mar", "kel", "nu", "vo", "jes", "ter", "hy", "per", "za", "in", "ox", "ur", "bi", "tek",
+};
+static const char *const GROUP_SUFFIXES[] = { "", " crew", " design", " inc", " productions", " team", " music" };
+static const char *const COLLECTIONS[] = { "Modland", "Aminet", "AMP", "scene.org", "Unsorted", "Keygen" };
+
+// Runs a function when leaving the scope, also if an exception is thrown
+template<typename Func>
+class ScopeExit
+{
+	Func func;
+
+public:
+	explicit ScopeExit(Func func) : func(std::move(func)) { }
+	ScopeExit(const ScopeExit &) = delete;
+	ScopeExit &operator=(const ScopeExit &) = delete;
+	~ScopeExit() { func(); }
+};
+
+
+template<typename T, size_t N>
+static const T &Choose(GeneratorRandom &rng, const T (&list)[N])
+{
+	return list[rng.Below(static_cast<uint32_t>(N))];
+}
+
+
+double GeneratorRandom::Normal()
+{
+	// Box-Muller
+	const double u = 1.0 - Uniform(), v = Uniform();
+	return std::sqrt(-2.0 * std::log(u)) * std::cos(6.283185307179586 * v);
+}
+
+
+double GeneratorRandom::LogNormal(double median, double sigma)
+{
+	return median * std::exp(sigma * Normal());
+}
+
+
+int GeneratorRandom::Pick(const int *weights, int count)
+{
+	int total = 0;
+	for(int i = 0; i < count; i++)
+		total += weights[i];
+	int value = static_cast<int>(Below(static_cast<uint32_t>(total)));
+	for(int i = 0; i < count; i++)
+	{
+		if(value < weights[i])
+			return i;
+		value -= weights[i];
+	}
+	return count - 1;
+}
+
+
+static QByteArray Capitalized(QByteArray word)
+{
+	if(!word.isEmpty())
+		word[0] = static_cast<char>(std::toupper(static_cast<unsigned char>(word[0])));
+	return word;
+}
+
+
+static QByteArray Name(GeneratorRandom &rng)
+{
+	QByteArray name;
+	const int numSyllables = rng.Range(2, 3);
+	for(int i = 0; i < numSyllables; i++)
+		name += Choose(rng, SYLLABLES);
+	return Capitalized(name);
+}
+
+
+static QByteArray Title(GeneratorRandom &rng, int maxLength)
+{
+	QByteArray title;
+	const int numWords = rng.Range(1, 3);
+	const uint32_t style = rng.Below(10);
+	for(int i = 0; i < numWords; i++)
+	{
+		if(i)
+			title += ' ';
+		const QByteArray word = Choose(rng, TITLE_WORDS);
+		title += (style < 4) ? word : ((style < 8) ? Capitalized(word) : word.toUpper());
+	}
+	if(rng.Chance(0.1))
+		title += " " + QByteArray::number(rng.Range(1, 9));
+	return title.left(maxLength);
+}
+
+
+// Sample and instrument names are often empty or (ab)used for credits and greetings
+static QByteArray SampleName(GeneratorRandom &rng, const QByteArray &composer, const QByteArray &group, int year, int maxLength)
+{
+	const uint32_t kind = rng.Below(100);
+	QByteArray name;
+	if(kind < 35)
+	{
+		return name;
+	} else if(kind < 75)
+	{
+		if(rng.Chance(0.15))
+			name = "st-" + QByteArray::number(rng.Range(1, 99)).rightJustified(2, '0') + ":";
+		name += Choose(rng, INSTRUMENT_WORDS);
+		if(rng.Chance(0.3))
+			name += QByteArray::number(rng.Range(1, 9));
+	} else if(kind < 90)
+	{
+		name = QString(Choose(rng, CREDITS)).arg(QString(composer), QString(group), QString::number(year)).toLatin1();
+	} else
+	{
+		name = Title(rng, maxLength);
+	}
+	return name.left(maxLength);
+}
+
+
+static QByteArray Slug(const QByteArray &title)
+{
+	QByteArray slug;
+	for(const char c : title)
+	{
+		const bool alnum = std::isalnum(static_cast<unsigned char>(c)) != 0;
+		if(alnum)
+			slug += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+		else if(!slug.isEmpty() && !slug.endsWith('_'))
+			slug += '_';
+	}
+	while(slug.endsWith('_'))
+		slug.chop(1);
+	return slug.isEmpty() ? QByteArray("untitled") : slug;
+}
+
+
+LibraryGenerator::LibraryGenerator(const Options &options) : options(options)
+{
+	GeneratorRandom rng(ModuleSeed(-1, 1));
+	artists.reserve(NUM_ARTISTS);
+	for(int i = 0; i < NUM_ARTISTS; i++)
+	{
+		QByteArray artist = Name(rng);
+		if(rng.Chance(0.2))
+			artist += " " + Name(rng);
+		else if(rng.Chance(0.1))
+			artist = "DJ " + artist;
+		artists.push_back(artist);
+	}
+	groups.reserve(NUM_GROUPS);
+	for(int i = 0; i < NUM_GROUPS; i++)
+	{
+		const QByteArray name = rng.Chance(0.5) ? Capitalized(Choose(rng, TITLE_WORDS)) : Name(rng);
+		groups.push_back(name + Choose(rng, GROUP_SUFFIXES));
+	}
+
+	// Melodies with a few leaps, which are rare enough in the generated note data that the planted modules are the only hits
+	static constexpr int STEPS[] = { -7, -5, -4, -3, -2, -1, 1, 2, 3, 4, 5, 7 };
+	for(int m = 0; m < options.numMelodies; m++)
+	{
+		std::vector<uint8_t> melody(1, static_cast<uint8_t>(rng.Range(64, 70)));
+		while(melody.size() < 8)
+		{
+			melody.push_back(static_cast<uint8_t>(std::clamp(melody.back() + Choose(rng, STEPS), 55, MAX_NOTE - 4)));
+		}
+		melodies.push_back(melody);
+	}
+}
+
+
+uint64_t LibraryGenerator::ModuleSeed(int64_t index, uint64_t salt) const
+{
+	GeneratorRandom rng(options.seed ^ (static_cast<uint64_t>(index) * 0xD1B54A32D192ED03ull) ^ (salt << 56));
+	return rng.Next();
+}
+
+
+QByteArray LibraryGenerator::MelodyIntervals(int melody) const
+{
+	QByteArray intervals;
+	const auto &notes = melodies[melody];
+	for(size_t i = 1; i < notes.size(); i++)
+	{
+		intervals.push_back(static_cast<char>(notes[i] - notes[i - 1]));
+	}
+	return intervals;
+}
+
+
+LibraryGenerator::Module LibraryGenerator::GenerateModule(int64_t index) const
+{
+	GeneratorRandom rng(ModuleSeed(index, 0));
+	const double kind = rng.Uniform();
+	Module module;
+	if(index > 0 && kind < options.duplicateRate + options.variantRate)
+	{
+		// Only earlier modules are copied, so that a library can be generated in several steps
+		const int64_t original = std::min(static_cast<int64_t>(rng.Uniform() * index), index - 1);
+		module = GenerateModule(original);
+		module.original = original;
+		module.variant = kind >= options.duplicateRate;
+		if(module.variant)
+		{
+			Vary(rng, module.song);
+			Analyze(rng, module);
+		}
+	} else
+	{
+		module.song = Compose(rng);
+		Analyze(rng, module);
+	}
+	module.index = index;
+	Place(rng, module);
+	return module;
+}
+
+
+LibraryGenerator::Song LibraryGenerator::Compose(GeneratorRandom &rng) const
+{
+	Song song;
+	song.format = FORMATS[rng.Pick(FORMAT_WEIGHTS, NUM_FORMATS)];
+	const bool isMOD = (song.format == "mod"), isXM = (song.format == "xm"), isIT = (song.format == "it" || song.format == "mptm");
+	song.numChannels = isMOD ? (rng.Chance(0.9) ? 4 : rng.Range(3, 4) * 2) : CHANNELS[rng.Pick(CHANNEL_WEIGHTS, NUM_CHANNEL_CHOICES)];
+	song.speed = rng.Chance(0.7) ? 6 : rng.Range(3, 8);
+	song.tempo = rng.Chance(0.6) ? 125 : rng.Range(90, 180);
+	song.numSubSongs = rng.Chance(0.05) ? rng.Range(2, 5) : 1;
+
+	// Patterns are mostly played in order, but choruses and the like are repeated
+	const int numPatterns = std::clamp(static_cast<int>(std::lround(rng.LogNormal(16.0, 0.6))), 1, isMOD ? 64 : 128);
+	for(int p = 0; p < numPatterns; p++)
+	{
+		song.orders.push_back(static_cast<uint8_t>(p));
+		if(p > 0 && rng.Chance(0.3))
+			song.orders.push_back(static_cast<uint8_t>(rng.Below(p)));
+	}
+
+	const int key = rng.Range(0, 11);
+	const int *scale = rng.Chance(0.5) ? MAJOR_SCALE : MINOR_SCALE;
+	const int numChannels = song.numChannels;
+	std::vector<int> degree(numChannels, 3);
+	song.patterns.resize(numPatterns);
+	song.patternSeeds.resize(numPatterns);
+	for(int p = 0; p < numPatterns; p++)
+	{
+		auto &pattern = song.patterns[p];
+		pattern.assign(ROWS_PER_PATTERN * numChannels, 0);
+		song.patternSeeds[p] = rng.Next();
+		for(int c = 0; c < numChannels; c++)
+		{
+			// Channels pause every now and then
+			if(rng.Chance(0.15))
+				continue;
+			const Voice &voice = VOICES[c % NUM_VOICES];
+			const int transpose = (voice.base < 60) ? key : key % 6;
+			for(int row = 0; row < ROWS_PER_PATTERN; row += voice.step)
+			{
+				if(!rng.Chance(voice.density))
+					continue;
+				degree[c] = std::clamp(degree[c] + rng.Range(-voice.leap, voice.leap), 0, voice.maxDegree);
+				pattern[row * numChannels + c] = static_cast<uint8_t>(voice.base + transpose + 12 * (degree[c] / 7) + scale[degree[c] % 7]);
+			}
+		}
+	}
+
+	if(options.numMelodies > 0 && rng.Chance(options.melodyRate))
+	{
+		// The melody replaces one channel of a pattern, so that its notes directly follow each other in the note data
+		song.melody = static_cast<int>(rng.Below(options.numMelodies));
+		song.melodyPattern = static_cast<int>(rng.Below(numPatterns));
+		song.melodyChannel = static_cast<int>(rng.Below(numChannels));
+		const int transpose = rng.Range(0, 4);
+		auto &pattern = song.patterns[song.melodyPattern];
+		for(int row = 0; row < ROWS_PER_PATTERN; row++)
+		{
+			pattern[row * numChannels + song.melodyChannel] = 0;
+		}
+		const auto &melody = melodies[song.melody];
+		for(size_t i = 0; i < melody.size(); i++)
+		{
+			pattern[i * 4 * numChannels + song.melodyChannel] = static_cast<uint8_t>(melody[i] + transpose);
+		}
+	}
+
+	// Few artists have made most of the modules
+	const size_t composer = std::min(static_cast<size_t>(std::pow(static_cast<double>(artists.size()), rng.Uniform())) - 1, artists.size() - 1);
+	song.composer = artists[composer];
+	const QByteArray &group = groups[composer % groups.size()];
+	const int year = rng.Range(1990, 2024);
+	const int nameLength = (isMOD || isXM) ? 22 : 26;
+	song.title = Title(rng, (isMOD || isXM) ? 20 : 26);
+	if(rng.Chance(isIT ? 0.3 : 0.03))
+		song.artist = song.composer;
+
+	if(isMOD)
+	{
+		song.numSamples = 31;
+	} else if(isXM)
+	{
+		song.numInstruments = rng.Range(4, 24);
+		song.numSamples = song.numInstruments + rng.Range(0, 8);
+	} else if(isIT)
+	{
+		song.numSamples = rng.Range(4, 60);
+		song.numInstruments = rng.Chance(0.5) ? rng.Range(4, 40) : 0;
+	} else
+	{
+		song.numSamples = rng.Range(4, 31);
+	}
+	for(int i = 0; i < song.numSamples; i++)
+		song.sampleNames.push_back(SampleName(rng, song.composer, group, year, nameLength));
+	for(int i = 0; i < song.numInstruments; i++)
+		song.instrumentNames.push_back(SampleName(rng, song.composer, group, year, nameLength));
+
+	if(isIT && rng.Chance(0.4))
+	{
+		const int numLines = rng.Range(1, 6);
+		for(int i = 0; i < numLines; i++)
+		{
+			song.comments += (rng.Chance(0.5) ? Title(rng, 40) : SampleName(rng, song.composer, group, year, 40)) + "\r";
+		}
+	}
+	return song;
+}
+
+
+// Edits or transposes a few notes, like a remix or a different version of the same module would
+void LibraryGenerator::Vary(GeneratorRandom &rng, Song &song) const
+{
+	int lowest = MAX_NOTE, highest = MIN_NOTE;
+	for(const auto &pattern : song.patterns)
+	{
+		for(const auto note : pattern)
+		{
+			if(note)
+			{
+				lowest = std::min(lowest, static_cast<int>(note));
+				highest = std::max(highest, static_cast<int>(note));
+			}
+		}
+	}
+	const int transpose = rng.Chance(0.3) ? std::clamp(rng.Range(-2, 2), MIN_NOTE - lowest, MAX_NOTE - highest) : 0;
+	const int numEdits = rng.Range(1, 6);
+	const int numChannels = song.numChannels;
+	for(auto &pattern : song.patterns)
+	{
+		for(auto &note : pattern)
+		{
+			if(note)
+				note = static_cast<uint8_t>(note + transpose);
+		}
+	}
+	for(int i = 0; i < numEdits; i++)
+	{
+		const int p = static_cast<int>(rng.Below(static_cast<uint32_t>(song.patterns.size())));
+		const int c = static_cast<int>(rng.Below(numChannels));
+		const int row = static_cast<int>(rng.Below(ROWS_PER_PATTERN));
+		if(p == song.melodyPattern && c == song.melodyChannel)
+			continue;
+		uint8_t &note = song.patterns[p][row * numChannels + c];
+		note = rng.Chance(0.3) ? 0 : static_cast<uint8_t>(std::clamp((note ? note : 67) + rng.Range(-2, 2), MIN_NOTE, MAX_NOTE));
+	}
+
+	// Transposed modules sound different, edited ones only slightly
+	if(transpose)
+	{
+		for(auto &seed : song.patternSeeds)
+			seed = rng.Next();
+	}
+	song.noiseSeed = rng.Next() | 1;
+	if(rng.Chance(0.3))
+		song.title = Title(rng, song.title.size() > 20 ? 26 : 20);
+}
+
+
+// Computes what ModDatabase::Analyze would store for the module
+void LibraryGenerator::Analyze(GeneratorRandom &rng, Module &module) const
+{
+	const Song &song = module.song;
+	ExtractNotes(song, module.noteData, module.patternHash, module.noteSimHash);
+
+	const std::vector<uint32_t> fingerprint = Fingerprint(song);
+	char *encoded = nullptr;
+	int encodedSize = 0;
+	chromaprint_encode_fingerprint(fingerprint.data(), static_cast<int>(fingerprint.size()), CHROMAPRINT_ALGORITHM_DEFAULT, &encoded, &encodedSize, 0);
+	module.fingerprint = QByteArray(encoded, encodedSize);
+	chromaprint_dealloc(encoded);
+
+	module.sampleText.clear();
+	for(const auto &name : song.sampleNames)
+		module.sampleText += name + "\n";
+	module.instrumentText.clear();
+	for(const auto &name : song.instrumentNames)
+		module.instrumentText += name + "\n";
+
+	// A tick lasts 2.5 / tempo seconds
+	module.length = static_cast<int64_t>(song.orders.size()) * ROWS_PER_PATTERN * song.speed * 2500 / song.tempo;
+	const double sampleBytes = std::clamp(rng.LogNormal(80000.0, 1.0), 500.0, 8.0e6);
+	const double patternBytes = song.patterns.size() * ROWS_PER_PATTERN * song.numChannels * (song.format == "mod" ? 4.0 : 2.5);
+	module.fileSize = static_cast<int64_t>(1084.0 + patternBytes + sampleBytes + 40.0 * song.numSamples);
+
+	// Like a SHA-512 hash in Base64
+	QByteArray digest(64, '\0');
+	for(int i = 0; i < digest.size(); i += 8)
+	{
+		const uint64_t value = rng.Next();
+		for(int b = 0; b < 8; b++)
+			digest[i + b] = static_cast<char>(value >> (b * 8));
+	}
+	module.hash = digest.toBase64();
+
+	// Only newer formats know when they were last edited
+	const bool dated = (song.format == "it" || song.format == "mptm") && rng.Chance(0.4);
+	module.editDate = dated ? 1072915200 + rng.Below(662256000) : UNDATED;
+	module.loudness = std::clamp(-17.0 + 4.0 * rng.Normal(), -40.0, -4.0);
+	module.peak = std::clamp(module.loudness + 14.0 + 2.0 * rng.Normal(), -30.0, 0.0);
+	module.leadingSilence = rng.Chance(0.7) ? 0 : rng.Range(1, 1500);
+	module.trailingSilence = static_cast<int>(std::clamp(rng.LogNormal(300.0, 1.5), 0.0, 60000.0));
+	module.introLength = rng.Chance(0.8) ? 0 : rng.Range(500, 30000);
+	module.bpm = std::round(song.tempo * 60.0 / song.speed) / 10.0;
+}
+
+
+// Gives the module its own file name and date
+void LibraryGenerator::Place(GeneratorRandom &rng, Module &module) const
+{
+	const Song &song = module.song;
+	module.fileName = "/library/" + QByteArray(Choose(rng, COLLECTIONS)) + "/" + song.composer + "/"
+		+ Slug(song.title) + "_" + QByteArray::number(static_cast<qint64>(module.index)) + "." + song.format;
+	// Most modules in archives were made in the heyday of the scene
+	if(rng.Chance(0.6))
+		module.fileDate = 788918400 + rng.Below(283996800);	// 1995 - 2003
+	else
+		module.fileDate = 631152000 + rng.Below(1104537600);	// 1990 - 2024
+}
+
+
+// Same as ModDatabase::BuildNoteString
+void LibraryGenerator::ExtractNotes(const Song &song, QByteArray &notes, int64_t &patternHash, int64_t &simHash)
+{
+	static constexpr uint64_t FNV1a_BASIS = 14695981039346656037ull;
+	static constexpr uint64_t FNV1a_PRIME = 1099511628211ull;
+	uint64_t hash = FNV1a_BASIS;
+	NoteSimHash noteSimHash;
+
+	notes.clear();
+	int8_t prevNote = 0, prevNoteHash = -1;
+	const int numChannels = song.numChannels;
+	for(int c = 0; c < numChannels; c++)
+	{
+		if(prevNote)
+			notes.push_back(-prevNote);
+		for(const auto p : song.orders)
+		{
+			const uint8_t *pattern = song.patterns[p].data();
+			for(int row = 0; row < ROWS_PER_PATTERN; row++)
+			{
+				const uint8_t note = pattern[row * numChannels + c];
+				if(note)
+				{
+					notes.push_back(static_cast<int8_t>(note) - prevNote);
+					if(prevNoteHash == -1)
+						prevNoteHash = static_cast<int8_t>(note);
+					const uint8_t noteDiff = static_cast<uint8_t>(static_cast<int8_t>(note) - prevNoteHash);
+					hash = (hash ^ noteDiff) * FNV1a_PRIME;
+					noteSimHash.AddInterval(noteDiff);
+					prevNote = prevNoteHash = static_cast<int8_t>(note);
+				}
+			}
+		}
+	}
+	patternHash = static_cast<int64_t>(hash);
+	simHash = noteSimHash.IsValid() ? static_cast<int64_t>(noteSimHash.GetHash()) : 0;
+}
+
+
+// Every pattern always sounds the same, so the fingerprint repeats wherever the order list repeats a pattern
+std::vector<uint32_t> LibraryGenerator::Fingerprint(const Song &song) const
+{
+	const double patternSeconds = ROWS_PER_PATTERN * song.speed * 2.5 / song.tempo;
+	const size_t framesPerPattern = static_cast<size_t>(std::ceil(patternSeconds * FINGERPRINT_RATE));
+	std::vector<std::vector<uint32_t>> patternFrames(song.patternSeeds.size());
+	std::vector<uint32_t> fingerprint;
+	fingerprint.reserve(static_cast<size_t>(song.orders.size() * patternSeconds * FINGERPRINT_RATE) + 1);
+	double time = 0.0;
+	for(const auto p : song.orders)
+	{
+		auto &frames = patternFrames[p];
+		if(frames.empty())
+		{
+			// Consecutive sub-fingerprints only differ in a few bits, until the next note changes most of them
+			GeneratorRandom rng(song.patternSeeds[p]);
+			uint32_t value = static_cast<uint32_t>(rng.Next());
+			frames.resize(framesPerPattern);
+			for(auto &frame : frames)
+			{
+				if(rng.Below(16) == 0)
+					value = static_cast<uint32_t>(rng.Next());
+				else
+					value ^= (1u << rng.Below(32)) | (1u << rng.Below(32));
+				frame = value;
+			}
+		}
+		time += patternSeconds;
+		const size_t end = static_cast<size_t>(time * FINGERPRINT_RATE);
+		for(size_t i = 0; fingerprint.size() < end && i < frames.size(); i++)
+		{
+			fingerprint.push_back(frames[i]);
+		}
+	}
+
+	if(song.noiseSeed)
+	{
+		GeneratorRandom rng(song.noiseSeed);
+		fingerprint.erase(fingerprint.begin(), fingerprint.begin() + std::min(static_cast<size_t>(rng.Below(8)), fingerprint.size()));
+		for(auto &frame : fingerprint)
+		{
+			if(rng.Chance(0.5))
+				frame ^= 1u << rng.Below(32);
+		}
+	}
+	return fingerprint;
+}
+
+
+void LibraryGenerator::Record(Manifest &manifest, const Module &module) const
+{
+	manifest.modules++;
+	if(module.song.melody >= 0)
+	{
+		auto &melody = manifest.melodies[module.song.melody];
+		melody.modules++;
+		if(melody.examples.size() < MAX_EXAMPLES)
+			melody.examples << QString(module.fileName);
+	}
+	if(module.original >= 0)
+	{
+		(module.variant ? manifest.variants : manifest.duplicates)++;
+		auto &examples = module.variant ? manifest.variantExamples : manifest.duplicateExamples;
+		if(examples.size() < static_cast<size_t>(MAX_EXAMPLES))
+			examples.push_back({ QString(module.fileName), QString(GenerateModule(module.original).fileName) });
+	}
+}
+
+
+LibraryGenerator::Manifest LibraryGenerator::Generate(QSqlDatabase &db, int numModules, const ProgressFunc &progress)
+{
+	// The Qt driver converts every value through QVariant, which would take longer than generating the modules
+	sqlite3 *handle = ModDatabase::NativeHandle(db);
+	if(!handle)
+	{
+		throw ModDatabase::Exception("Cannot access the library: Qt's SQLite driver does not use the system SQLite library", QSqlError());
+	}
+
+	QSqlQuery query(db);
+	QStringList indexNames, indices;
+	query.exec("SELECT `name`, `sql` FROM `sqlite_master` WHERE `type` = 'index' AND `tbl_name` = 'modlib_modules' AND `sql` IS NOT NULL");
+	while(query.next())
+	{
+		indexNames << query.value(0).toString();
+		indices << query.value(1).toString();
+	}
+	// A half-written library is worthless anyway. The journal mode cannot be changed inside of a transaction.
+	// Whatever the library was opened with is restored afterwards.
+	const QString journalMode = (query.exec("PRAGMA journal_mode") && query.next()) ? query.value(0).toString() : QString();
+	const QString synchronous = (query.exec("PRAGMA synchronous") && query.next()) ? query.value(0).toString() : QString();
+	query.exec("PRAGMA synchronous = OFF");
+	query.exec("PRAGMA journal_mode = MEMORY");
+	// Cleanup happens in reverse order of declaration: The statement is finalized, an unfinished transaction is rolled back, and then the indices and journaling are restored.
+	const ScopeExit restoreLibrary([&query, &indices, &journalMode, &synchronous]()
+	{
+		for(const auto &index : indices)
+		{
+			// Fails harmlessly if the index has survived a rollback
+			query.exec(index);
+		}
+		if(!journalMode.isEmpty())
+			query.exec("PRAGMA journal_mode = " + journalMode);
+		if(!synchronous.isEmpty())
+			query.exec("PRAGMA synchronous = " + synchronous);
+	});
+
+	db.transaction();
+	bool committed = false;
+	const ScopeExit rollback([&db, &committed]()
+	{
+		if(!committed)
+			db.rollback();
+	});
+	sqlite3_stmt *insert = nullptr;
+	const ScopeExit finalize([&insert]() { sqlite3_finalize(insert); });
+
+	// Indices are much faster to create once at the end than to update for every module
+	for(const auto &name : indexNames)
+	{
+		query.exec("DROP INDEX `" + name + "`");
+	}
+
+	if(sqlite3_prepare_v2(handle, R"(
+		INSERT INTO `modlib_modules` (
+		`hash`, `filename`, `filesize`, `filedate`, `editdate`, `format`, `title`, `length`, `num_channels`, `num_patterns`, `num_orders`, `num_subsongs`, `num_samples`, `num_instruments`, `sample_text`, `instrument_text`, `comments`, `artist`, `fingerprint`, `note_data`, `pattern_hash`, `note_simhash`,
+		`loudness`, `peak`, `leading_silence`, `trailing_silence`, `intro_length`, `bpm`, `analysis_version`)
+		VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17, ?18, ?19, ?20, ?21, ?22, ?23, ?24, ?25, ?26, ?27, ?28, ?29)
+		)", -1, &insert, nullptr) != SQLITE_OK)
+	{
+		throw ModDatabase::Exception(QString("Cannot prepare insert query: %1 ").arg(sqlite3_errmsg(handle)), QSqlError());
+	}
+	const auto bindText = [insert](int column, const QByteArray &text) { sqlite3_bind_text(insert, column, text.constData(), text.size(), SQLITE_STATIC); };
+	const auto bindBlob = [insert](int column, const QByteArray &blob) { sqlite3_bind_blob(insert, column, blob.constData(), blob.size(), SQLITE_STATIC); };
+
+	Manifest manifest;
+	for(int m = 0; m < options.numMelodies; m++)
+	{
+		manifest.melodies.push_back({ MelodyIntervals(m), 0, {} });
+	}
+
+	std::vector<Module> batch;
+	batch.reserve(BATCH_SIZE);
+	for(int start = 0; start < numModules; start += BATCH_SIZE)
+	{
+		batch.resize(std::min(BATCH_SIZE, numModules - start));
+		for(size_t i = 0; i < batch.size(); i++)
+		{
+			batch[i].index = start + static_cast<int>(i);
+		}
+		QtConcurrent::blockingMap(batch, [this](Module &module)
+		{
+			module = GenerateModule(module.index);
+			// Only needed for writing module files
+			std::vector<std::vector<uint8_t>>().swap(module.song.patterns);
+		});
+
+		for(const auto &module : batch)
+		{
+			const Song &song = module.song;
+			sqlite3_reset(insert);
+			bindText(1, module.hash);
+			bindText(2, module.fileName);
+			sqlite3_bind_int64(insert, 3, module.fileSize);
+			sqlite3_bind_int64(insert, 4, module.fileDate);
+			sqlite3_bind_int64(insert, 5, module.editDate);
+			bindText(6, song.format);
+			bindText(7, song.title);
+			sqlite3_bind_int64(insert, 8, module.length);
+			sqlite3_bind_int(insert, 9, song.numChannels);
+			sqlite3_bind_int(insert, 10, static_cast<int>(song.patternSeeds.size()));
+			sqlite3_bind_int(insert, 11, static_cast<int>(song.orders.size()));
+			sqlite3_bind_int(insert, 12, song.numSubSongs);
+			sqlite3_bind_int(insert, 13, song.numSamples);
+			sqlite3_bind_int(insert, 14, song.numInstruments);
+			bindText(15, module.sampleText);
+			bindText(16, module.instrumentText);
+			bindText(17, song.comments);
+			bindText(18, song.artist);
+			bindBlob(19, module.fingerprint);
+			bindBlob(20, module.noteData);
+			sqlite3_bind_int64(insert, 21, module.patternHash);
+			sqlite3_bind_int64(insert, 22, module.noteSimHash);
+			sqlite3_bind_double(insert, 23, module.loudness);
+			sqlite3_bind_double(insert, 24, module.peak);
+			sqlite3_bind_int(insert, 25, module.leadingSilence);
+			sqlite3_bind_int(insert, 26, module.trailingSilence);
+			sqlite3_bind_int(insert, 27, module.introLength);
+			sqlite3_bind_double(insert, 28, module.bpm);
+			sqlite3_bind_int(insert, 29, AnalysisPipeline::VERSION);
+			if(sqlite3_step(insert) != SQLITE_DONE)
+			{
+				throw ModDatabase::Exception(QString("Cannot insert generated module: %1 ").arg(sqlite3_errmsg(handle)), QSqlError());
+			}
+			Record(manifest, module);
+		}
+		if(progress && !progress(QObject::tr("Generating modules..."), start + static_cast<int>(batch.size()), numModules))
+		{
+			break;
+		}
+	}
+	// Facet counts are computed when the library is opened the next time, and the generated modules are not part of any cluster yet
+	query.exec("DELETE FROM `modlib_schema` WHERE `name` = 'facets_built'");
+	query.exec("DELETE FROM `modlib_schema` WHERE `name` = 'clusters_built'");
+	sqlite3_finalize(insert);
+	insert = nullptr;
+	committed = db.commit();
+
+	if(progress)
+		progress(QObject::tr("Creating indices..."), 0, 0);
+	return manifest;
+}
+
+
+QStringList LibraryGenerator::WriteModules(const QString &directory, int count) const
+{
+	QStringList paths;
+	QDir().mkpath(directory);
+	for(int i = 0; i < count; i++)
+	{
+		const Module module = GenerateModule(i);
+		Song song = module.song;
+		if(song.orders.size() > MAX_WRITTEN_ORDERS)
+			song.orders.resize(MAX_WRITTEN_ORDERS);
+		// Everything that is not a MOD becomes an XM
+		const bool isMOD = (song.format == "mod");
+		const QString path = QDir(directory).filePath(QFileInfo(QString(module.fileName)).completeBaseName() + (isMOD ? ".mod" : ".xm"));
+		QFile file(path);
+		if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(isMOD ? EncodeMOD(song) : EncodeXM(song)) < 0)
+		{
+			continue;
+		}
+		paths << path;
+	}
+	return paths;
+}
+
+
+// One sample per voice: square bass, noise drum, triangle chords and saw lead
+static std::vector<int8_t> VoiceSample(int voice, bool &loop)
+{
+	std::vector<int8_t> sample;
+	loop = (voice != 1);
+	if(voice == 1)
+	{
+		GeneratorRandom rng(voice);
+		sample.resize(2048);
+		for(size_t i = 0; i < sample.size(); i++)
+			sample[i] = static_cast<int8_t>((static_cast<int>(rng.Below(256)) - 128) * static_cast<int>(sample.size() - i) / static_cast<int>(sample.size()));
+	} else
+	{
+		sample.resize(64);
+		for(int i = 0; i < 64; i++)
+		{
+			if(voice == 0)
+				sample[i] = (i < 32) ? 96 : -96;
+			else if(voice == 2)
+				sample[i] = static_cast<int8_t>((i < 32) ? i * 8 - 128 : 383 - i * 8);
+			else
+				sample[i] = static_cast<int8_t>(i * 4 - 128);
+		}
+	}
+	return sample;
+}
+
+
+static void WriteName(QByteArray &out, const QByteArray &name, int length)
+{
+	out += name.left(length).leftJustified(length, '\0');
+}
+
+
+static void WriteBE16(QByteArray &out, uint16_t value)
+{
+	out += static_cast<char>(value >> 8);
+	out += static_cast<char>(value & 0xFF);
+}
+
+
+static void WriteLE16(QByteArray &out, uint16_t value)
+{
+	out += static_cast<char>(value & 0xFF);
+	out += static_cast<char>(value >> 8);
+}
+
+
+static void WriteLE32(QByteArray &out, uint32_t value)
+{
+	WriteLE16(out, static_cast<uint16_t>(value));
+	WriteLE16(out, static_cast<uint16_t>(value >> 16));
+}
+
+
+// ProTracker module with the samples of the four voices
+QByteArray LibraryGenerator::EncodeMOD(const Song &song)
+{
+	const int numChannels = song.numChannels;
+	QByteArray out;
+	WriteName(out, song.title, 20);
+
+	std::vector<int8_t> samples[NUM_VOICES];
+	bool loops[NUM_VOICES];
+	for(int s = 0; s < 31; s++)
+	{
+		WriteName(out, s < static_cast<int>(song.sampleNames.size()) ? song.sampleNames[s] : QByteArray(), 22);
+		if(s < NUM_VOICES)
+		{
+			samples[s] = VoiceSample(s, loops[s]);
+			const uint16_t words = static_cast<uint16_t>(samples[s].size() / 2);
+			WriteBE16(out, words);
+			out += '\0';	// Finetune
+			out += static_cast<char>(64);	// Volume
+			WriteBE16(out, 0);
+			WriteBE16(out, loops[s] ? words : 1);
+		} else
+		{
+			WriteBE16(out, 0);
+			out += '\0';
+			out += '\0';
+			WriteBE16(out, 0);
+			WriteBE16(out, 1);
+		}
+	}
+
+	int numPatterns = 0;
+	out += static_cast<char>(song.orders.size());
+	out += static_cast<char>(127);
+	for(int o = 0; o < 128; o++)
+	{
+		const uint8_t pattern = (o < static_cast<int>(song.orders.size())) ? song.orders[o] : 0;
+		numPatterns = std::max(numPatterns, pattern + 1);
+		out += static_cast<char>(pattern);
+	}
+	out += (numChannels == 4) ? QByteArray("M.K.") : QByteArray::number(numChannels) + "CHN";
+
+	for(int p = 0; p < numPatterns; p++)
+	{
+		const auto &pattern = song.patterns[p];
+		for(int row = 0; row < ROWS_PER_PATTERN; row++)
+		{
+			for(int c = 0; c < numChannels; c++)
+			{
+				const uint8_t note = pattern[row * numChannels + c];
+				const uint16_t period = note ? PERIODS[std::clamp(static_cast<int>(note), MIN_NOTE, MAX_NOTE) - MIN_NOTE] : 0;
+				const int sample = note ? (c % NUM_VOICES) + 1 : 0;
+				// Speed and tempo are set at the start of the song
+				int effect = 0, param = 0;
+				if(p == song.orders[0] && row == 0 && c < 2)
+				{
+					effect = 0x0F;
+					param = (c == 0) ? song.speed : song.tempo;
+				}
+				out += static_cast<char>((sample & 0xF0) | (period >> 8));
+				out += static_cast<char>(period & 0xFF);
+				out += static_cast<char>(((sample & 0x0F) << 4) | effect);
+				out += static_cast<char>(param);
+			}
+		}
+	}
+
+	for(const auto &sample : samples)
+	{
+		out.append(reinterpret_cast<const char *>(sample.data()), static_cast<int>(sample.size()));
+	}
+	return out;
+}
+
+
+// FastTracker 2 module with one instrument per voice, followed by instruments that only have a name
+QByteArray LibraryGenerator::EncodeXM(const Song &song)
+{
+	const int numChannels = std::min(song.numChannels + (song.numChannels & 1), 32);
+	int numPatterns = 0;
+	for(const auto pattern : song.orders)
+		numPatterns = std::max(numPatterns, pattern + 1);
+	const int numInstruments = std::max(static_cast<int>(song.instrumentNames.size()), NUM_VOICES);
+
+	QByteArray out("Extended Module: ");
+	WriteName(out, song.title, 20);
+	out += static_cast<char>(0x1A);
+	WriteName(out, "Mod Library", 20);
+	WriteLE16(out, 0x0104);
+	WriteLE32(out, 276);	// Header size
+	WriteLE16(out, static_cast<uint16_t>(song.orders.size()));
+	WriteLE16(out, 0);	// Restart position
+	WriteLE16(out, static_cast<uint16_t>(numChannels));
+	WriteLE16(out, static_cast<uint16_t>(numPatterns));
+	WriteLE16(out, static_cast<uint16_t>(numInstruments));
+	WriteLE16(out, 1);	// Linear frequencies
+	WriteLE16(out, static_cast<uint16_t>(song.speed));
+	WriteLE16(out, static_cast<uint16_t>(song.tempo));
+	for(int o = 0; o < 256; o++)
+		out += static_cast<char>((o < static_cast<int>(song.orders.size())) ? song.orders[o] : 0);
+
+	for(int p = 0; p < numPatterns; p++)
+	{
+		const auto &pattern = song.patterns[p];
+		QByteArray packed;
+		for(int row = 0; row < ROWS_PER_PATTERN; row++)
+		{
+			for(int c = 0; c < numChannels; c++)
+			{
+				const uint8_t note = (c < song.numChannels) ? pattern[row * song.numChannels + c] : 0;
+				if(note)
+				{
+					// XM notes are one octave lower than libopenmpt's
+					packed += static_cast<char>(0x83);
+					packed += static_cast<char>(note - 12);
+					packed += static_cast<char>((c % NUM_VOICES) + 1);
+				} else
+				{
+					packed += static_cast<char>(0x80);
+				}
+			}
+		}
+		WriteLE32(out, 9);
+		out += '\0';
+		WriteLE16(out, ROWS_PER_PATTERN);
+		WriteLE16(out, static_cast<uint16_t>(packed.size()));
+		out += packed;
+	}
+
+	static constexpr int INSTRUMENT_HEADER_SIZE = 263;
+	for(int i = 0; i < numInstruments; i++)
+	{
+		const int headerStart = out.size();
+		const bool hasSample = (i < NUM_VOICES);
+		WriteLE32(out, INSTRUMENT_HEADER_SIZE);
+		WriteName(out, i < static_cast<int>(song.instrumentNames.size()) ? song.instrumentNames[i] : QByteArray(), 22);
+		out += '\0';
+		WriteLE16(out, hasSample ? 1 : 0);
+		WriteLE32(out, 40);	// Sample header size
+		// Sample map, envelopes, vibrato and fadeout all stay at zero
+		out += QByteArray(headerStart + INSTRUMENT_HEADER_SIZE - out.size(), '\0');
+		if(!hasSample)
+		{
+			continue;
+		}
+
+		bool loop = false;
+		const std::vector<int8_t> sample = VoiceSample(i, loop);
+		WriteLE32(out, static_cast<uint32_t>(sample.size()));
+		WriteLE32(out, 0);
+		WriteLE32(out, loop ? static_cast<uint32_t>(sample.size()) : 0);
+		out += static_cast<char>(64);	// Volume
+		out += '\0';	// Finetune
+		out += static_cast<char>(loop ? 1 : 0);
+		out += static_cast<char>(128);	// Panning
+		out += '\0';	// Relative note
+		out += '\0';
+		WriteName(out, i < static_cast<int>(song.sampleNames.size()) ? song.sampleNames[i] : QByteArray(), 22);
+		// Sample data is stored as deltas
+		int8_t previous = 0;
+		for(const auto value : sample)
+		{
+			out += static_cast<char>(static_cast<int8_t>(value - previous));
+			previous = value;
+		}
+	}
+	return out;
+}
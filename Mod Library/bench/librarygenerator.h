@@ -0,0 +1,154 @@
+/*
+ * librarygenerator.h
+ * ------------------
+ * Purpose: Synthetic module libraries and module files for scale testing.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QtSql/QSqlDatabase>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Small and fast, and unlike the standard engines and distributions, Next, Below, Range, Uniform and Chance produce the same numbers on every platform.
+// Normal and LogNormal go through the math library, whose results may differ in the last bits between C runtimes.
+class GeneratorRandom
+{
+protected:
+	uint64_t state;
+
+public:
+	explicit GeneratorRandom(uint64_t seed) : state(seed) { }
+
+	// splitmix64
+	uint64_t Next()
+	{
+		uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+	// 0 <= value < n
+	uint32_t Below(uint32_t n) { return static_cast<uint32_t>(((Next() >> 32) * n) >> 32); }
+	int Range(int min, int max) { return min + static_cast<int>(Below(static_cast<uint32_t>(max - min + 1))); }
+	double Uniform() { return (Next() >> 11) * (1.0 / 9007199254740992.0); }
+	bool Chance(double probability) { return Uniform() < probability; }
+	double Normal();
+	double LogNormal(double median, double sigma);
+	// Index into a list of weights
+	int Pick(const int *weights, int count);
+};
+
+
+// Produces libraries that resemble real ones as far as the search, duplicate detection and ingest code can tell:
+// pattern data is composed from repeated patterns, so that note data, pattern hashes and similarity hashes
+// are computed exactly as BuildNoteString would, and fingerprints repeat wherever the order list repeats a pattern.
+// Some modules are exact copies of earlier ones, some are edited or transposed variants, and some contain one
+// of a few planted melodies. Every module only depends on the seed and its index, so the result does not depend on
+// how many threads generate it. As some distributions use floating-point math functions, identical libraries are
+// only guaranteed for the same build; other platforms produce libraries with the same statistics.
+class LibraryGenerator
+{
+public:
+	static constexpr int ROWS_PER_PATTERN = 64;
+	// Written module files are cut off after this many orders to keep them small
+	static constexpr int MAX_WRITTEN_ORDERS = 16;
+	// Number of examples of every planted feature listed in the manifest
+	static constexpr int MAX_EXAMPLES = 100;
+
+	struct Options
+	{
+		uint64_t seed = 1;
+		double duplicateRate = 0.04;	// Exact copies of an earlier module under another file name
+		double variantRate = 0.03;	// Edited or transposed copies of an earlier module
+		double melodyRate = 0.002;	// Modules containing one of the planted melodies
+		int numMelodies = 16;
+	};
+
+	// Return false from the progress callback to cancel the operation.
+	using ProgressFunc = std::function<bool(const QString &status, int value, int maximum)>;
+
+	// What was planted where, so that tests know which results to expect
+	struct Manifest
+	{
+		struct Melody
+		{
+			QByteArray intervals;	// As entered into the melody search
+			int64_t modules = 0;
+			QStringList examples;
+		};
+
+		int64_t modules = 0;
+		std::vector<Melody> melodies;
+		int64_t duplicates = 0, variants = 0;
+		std::vector<std::pair<QString, QString>> duplicateExamples, variantExamples;	// Copy and original
+	};
+
+	// Pattern data and metadata of a module
+	struct Song
+	{
+		QByteArray format;
+		int numChannels = 4, speed = 6, tempo = 125;
+		int numSamples = 0, numInstruments = 0, numSubSongs = 1;
+		std::vector<uint8_t> orders;
+		std::vector<std::vector<uint8_t>> patterns;	// ROWS_PER_PATTERN * numChannels notes each; 0 = no note, otherwise libopenmpt note numbers
+		std::vector<uint64_t> patternSeeds;	// Fingerprint of every pattern
+		QByteArray title, composer, artist, comments;	// The artist is only known if the module says so
+		std::vector<QByteArray> sampleNames, instrumentNames;
+		int melody = -1, melodyPattern = -1, melodyChannel = -1;
+		uint64_t noiseSeed = 0;	// Variants sound slightly different, 0 = no noise
+	};
+
+	// Everything stored in modlib_modules for one module
+	struct Module
+	{
+		int64_t index = 0;
+		int64_t original = -1;	// Module that this one is a copy or variant of
+		bool variant = false;
+		Song song;
+		QByteArray hash, fileName, sampleText, instrumentText, noteData, fingerprint;
+		int64_t fileSize = 0, fileDate = 0, editDate = 0, length = 0, patternHash = 0, noteSimHash = 0;
+		double loudness = 0.0, peak = 0.0, bpm = 0.0;
+		int leadingSilence = 0, trailingSilence = 0, introLength = 0;
+	};
+
+protected:
+	Options options;
+	std::vector<QByteArray> artists, groups;
+	std::vector<std::vector<uint8_t>> melodies;	// Absolute notes
+
+public:
+	LibraryGenerator(const Options &options);
+
+	const Options &GetOptions() const { return options; }
+	QByteArray MelodyIntervals(int melody) const;
+
+	// Thread-safe
+	Module GenerateModule(int64_t index) const;
+	std::vector<uint32_t> Fingerprint(const Song &song) const;
+
+	// Adds the given number of modules to an open library
+	Manifest Generate(QSqlDatabase &db, int numModules, const ProgressFunc &progress);
+
+	// Writes the first modules as small MOD or XM files and returns their paths
+	QStringList WriteModules(const QString &directory, int count) const;
+	static QByteArray EncodeMOD(const Song &song);
+	static QByteArray EncodeXM(const Song &song);
+
+protected:
+	Song Compose(GeneratorRandom &rng) const;
+	void Vary(GeneratorRandom &rng, Song &song) const;
+	void Analyze(GeneratorRandom &rng, Module &module) const;
+	void Place(GeneratorRandom &rng, Module &module) const;
+	void Record(Manifest &manifest, const Module &module) const;
+	static void ExtractNotes(const Song &song, QByteArray &notes, int64_t &patternHash, int64_t &simHash);
+	uint64_t ModuleSeed(int64_t index, uint64_t salt) const;
+};
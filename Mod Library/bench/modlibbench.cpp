@@ -0,0 +1,799 @@
+/*
+ * modlibbench.cpp
+ * ---------------
+ * Purpose: Benchmarks of the search and ingest hot paths, with a regression check for automated runs.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <vector>
+#include <chromaprint.h>
+#include <libopenmpt/libopenmpt.hpp>
+#include "analyzers.h"
+#include "database.h"
+#include "fingerprint.h"
+#include "librarygenerator.h"
+#include "modulecache.h"
+#include "notesimilarity.h"
+#include "sqlregexp.h"
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define MODLIB_BENCH_SSSE3
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+// Version of the JSON output
+static constexpr int RESULT_FORMAT = 1;
+// Same values as the search worker
+static constexpr size_t MAX_FINGERPRINT_CANDIDATES = 1000;
+static constexpr int MIN_FINGERPRINT_HITS = 2;
+static constexpr size_t MAX_FINGERPRINT_MATCHES = 100;
+// Chromaprint produces about eight sub-fingerprints per second of audio
+static constexpr double FINGERPRINT_RATE = 8.0;
+
+static const char *const WORDS[] =
+{
+	"acid", "alien", "amiga", "angel", "bass", "beat", "blue", "boogie", "chip", "cosmic", "crystal", "dance", "dark", "dream", "echo", "electric",
+	"fantasy", "fire", "funk", "galaxy", "groove", "happy", "heaven", "intro", "jungle", "laser", "love", "magic", "melody", "mega", "night", "ocean",
+	"party", "power", "rain", "rave", "remix", "shadow", "space", "speed", "star", "storm", "summer", "techno", "theme", "trance", "tune", "vision",
+	"wave", "winter", "zone",
+};
+static constexpr int NUM_WORDS = static_cast<int>(std::size(WORDS));
+
+
+// Keeps the compiler from optimizing away results that are not used otherwise
+static volatile int64_t sink = 0;
+
+
+struct Result
+{
+	QString name;
+	QString unit;	// What the throughput is counted in
+	std::vector<double> seconds;	// Duration of every iteration
+	double items = 0.0;	// Processed over all iterations
+
+	double TotalSeconds() const { return std::accumulate(seconds.begin(), seconds.end(), 0.0); }
+	double Throughput() const
+	{
+		const double total = TotalSeconds();
+		return total > 0.0 ? items / total : 0.0;
+	}
+
+	// Nearest-rank percentile of the iteration durations in milliseconds
+	double Percentile(double percent) const
+	{
+		if(seconds.empty())
+			return 0.0;
+		std::vector<double> sorted = seconds;
+		std::sort(sorted.begin(), sorted.end());
+		const size_t rank = static_cast<size_t>(std::ceil(percent / 100.0 * sorted.size()));
+		return sorted[std::clamp(rank, size_t(1), sorted.size()) - 1] * 1000.0;
+	}
+};
+
+
+// Passed to every iteration, so that it can exclude its setup and teardown from the measurement
+struct Iteration
+{
+	int index;
+	Clock::time_point start, end;
+
+	void Restart() { start = Clock::now(); }
+	void Stop() { end = Clock::now(); }
+};
+
+
+class Benchmarks
+{
+protected:
+	QRegularExpression filter;
+	std::vector<Result> results;
+	QTextStream out;
+
+public:
+	Benchmarks(const QString &filter) : filter(filter), out(stdout) { }
+
+	bool Enabled(const QString &name) const { return filter.match(name).hasMatch(); }
+	const std::vector<Result> &GetResults() const { return results; }
+
+	// Calls func the given number of times. It returns the number of items that were processed in that iteration.
+	template<typename Func>
+	void Run(const QString &name, const QString &unit, int iterations, Func &&func)
+	{
+		if(!Enabled(name) || iterations <= 0)
+		{
+			return;
+		}
+		Result result;
+		result.name = name;
+		result.unit = unit;
+		result.seconds.reserve(iterations);
+		for(int i = 0; i < iterations; i++)
+		{
+			Iteration iteration{ i, Clock::now(), Clock::time_point() };
+			const double items = func(iteration);
+			if(iteration.end == Clock::time_point())
+				iteration.Stop();
+			result.seconds.push_back(std::chrono::duration<double>(iteration.end - iteration.start).count());
+			result.items += items;
+		}
+		Print(result);
+		results.push_back(std::move(result));
+	}
+
+	void PrintHeader()
+	{
+		out << QString("%1 %2 %3 %4 %5 %6\n").arg("Benchmark", -32).arg("Iterations", 10).arg("Throughput", 28).arg("p50 ms", 10).arg("p90 ms", 10).arg("p99 ms", 10);
+		out.flush();
+	}
+
+	void Print(const Result &result)
+	{
+		const QString throughput = QString::number(result.Throughput(), 'g', 4) + " " + result.unit + "/s";
+		out << QString("%1 %2 %3 %4 %5 %6\n").arg(result.name, -32).arg(result.seconds.size(), 10).arg(throughput, 28)
+			.arg(result.Percentile(50), 10, 'f', 3).arg(result.Percentile(90), 10, 'f', 3).arg(result.Percentile(99), 10, 'f', 3);
+		out.flush();
+	}
+};
+
+
+static QJsonObject ToJson(const Result &result)
+{
+	QJsonObject object;
+	object["name"] = result.name;
+	object["unit"] = result.unit;
+	object["iterations"] = static_cast<int>(result.seconds.size());
+	object["items"] = result.items;
+	object["seconds"] = result.TotalSeconds();
+	object["throughput"] = result.Throughput();
+	object["p50_ms"] = result.Percentile(50);
+	object["p90_ms"] = result.Percentile(90);
+	object["p99_ms"] = result.Percentile(99);
+	return object;
+}
+
+
+static bool ReadJson(const QString &fileName, QJsonObject &object)
+{
+	QFile file(fileName);
+	if(!file.open(QIODevice::ReadOnly))
+	{
+		return false;
+	}
+	QJsonParseError error;
+	const QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &error);
+	if(error.error != QJsonParseError::NoError || !document.isObject())
+	{
+		return false;
+	}
+	object = document.object();
+	return true;
+}
+
+
+// Prints how much faster or slower every benchmark is compared to an earlier run.
+// Fails if the throughput of any benchmark dropped by more than maxSlowdown percent; a negative value disables the check.
+static bool Compare(const std::vector<Result> &results, const QJsonObject &baseline, double maxSlowdown)
+{
+	QTextStream out(stdout);
+	out << "\nCompared to baseline:\n";
+	bool passed = true;
+	const QJsonArray baselineResults = baseline["results"].toArray();
+	for(const auto &result : results)
+	{
+		const auto old = std::find_if(baselineResults.begin(), baselineResults.end(), [&result](const QJsonValue &v) { return v.toObject()["name"].toString() == result.name; });
+		if(old == baselineResults.end())
+		{
+			out << QString("%1 %2\n").arg(result.name, -32).arg("new");
+			continue;
+		}
+		const double oldThroughput = (*old).toObject()["throughput"].toDouble();
+		const double change = oldThroughput > 0.0 ? (result.Throughput() / oldThroughput - 1.0) * 100.0 : 0.0;
+		const bool failed = maxSlowdown >= 0.0 && change < -maxSlowdown;
+		out << QString("%1 %2%3%%4\n").arg(result.name, -32).arg(change >= 0.0 ? "+" : "").arg(change, 0, 'f', 1).arg(failed ? " FAILED" : "");
+		passed = passed && !failed;
+	}
+	return passed;
+}
+
+
+// Thresholds are given per benchmark as any of min_throughput, max_p50_ms, max_p90_ms and max_p99_ms.
+// They have to hold on any machine the test runs on, so they only catch order-of-magnitude regressions.
+// Smaller regressions are found by comparing with a baseline from the same machine (--compare with --max-slowdown).
+// Benchmarks that were not run (e.g. because there is no corpus) are not checked.
+static bool Check(const std::vector<Result> &results, const QJsonObject &thresholds)
+{
+	QTextStream out(stdout);
+	out << "\nRegression check:\n";
+	bool passed = true;
+	for(auto threshold = thresholds.begin(); threshold != thresholds.end(); threshold++)
+	{
+		const auto result = std::find_if(results.begin(), results.end(), [&threshold](const Result &r) { return r.name == threshold.key(); });
+		if(result == results.end())
+		{
+			out << QString("%1 skipped\n").arg(threshold.key(), -32);
+			continue;
+		}
+		const QJsonObject limits = threshold.value().toObject();
+		QStringList failures;
+		if(limits.contains("min_throughput") && result->Throughput() < limits["min_throughput"].toDouble())
+			failures << QString("throughput %1 < %2").arg(result->Throughput()).arg(limits["min_throughput"].toDouble());
+		for(const int percentile : { 50, 90, 99 })
+		{
+			const QString key = QString("max_p%1_ms").arg(percentile);
+			if(limits.contains(key) && result->Percentile(percentile) > limits[key].toDouble())
+				failures << QString("p%1 %2 ms > %3 ms").arg(percentile).arg(result->Percentile(percentile)).arg(limits[key].toDouble());
+		}
+		out << QString("%1 %2\n").arg(threshold.key(), -32).arg(failures.isEmpty() ? QString("ok") : "FAILED: " + failures.join(", "));
+		passed = passed && failures.isEmpty();
+	}
+	return passed;
+}
+
+
+// Consecutive sub-fingerprints of real audio only differ in a few bits, until the next note changes most of them.
+static std::vector<uint32_t> RandomFingerprint(std::mt19937 &rng, int length)
+{
+	std::vector<uint32_t> fingerprint(length);
+	uint32_t value = rng();
+	for(auto &subFingerprint : fingerprint)
+	{
+		if(rng() % 32 == 0)
+			value = rng();
+		else
+			value ^= (1u << (rng() % 32)) | (1u << (rng() % 32));
+		subFingerprint = value;
+	}
+	return fingerprint;
+}
+
+
+// Cuts a piece out of a fingerprint and adds some noise, like a different rendering of the same song would
+static std::vector<uint32_t> Excerpt(std::mt19937 &rng, const std::vector<uint32_t> &fingerprint, int length, int noiseBits)
+{
+	const int start = static_cast<int>(rng() % std::max(static_cast<int>(fingerprint.size()) - length, 1));
+	std::vector<uint32_t> excerpt(fingerprint.begin() + start, fingerprint.begin() + std::min(start + length, static_cast<int>(fingerprint.size())));
+	for(auto &subFingerprint : excerpt)
+	{
+		for(int i = 0; i < noiseBits; i++)
+			subFingerprint ^= 1u << (rng() % 32);
+	}
+	return excerpt;
+}
+
+
+// Fingerprint excerpts of some of the generated modules and the planted melodies, which the fingerprint and melody searches look for
+struct SyntheticLibrary
+{
+	std::vector<std::vector<uint32_t>> fingerprints;
+	std::vector<QByteArray> melodies;
+};
+
+
+// Fills the library with plausible modules, so that the queries see realistic row sizes and selectivities
+static SyntheticLibrary PopulateLibrary(QSqlDatabase &db, LibraryGenerator &generator, int rows, std::mt19937 &rng)
+{
+	SyntheticLibrary library;
+	const LibraryGenerator::Manifest manifest = generator.Generate(db, rows, nullptr);
+	for(const auto &melody : manifest.melodies)
+	{
+		library.melodies.push_back(melody.intervals);
+	}
+	const int sampleEvery = std::max(rows / 200, 1);
+	for(int row = 0; row < rows; row += sampleEvery)
+	{
+		const std::vector<uint32_t> fingerprint = generator.Fingerprint(generator.GenerateModule(row).song);
+		library.fingerprints.push_back(Excerpt(rng, fingerprint, static_cast<int>(30 * FINGERPRINT_RATE), 2));
+	}
+	return library;
+}
+
+
+struct CorpusModule
+{
+	QString path;
+	QByteArray content;
+	double duration;
+};
+
+
+// Returns the modules that libopenmpt can load, in a stable order
+static std::vector<CorpusModule> LoadCorpus(const QString &directory, int maxFiles)
+{
+	QStringList paths;
+	QDirIterator it(directory, QDir::Files, QDirIterator::Subdirectories);
+	while(it.hasNext())
+	{
+		paths << it.next();
+	}
+	paths.sort();
+
+	std::vector<CorpusModule> corpus;
+	for(const auto &path : paths)
+	{
+		if(static_cast<int>(corpus.size()) >= maxFiles)
+		{
+			break;
+		}
+		QFile file(path);
+		if(!file.open(QIODevice::ReadOnly))
+		{
+			continue;
+		}
+		const QByteArray content = file.readAll();
+		try
+		{
+			std::ostringstream log;
+			openmpt::module mod(content.cbegin(), content.cend(), log);
+			corpus.push_back({ path, content, mod.get_duration_seconds() });
+		} catch(openmpt::exception &)
+		{
+		}
+	}
+	return corpus;
+}
+
+
+static int HammingDistanceTable(const uint32_t *a, const uint32_t *b, int length)
+{
+	static const auto table = []
+	{
+		std::array<uint8_t, 256> bits;
+		for(int i = 0; i < 256; i++)
+			bits[i] = static_cast<uint8_t>((i & 1) + (i >> 1 & 1) + (i >> 2 & 1) + (i >> 3 & 1) + (i >> 4 & 1) + (i >> 5 & 1) + (i >> 6 & 1) + (i >> 7 & 1));
+		return bits;
+	}();
+	int differences = 0;
+	for(int i = 0; i < length; i++)
+	{
+		const uint32_t v = a[i] ^ b[i];
+		differences += table[v & 0xFF] + table[(v >> 8) & 0xFF] + table[(v >> 16) & 0xFF] + table[v >> 24];
+	}
+	return differences;
+}
+
+
+// Counts the bits of two sub-fingerprints at once without any special instructions
+static int HammingDistanceSwar(const uint32_t *a, const uint32_t *b, int length)
+{
+	int differences = 0;
+	int i = 0;
+	for(; i + 2 <= length; i += 2)
+	{
+		uint64_t x, y;
+		std::memcpy(&x, a + i, sizeof(x));
+		std::memcpy(&y, b + i, sizeof(y));
+		uint64_t v = x ^ y;
+		v = v - ((v >> 1) & 0x5555555555555555ull);
+		v = (v & 0x3333333333333333ull) + ((v >> 2) & 0x3333333333333333ull);
+		v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+		differences += static_cast<int>((v * 0x0101010101010101ull) >> 56);
+	}
+	if(i < length)
+	{
+		differences += HammingDistanceTable(a + i, b + i, length - i);
+	}
+	return differences;
+}
+
+
+#ifdef MODLIB_BENCH_SSSE3
+// Looks up the bit counts of all nibbles of four sub-fingerprints at once
+static int HammingDistanceSsse3(const uint32_t *a, const uint32_t *b, int length)
+{
+	const __m128i lookup = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m128i lowMask = _mm_set1_epi8(0x0F);
+	__m128i total = _mm_setzero_si128();
+	int i = 0;
+	for(; i + 4 <= length; i += 4)
+	{
+		const __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+		const __m128i counts = _mm_add_epi8(_mm_shuffle_epi8(lookup, _mm_and_si128(v, lowMask)), _mm_shuffle_epi8(lookup, _mm_and_si128(_mm_srli_epi16(v, 4), lowMask)));
+		total = _mm_add_epi64(total, _mm_sad_epu8(counts, _mm_setzero_si128()));
+	}
+	int differences = _mm_cvtsi128_si32(_mm_add_epi64(total, _mm_srli_si128(total, 8)));
+	if(i < length)
+	{
+		differences += HammingDistanceTable(a + i, b + i, length - i);
+	}
+	return differences;
+}
+#endif
+
+
+// Fingerprint scoring on synthetic fingerprints: the bit counting variants on their own, and the complete comparison.
+// All bit counting variants must agree with the one used by FingerprintMatcher.
+static bool BenchFingerprints(Benchmarks &bench, std::mt19937 &rng, int iterations)
+{
+	static constexpr int LENGTH = 1024, NUM_CANDIDATES = 256;
+	const std::vector<uint32_t> query = RandomFingerprint(rng, LENGTH);
+	std::vector<std::vector<uint32_t>> candidates;
+	for(int i = 0; i < NUM_CANDIDATES; i++)
+	{
+		// Half of them are noisy copies of the query, like the candidates proposed by the fingerprint index
+		candidates.push_back((i % 2) ? Excerpt(rng, query, LENGTH, 3) : RandomFingerprint(rng, LENGTH));
+	}
+
+	std::vector<std::pair<QString, int64_t>> checksums;
+	const auto hamming = [&](const QString &name, auto distance)
+	{
+		int64_t checksum = 0;
+		bench.Run("fingerprint/" + name, "sub-fingerprints", iterations, [&](Iteration &)
+		{
+			checksum = 0;
+			for(const auto &candidate : candidates)
+				checksum += distance(query.data(), candidate.data(), LENGTH);
+			sink += checksum;
+			return static_cast<double>(LENGTH) * NUM_CANDIDATES;
+		});
+		if(bench.Enabled("fingerprint/" + name))
+			checksums.push_back({ name, checksum });
+	};
+	hamming("hamming_table", HammingDistanceTable);
+	hamming("hamming_swar", HammingDistanceSwar);
+#ifdef MODLIB_BENCH_SSSE3
+	hamming("hamming_ssse3", HammingDistanceSsse3);
+#endif
+	hamming("hamming_popcount", [](const uint32_t *a, const uint32_t *b, int length) { return FingerprintMatcher::HammingDistance(a, b, length); });
+
+	const FingerprintMatcher matcher(query.data(), LENGTH);
+	bench.Run("fingerprint/compare", "comparisons", iterations, [&](Iteration &)
+	{
+		for(const auto &candidate : candidates)
+			sink += matcher.Compare(candidate.data(), static_cast<int>(candidate.size()));
+		return static_cast<double>(NUM_CANDIDATES);
+	});
+
+	bool agree = true;
+	for(const auto &checksum : checksums)
+	{
+		if(checksum.second != checksums.front().second)
+		{
+			QTextStream(stderr) << "fingerprint/" << checksum.first << " disagrees with fingerprint/" << checksums.front().first << "\n";
+			agree = false;
+		}
+	}
+	return agree;
+}
+
+
+// The queries built by ModLibrary::DoSearch and the fingerprint lookup of SearchWorker, on the synthetic library
+static void BenchSearch(Benchmarks &bench, QSqlDatabase &db, const SyntheticLibrary &library, std::mt19937 &rng, int iterations)
+{
+	const auto runQuery = [&db](const QString &sql, const std::vector<std::pair<QString, QVariant>> &bindValues)
+	{
+		QSqlQuery query(db);
+		query.setForwardOnly(true);
+		query.prepare(sql);
+		for(const auto &value : bindValues)
+		{
+			query.bindValue(value.first, value.second);
+		}
+		if(!query.exec())
+		{
+			throw ModDatabase::Exception("Cannot run benchmark query: ", query.lastError());
+		}
+		int64_t rows = 0;
+		while(query.next())
+		{
+			rows += query.value(0).toLongLong();
+		}
+		sink += rows;
+		return 1.0;
+	};
+	const QString select = "SELECT `rowid` FROM `modlib_modules` ";
+	const auto textCondition = [](std::initializer_list<const char *> columns)
+	{
+		QString condition = "(0 ";
+		for(const char *column : columns)
+			condition += QString("OR `") + column + "` LIKE :str ESCAPE '\\' ";
+		return condition + ") ";
+	};
+	const QString defaultColumns = textCondition({ "filename", "title", "artist", "sample_text", "instrument_text" });
+
+	bench.Run("sql/text", "queries", iterations, [&](Iteration &)
+	{
+		return runQuery(select + "WHERE " + defaultColumns, { { ":str", QString("%") + WORDS[rng() % NUM_WORDS] + "%" } });
+	});
+
+	bench.Run("sql/text_sorted", "queries", iterations, [&](Iteration &)
+	{
+		return runQuery(select + "WHERE " + textCondition({ "title" }) + "ORDER BY `filesize` ", { { ":str", QString("%") + WORDS[rng() % NUM_WORDS] + "%" } });
+	});
+
+	bench.Run("sql/regexp", "queries", iterations, [&](Iteration &)
+	{
+		const QString pattern = QString(WORDS[rng() % NUM_WORDS]) + "\\s+\\w+";
+		const QString literal = SqlRegexp::RequiredLiteral(pattern);
+		return runQuery(select + "WHERE (0 OR (`title` LIKE :literal ESCAPE '\\' AND `title` REGEXP :str) OR (`sample_text` LIKE :literal ESCAPE '\\' AND `sample_text` REGEXP :str)) ",
+			{ { ":str", pattern }, { ":literal", "%" + literal + "%" } });
+	});
+
+	bench.Run("sql/filters", "queries", iterations, [&](Iteration &)
+	{
+		const int channels = 4 + rng() % 8;
+		return runQuery(select + "WHERE " + textCondition({ "title" })
+			+ "AND (`filesize` BETWEEN 10000 AND 500000) "
+			+ "AND (`format` IN ('xm','it')) "
+			+ "AND (`num_channels` BETWEEN " + QString::number(channels) + " AND " + QString::number(channels + 4) + ") ",
+			{ { ":str", "%%" } });
+	});
+
+	bench.Run("sql/melody", "queries", iterations, [&](Iteration &)
+	{
+		const QByteArray &melody = library.melodies[rng() % library.melodies.size()];
+		return runQuery(select + "WHERE " + defaultColumns + "AND INSTR(`note_data`, X'" + QString::fromLatin1(melody.toHex()) + "') > 0 ", { { ":str", "%%" } });
+	});
+
+	// Candidates from the sub-fingerprint index, followed by a top-K comparison of their stored fingerprints
+	auto &index = FingerprintIndex::Instance();
+	if(bench.Enabled("sql/fingerprint"))
+	{
+		index.Clear();
+		index.Build(db);
+	}
+	bench.Run("sql/fingerprint", "queries", iterations, [&](Iteration &)
+	{
+		const std::vector<uint32_t> &fingerprint = library.fingerprints[rng() % library.fingerprints.size()];
+		const int size = static_cast<int>(fingerprint.size());
+		const auto candidates = index.Query(fingerprint.data(), size, MAX_FINGERPRINT_CANDIDATES, MIN_FINGERPRINT_HITS);
+		if(candidates.empty())
+		{
+			return 1.0;
+		}
+		QStringList ids;
+		for(const auto &candidate : candidates)
+		{
+			ids << QString::number(candidate.id);
+		}
+
+		QSqlQuery query(db);
+		query.setForwardOnly(true);
+		if(!query.exec("SELECT `rowid`, `fingerprint` FROM `modlib_modules` WHERE `rowid` IN (" + ids.join(',') + ")"))
+		{
+			throw ModDatabase::Exception("Cannot run benchmark query: ", query.lastError());
+		}
+		const FingerprintMatcher matcher(fingerprint.data(), size);
+		std::priority_queue<int, std::vector<int>, std::greater<int>> best;
+		while(query.next())
+		{
+			const QByteArray modFingerprint = query.value(1).toByteArray();
+			uint32_t *modRawFingerprint = nullptr;
+			int modRawFingerprintSize = 0;
+			chromaprint_decode_fingerprint(modFingerprint.constData(), modFingerprint.size(), &modRawFingerprint, &modRawFingerprintSize, nullptr, 0);
+			const int minMatch = (best.size() < MAX_FINGERPRINT_MATCHES) ? 0 : best.top() + 1;
+			const int match = matcher.Compare(modRawFingerprint, modRawFingerprintSize, minMatch);
+			chromaprint_dealloc(modRawFingerprint);
+			if(match < minMatch)
+				continue;
+			if(best.size() == MAX_FINGERPRINT_MATCHES)
+				best.pop();
+			best.push(match);
+		}
+		sink += best.size();
+		return 1.0;
+	});
+}
+
+
+// Hot paths that need real modules: note extraction, the analysis render pass and adding modules to the library
+static void BenchCorpus(Benchmarks &bench, const std::vector<CorpusModule> &corpus, int rounds)
+{
+	const int iterations = static_cast<int>(corpus.size()) * rounds;
+	const auto moduleOf = [&corpus](const Iteration &iteration) -> const CorpusModule & { return corpus[iteration.index % corpus.size()]; };
+
+	bench.Run("notes/build_note_string", "modules", iterations, [&](Iteration &iteration)
+	{
+		const CorpusModule &module = moduleOf(iteration);
+		std::ostringstream log;
+		openmpt::module mod(module.content.cbegin(), module.content.cend(), log);
+		QByteArray notes;
+		NoteSimHash simHash;
+		iteration.Restart();
+		sink += ModDatabase::BuildNoteString(mod, notes, simHash) + notes.size();
+		iteration.Stop();
+		return 1.0;
+	});
+
+	bench.Run("render/chromaprint", "audio seconds", iterations, [&](Iteration &iteration)
+	{
+		const CorpusModule &module = moduleOf(iteration);
+		std::ostringstream log;
+		openmpt::module mod(module.content.cbegin(), module.content.cend(), log);
+		AnalysisPipeline pipeline;
+		const auto &chromaprint = pipeline.Add<ChromaprintAnalyzer>();
+		iteration.Restart();
+		pipeline.Run(mod);
+		iteration.Stop();
+		sink += chromaprint.GetFingerprint().size();
+		return module.duration;
+	});
+
+	bench.Run("render/analysis", "audio seconds", iterations, [&](Iteration &iteration)
+	{
+		const CorpusModule &module = moduleOf(iteration);
+		ModuleAnalysis analysis;
+		iteration.Restart();
+		ModDatabase::Analyze(module.path, module.content, QString(), analysis);
+		iteration.Stop();
+		sink += analysis.fingerprint.size();
+		return module.duration;
+	});
+
+	// Without the module cache, just like the first time a file is added
+	auto &database = ModDatabase::Instance();
+	bench.Run("ingest/add_module", "modules", iterations, [&](Iteration &iteration)
+	{
+		const CorpusModule &module = moduleOf(iteration);
+		database.RemoveModule(module.path);
+		ModuleCache::Instance().Clear();
+		iteration.Restart();
+		sink += database.AddModule(module.path);
+		iteration.Stop();
+		return 1.0;
+	});
+}
+
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("modlib-bench");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Benchmarks of the Mod Library search and ingest hot paths.");
+	parser.addHelpOption();
+	const QCommandLineOption corpusOption("corpus", "Directory of modules for the note, render and ingest benchmarks.", "directory");
+	const QCommandLineOption generateCorpusOption("generate-corpus", "Write this many generated modules and use them as the corpus.", "count");
+	const QCommandLineOption maxFilesOption("max-files", "Maximum number of corpus modules to use (default: 200, quick: 20).", "count");
+	const QCommandLineOption rowsOption("rows", "Number of modules in the synthetic library (default: 50000, quick: 10000).", "count");
+	const QCommandLineOption iterationsOption("iterations", "Iterations of every synthetic benchmark (default: 100, quick: 20).", "count");
+	const QCommandLineOption roundsOption("rounds", "How often every corpus module is processed (default: 3, quick: 1).", "count");
+	const QCommandLineOption seedOption("seed", "Seed of the synthetic data (default: 1).", "seed", "1");
+	const QCommandLineOption filterOption("filter", "Only run benchmarks whose name matches this regular expression.", "regex");
+	const QCommandLineOption quickOption("quick", "Smaller library and fewer iterations, as used by the regression test.");
+	const QCommandLineOption jsonOption("json", "Write the results to this file.", "file");
+	const QCommandLineOption compareOption("compare", "Compare the throughput with the results of an earlier run.", "file");
+	const QCommandLineOption maxSlowdownOption("max-slowdown", "With --compare, fail if any throughput dropped by more than this many percent.", "percent");
+	const QCommandLineOption checkOption("check", "Fail if any result is worse than the absolute thresholds in this file.", "file");
+	parser.addOptions({ corpusOption, generateCorpusOption, maxFilesOption, rowsOption, iterationsOption, roundsOption, seedOption, filterOption, quickOption, jsonOption, compareOption, maxSlowdownOption, checkOption });
+	parser.process(app);
+
+	const bool quick = parser.isSet(quickOption);
+	const auto intOption = [&parser](const QCommandLineOption &option, int defaultValue)
+	{
+		return parser.isSet(option) ? std::max(parser.value(option).toInt(), 0) : defaultValue;
+	};
+	const int maxFiles = intOption(maxFilesOption, quick ? 20 : 200);
+	const int rows = intOption(rowsOption, quick ? 10000 : 50000);
+	const int iterations = intOption(iterationsOption, quick ? 20 : 100);
+	const int rounds = intOption(roundsOption, quick ? 1 : 3);
+	const unsigned int seed = parser.value(seedOption).toUInt();
+
+	QTextStream err(stderr);
+	QJsonObject thresholds, baseline;
+	if(parser.isSet(checkOption) && !ReadJson(parser.value(checkOption), thresholds))
+	{
+		err << "Cannot read thresholds from " << parser.value(checkOption) << "\n";
+		return 2;
+	}
+	if(parser.isSet(compareOption) && !ReadJson(parser.value(compareOption), baseline))
+	{
+		err << "Cannot read baseline from " << parser.value(compareOption) << "\n";
+		return 2;
+	}
+
+	QTemporaryDir libraryDir;
+	if(!libraryDir.isValid())
+	{
+		err << "Cannot create temporary library directory\n";
+		return 2;
+	}
+
+	LibraryGenerator::Options generatorOptions;
+	generatorOptions.seed = seed;
+	LibraryGenerator generator(generatorOptions);
+
+	std::vector<CorpusModule> corpus;
+	QString corpusDir = parser.value(corpusOption);
+	if(!parser.isSet(corpusOption) && parser.isSet(generateCorpusOption))
+	{
+		corpusDir = libraryDir.filePath("corpus");
+		generator.WriteModules(corpusDir, intOption(generateCorpusOption, 0));
+	}
+	if(!corpusDir.isEmpty())
+	{
+		corpus = LoadCorpus(corpusDir, maxFiles);
+		if(corpus.empty())
+		{
+			err << "No modules found in " << corpusDir << "\n";
+			return 2;
+		}
+	}
+
+	Benchmarks bench(parser.value(filterOption));
+	std::mt19937 rng(seed);
+	bool passed = true;
+	try
+	{
+		auto &database = ModDatabase::Instance();
+		database.Open(libraryDir.path());
+		QTextStream(stdout) << "Creating synthetic library with " << rows << " modules...\n";
+		const SyntheticLibrary library = PopulateLibrary(database.GetDB(), generator, std::max(rows, 1), rng);
+
+		bench.PrintHeader();
+		passed = BenchFingerprints(bench, rng, iterations);
+		BenchSearch(bench, database.GetDB(), library, rng, iterations);
+		if(!corpus.empty())
+		{
+			BenchCorpus(bench, corpus, rounds);
+		}
+	} catch(ModDatabase::Exception &e)
+	{
+		err << e.what() << "\n";
+		return 2;
+	}
+
+	if(parser.isSet(jsonOption))
+	{
+		QJsonObject config;
+		config["rows"] = rows;
+		config["iterations"] = iterations;
+		config["corpus_modules"] = static_cast<int>(corpus.size());
+		config["rounds"] = rounds;
+		config["seed"] = static_cast<qint64>(seed);
+		config["quick"] = quick;
+		QJsonArray results;
+		for(const auto &result : bench.GetResults())
+		{
+			results.append(ToJson(result));
+		}
+		QJsonObject root;
+		root["format"] = RESULT_FORMAT;
+		root["config"] = config;
+		root["results"] = results;
+
+		QFile file(parser.value(jsonOption));
+		if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(QJsonDocument(root).toJson()) < 0)
+		{
+			err << "Cannot write results to " << parser.value(jsonOption) << "\n";
+			return 2;
+		}
+	}
+
+	if(!baseline.isEmpty())
+	{
+		const double maxSlowdown = parser.isSet(maxSlowdownOption) ? std::max(parser.value(maxSlowdownOption).toDouble(), 0.0) : -1.0;
+		passed = Compare(bench.GetResults(), baseline, maxSlowdown) && passed;
+	}
+	if(!thresholds.isEmpty())
+	{
+		passed = Check(bench.GetResults(), thresholds) && passed;
+	}
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+/*
+ * modlibgen.cpp
+ * -------------
+ * Purpose: Command-line tool for creating synthetic libraries and module files for scale testing.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <algorithm>
+#include "database.h"
+#include "librarygenerator.h"
+
+static QJsonArray ToJson(const std::vector<std::pair<QString, QString>> &examples)
+{
+	QJsonArray array;
+	for(const auto &example : examples)
+	{
+		QJsonObject pair;
+		pair["copy"] = example.first;
+		pair["original"] = example.second;
+		array.append(pair);
+	}
+	return array;
+}
+
+
+static QJsonObject ToJson(const LibraryGenerator::Manifest &manifest, const LibraryGenerator::Options &options)
+{
+	QJsonObject root;
+	root["seed"] = QString::number(options.seed);
+	root["modules"] = static_cast<qint64>(manifest.modules);
+	root["duplicates"] = static_cast<qint64>(manifest.duplicates);
+	root["variants"] = static_cast<qint64>(manifest.variants);
+	root["duplicate_examples"] = ToJson(manifest.duplicateExamples);
+	root["variant_examples"] = ToJson(manifest.variantExamples);
+	QJsonArray melodies;
+	for(const auto &melody : manifest.melodies)
+	{
+		QJsonArray intervals;
+		for(const char interval : melody.intervals)
+			intervals.append(static_cast<int>(interval));
+		QJsonObject object;
+		object["intervals"] = intervals;
+		object["note_data"] = QString::fromLatin1(melody.intervals.toHex());
+		// Other modules may contain the same intervals by chance
+		object["planted"] = static_cast<qint64>(melody.modules);
+		object["examples"] = QJsonArray::fromStringList(melody.examples);
+		melodies.append(object);
+	}
+	root["melodies"] = melodies;
+	return root;
+}
+
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("modlib-gen");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Creates synthetic Mod Library databases and module files for scale testing.");
+	parser.addHelpOption();
+	const QCommandLineOption modulesOption("modules", "Number of modules in the library (default: 100000).", "count", "100000");
+	const QCommandLineOption outputOption("output", "Directory in which the library is created.", "directory");
+	const QCommandLineOption seedOption("seed", "Seed of the generated data (default: 1).", "seed", "1");
+	const QCommandLineOption duplicatesOption("duplicates", "Fraction of exact copies of other modules (default: 0.04).", "rate");
+	const QCommandLineOption variantsOption("variants", "Fraction of edited or transposed copies of other modules (default: 0.03).", "rate");
+	const QCommandLineOption melodiesOption("melodies", "Fraction of modules containing a planted melody (default: 0.002).", "rate");
+	const QCommandLineOption filesOption("files", "Also write the first modules as MOD and XM files into this directory.", "directory");
+	const QCommandLineOption fileCountOption("file-count", "Number of module files to write (default: 100).", "count", "100");
+	const QCommandLineOption manifestOption("manifest", "Write the planted duplicates and melodies to this JSON file.", "file");
+	parser.addOptions({ modulesOption, outputOption, seedOption, duplicatesOption, variantsOption, melodiesOption, filesOption, fileCountOption, manifestOption });
+	parser.process(app);
+
+	QTextStream out(stdout), err(stderr);
+	if(!parser.isSet(outputOption) && !parser.isSet(filesOption))
+	{
+		err << "Nothing to do: specify --output and/or --files\n";
+		return 2;
+	}
+
+	LibraryGenerator::Options options;
+	options.seed = parser.value(seedOption).toULongLong();
+	if(parser.isSet(duplicatesOption))
+		options.duplicateRate = parser.value(duplicatesOption).toDouble();
+	if(parser.isSet(variantsOption))
+		options.variantRate = parser.value(variantsOption).toDouble();
+	if(parser.isSet(melodiesOption))
+		options.melodyRate = parser.value(melodiesOption).toDouble();
+	LibraryGenerator generator(options);
+
+	if(parser.isSet(filesOption))
+	{
+		const QStringList files = generator.WriteModules(parser.value(filesOption), std::max(parser.value(fileCountOption).toInt(), 0));
+		out << "Wrote " << files.size() << " module files to " << parser.value(filesOption) << "\n";
+	}
+	if(!parser.isSet(outputOption))
+	{
+		return 0;
+	}
+
+	// Adding to an existing library would mix real and generated modules
+	const QDir outputDir(parser.value(outputOption));
+	if(QFile::exists(outputDir.filePath("Mod Library.sqlite")))
+	{
+		err << "There is already a library in " << outputDir.path() << "\n";
+		return 2;
+	}
+	if(!QDir().mkpath(outputDir.path()))
+	{
+		err << "Cannot create " << outputDir.path() << "\n";
+		return 2;
+	}
+
+	const int numModules = std::max(parser.value(modulesOption).toInt(), 0);
+	QElapsedTimer timer;
+	timer.start();
+	LibraryGenerator::Manifest manifest;
+	try
+	{
+		auto &database = ModDatabase::Instance();
+		database.Open(outputDir.path());
+		int lastPercent = -1;
+		manifest = generator.Generate(database.GetDB(), numModules, [&](const QString &status, int value, int maximum)
+		{
+			const int percent = maximum ? static_cast<int>(int64_t(value) * 100 / maximum) : 100;
+			if(percent != lastPercent || !maximum)
+			{
+				out << "\r" << status << " " << percent << "%";
+				out.flush();
+				lastPercent = percent;
+			}
+			return true;
+		});
+	} catch(ModDatabase::Exception &e)
+	{
+		err << "\n" << e.what() << "\n";
+		return 2;
+	}
+	out << "\nGenerated " << manifest.modules << " modules (" << manifest.duplicates << " duplicates, " << manifest.variants << " variants) in "
+		<< QString::number(timer.elapsed() / 1000.0, 'f', 1) << " seconds\n";
+
+	if(parser.isSet(manifestOption))
+	{
+		QFile file(parser.value(manifestOption));
+		if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(QJsonDocument(ToJson(manifest, options)).toJson()) < 0)
+		{
+			err << "Cannot write manifest to " << parser.value(manifestOption) << "\n";
+			return 2;
+		}
+	}
+	return 0;
+}
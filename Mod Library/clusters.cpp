@@ -0,0 +1,580 @@
+/*
+ * clusters.cpp
+ * ------------
+ * Purpose: Library-wide clustering of similar sounding modules based on their fingerprints.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "clusters.h"
+#include "database.h"
+#include "fingerprint.h"
+#include "parallelsort.h"
+#include <QtConcurrent/QtConcurrent>
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+#include <chromaprint.h>
+
+
+static std::vector<uint32_t> DecodeFingerprint(const QByteArray &encoded)
+{
+	uint32_t *rawFingerprint = nullptr;
+	int rawFingerprintSize = 0;
+	std::vector<uint32_t> result;
+	if(chromaprint_decode_fingerprint(encoded.constData(), encoded.size(), &rawFingerprint, &rawFingerprintSize, nullptr, 0))
+	{
+		result.assign(rawFingerprint, rawFingerprint + rawFingerprintSize);
+	}
+	chromaprint_dealloc(rawFingerprint);
+	return result;
+}
+
+
+static uint64_t Mix64(uint64_t x)
+{
+	// splitmix64 finalizer
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ull;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBull;
+	x ^= x >> 31;
+	return x;
+}
+
+
+void SimilarityClusters::Open(QSqlDatabase &database)
+{
+	db = database;
+	QSqlQuery query(db);
+	if(!query.exec("CREATE TABLE IF NOT EXISTS `modlib_fingerprint_bands` (`band` INT, `bucket` INT, `filename` TEXT)")
+		|| !query.exec("CREATE INDEX IF NOT EXISTS `modlib_fingerprint_bands_bucket` ON `modlib_fingerprint_bands` (`bucket`)")
+		|| !query.exec("CREATE INDEX IF NOT EXISTS `modlib_fingerprint_bands_filename` ON `modlib_fingerprint_bands` (`filename`)"))
+	{
+		throw ModDatabase::Exception("Cannot create fingerprint band table: ", query.lastError());
+	}
+	if(!query.exec("CREATE TABLE IF NOT EXISTS `modlib_clusters` (`filename` TEXT PRIMARY KEY, `cluster` INT, `similarity` INT)")
+		|| !query.exec("CREATE INDEX IF NOT EXISTS `modlib_clusters_cluster` ON `modlib_clusters` (`cluster`)"))
+	{
+		throw ModDatabase::Exception("Cannot create cluster table: ", query.lastError());
+	}
+
+	insertBandQuery = QSqlQuery(db);
+	findBandQuery = QSqlQuery(db);
+	removeBandsQuery = QSqlQuery(db);
+	fingerprintQuery = QSqlQuery(db);
+	clusterQuery = QSqlQuery(db);
+	insertMemberQuery = QSqlQuery(db);
+	updateMemberQuery = QSqlQuery(db);
+	mergeQuery = QSqlQuery(db);
+	removeMemberQuery = QSqlQuery(db);
+	// The bucket value already includes the band number, so band is only stored for informational purposes.
+	if(!insertBandQuery.prepare("INSERT INTO `modlib_fingerprint_bands` (`band`, `bucket`, `filename`) VALUES (:band, :bucket, :filename)")
+		|| !findBandQuery.prepare("SELECT `filename` FROM `modlib_fingerprint_bands` WHERE `bucket` = :bucket LIMIT " + QString::number(MAX_BUCKET_SIZE))
+		|| !removeBandsQuery.prepare("DELETE FROM `modlib_fingerprint_bands` WHERE `filename` = :filename")
+		|| !fingerprintQuery.prepare("SELECT `fingerprint` FROM `modlib_modules` WHERE `filename` = :filename")
+		|| !clusterQuery.prepare("SELECT `cluster` FROM `modlib_clusters` WHERE `filename` = :filename")
+		|| !insertMemberQuery.prepare("INSERT OR IGNORE INTO `modlib_clusters` (`filename`, `cluster`, `similarity`) VALUES (:filename, :cluster, 0)")
+		|| !updateMemberQuery.prepare("UPDATE `modlib_clusters` SET `cluster` = :cluster, `similarity` = MAX(`similarity`, :similarity) WHERE `filename` = :filename")
+		|| !mergeQuery.prepare("UPDATE `modlib_clusters` SET `cluster` = :cluster WHERE `cluster` = :old_cluster")
+		|| !removeMemberQuery.prepare("DELETE FROM `modlib_clusters` WHERE `filename` = :filename"))
+	{
+		throw ModDatabase::Exception("Cannot prepare cluster queries: ", db.lastError());
+	}
+
+	built = query.exec("SELECT `value` FROM `modlib_schema` WHERE `name` = 'clusters_built'") && query.next();
+}
+
+
+SimilarityClusters::Signature SimilarityClusters::ComputeSignature(const uint32_t *fingerprint, int size)
+{
+	// One-permutation hashing: Each sub-fingerprint key is hashed once, the top bits select the bin,
+	// and each bin keeps the minimum of the remaining bits.
+	Signature signature;
+	signature.fill(UINT32_MAX);
+	for(int i = 0; i < size; i++)
+	{
+		const uint64_t h = Mix64(FingerprintMatcher::Key(fingerprint[i]));
+		const int bin = static_cast<int>(h >> 59);
+		const uint32_t value = static_cast<uint32_t>(h);
+		if(value < signature[bin])
+			signature[bin] = value;
+	}
+	return signature;
+}
+
+
+SimilarityClusters::Bands SimilarityClusters::ComputeBands(const Signature &signature)
+{
+	static_assert(NUM_BINS == 32, "Bin selection in ComputeSignature assumes 32 bins");
+	Bands bands;
+	for(int b = 0; b < NUM_BANDS; b++)
+	{
+		uint64_t h = Mix64(b + 1);
+		bool empty = false;
+		for(int r = 0; r < ROWS_PER_BAND; r++)
+		{
+			const uint32_t value = signature[b * ROWS_PER_BAND + r];
+			empty |= (value == UINT32_MAX);
+			h = Mix64(h ^ value);
+		}
+		// sqlite integers are signed; 0 is reserved for empty bands
+		bands[b] = empty ? 0 : static_cast<int64_t>(h | 1);
+	}
+	return bands;
+}
+
+
+int SimilarityClusters::ClusterOf(const QString &fileName)
+{
+	clusterQuery.bindValue(":filename", fileName);
+	if(clusterQuery.exec() && clusterQuery.next())
+	{
+		return clusterQuery.value(0).toInt();
+	}
+	return -1;
+}
+
+
+void SimilarityClusters::AddModule(const QString &fileName, const uint32_t *fingerprint, int size)
+{
+	RemoveModule(fileName);
+	if(size <= 0)
+	{
+		return;
+	}
+
+	const Bands bands = ComputeBands(ComputeSignature(fingerprint, size));
+	QSet<QString> candidates;
+	for(int b = 0; b < NUM_BANDS; b++)
+	{
+		if(!bands[b])
+		{
+			continue;
+		}
+		findBandQuery.bindValue(":bucket", QVariant::fromValue(bands[b]));
+		if(findBandQuery.exec())
+		{
+			while(findBandQuery.next())
+			{
+				candidates.insert(findBandQuery.value(0).toString());
+			}
+		}
+		insertBandQuery.bindValue(":band", b);
+		insertBandQuery.bindValue(":bucket", QVariant::fromValue(bands[b]));
+		insertBandQuery.bindValue(":filename", fileName);
+		insertBandQuery.exec();
+	}
+	candidates.remove(fileName);
+
+	std::vector<std::pair<QString, int>> matches;
+	const FingerprintMatcher matcher(fingerprint, size);
+	for(const auto &candidate : candidates)
+	{
+		fingerprintQuery.bindValue(":filename", candidate);
+		if(!fingerprintQuery.exec() || !fingerprintQuery.next())
+		{
+			continue;
+		}
+		const auto other = DecodeFingerprint(fingerprintQuery.value(0).toByteArray());
+		const int similarity = matcher.Compare(other.data(), static_cast<int>(other.size()), MIN_SIMILARITY);
+		if(similarity >= MIN_SIMILARITY)
+		{
+			matches.push_back({ candidate, similarity });
+		}
+	}
+	if(!matches.empty())
+	{
+		Merge(fileName, matches);
+	}
+}
+
+
+void SimilarityClusters::Merge(const QString &fileName, const std::vector<std::pair<QString, int>> &matches)
+{
+	// The new module joins all clusters of the modules it is similar to.
+	std::vector<int> clusters;
+	for(const auto &match : matches)
+	{
+		const int cluster = ClusterOf(match.first);
+		if(cluster != -1)
+			clusters.push_back(cluster);
+	}
+	std::sort(clusters.begin(), clusters.end());
+	clusters.erase(std::unique(clusters.begin(), clusters.end()), clusters.end());
+
+	int target;
+	if(clusters.empty())
+	{
+		QSqlQuery query(db);
+		query.exec("SELECT IFNULL(MAX(`cluster`), 0) + 1 FROM `modlib_clusters`");
+		query.next();
+		target = query.value(0).toInt();
+	} else
+	{
+		target = clusters.front();
+		for(size_t i = 1; i < clusters.size(); i++)
+		{
+			mergeQuery.bindValue(":cluster", target);
+			mergeQuery.bindValue(":old_cluster", clusters[i]);
+			mergeQuery.exec();
+		}
+	}
+
+	int bestSimilarity = 0;
+	const auto addMember = [this, target](const QString &member, int similarity)
+	{
+		insertMemberQuery.bindValue(":filename", member);
+		insertMemberQuery.bindValue(":cluster", target);
+		insertMemberQuery.exec();
+		updateMemberQuery.bindValue(":filename", member);
+		updateMemberQuery.bindValue(":cluster", target);
+		updateMemberQuery.bindValue(":similarity", similarity);
+		updateMemberQuery.exec();
+	};
+	for(const auto &match : matches)
+	{
+		addMember(match.first, match.second);
+		bestSimilarity = std::max(bestSimilarity, match.second);
+	}
+	addMember(fileName, bestSimilarity);
+}
+
+
+void SimilarityClusters::RemoveModule(const QString &fileName)
+{
+	removeBandsQuery.bindValue(":filename", fileName);
+	removeBandsQuery.exec();
+
+	const int cluster = ClusterOf(fileName);
+	if(cluster == -1)
+	{
+		return;
+	}
+	removeMemberQuery.bindValue(":filename", fileName);
+	removeMemberQuery.exec();
+
+	// The removed module may have been the only link between some of the remaining members.
+	Split(cluster);
+}
+
+
+void SimilarityClusters::Split(int cluster)
+{
+	QSqlQuery query(db);
+	query.setForwardOnly(true);
+	query.prepare("SELECT `c`.`filename`, `m`.`fingerprint` FROM `modlib_clusters` AS `c` JOIN `modlib_modules` AS `m` ON `m`.`filename` = `c`.`filename` "
+		"WHERE `c`.`cluster` = :cluster LIMIT " + QString::number(MAX_SPLIT_SIZE + 1));
+	query.bindValue(":cluster", cluster);
+	std::vector<QString> fileNames;
+	std::vector<std::vector<uint32_t>> fingerprints;
+	if(query.exec())
+	{
+		while(query.next())
+		{
+			fileNames.push_back(query.value(0).toString());
+			fingerprints.push_back(DecodeFingerprint(query.value(1).toByteArray()));
+		}
+	}
+	query.finish();
+
+	if(fileNames.size() > MAX_SPLIT_SIZE)
+	{
+		return;
+	}
+
+	// Connected components of the remaining members, as Rebuild would find them.
+	// Members without any similar partner leave the cluster, and every further component becomes a new cluster.
+	const size_t numMembers = fileNames.size();
+	std::vector<size_t> component(numMembers);
+	std::iota(component.begin(), component.end(), size_t(0));
+	std::vector<int> similarity(numMembers, 0);
+	for(size_t i = 0; i < numMembers; i++)
+	{
+		const FingerprintMatcher matcher(fingerprints[i].data(), static_cast<int>(fingerprints[i].size()));
+		for(size_t j = i + 1; j < numMembers; j++)
+		{
+			const int result = matcher.Compare(fingerprints[j].data(), static_cast<int>(fingerprints[j].size()), MIN_SIMILARITY);
+			if(result < MIN_SIMILARITY)
+			{
+				continue;
+			}
+			similarity[i] = std::max(similarity[i], result);
+			similarity[j] = std::max(similarity[j], result);
+			const size_t from = component[j], to = component[i];
+			if(from != to)
+			{
+				std::replace(component.begin(), component.end(), from, to);
+			}
+		}
+	}
+
+	QSqlQuery memberQuery(db);
+	memberQuery.prepare("UPDATE `modlib_clusters` SET `cluster` = :cluster, `similarity` = :similarity WHERE `filename` = :filename");
+	std::unordered_map<size_t, int> newClusters;
+	int nextCluster = 0;
+	for(size_t i = 0; i < numMembers; i++)
+	{
+		if(!similarity[i])
+		{
+			removeMemberQuery.bindValue(":filename", fileNames[i]);
+			removeMemberQuery.exec();
+			continue;
+		}
+		auto target = newClusters.find(component[i]);
+		if(target == newClusters.end())
+		{
+			int id = cluster;
+			if(!newClusters.empty())
+			{
+				if(!nextCluster)
+				{
+					QSqlQuery maxQuery(db);
+					maxQuery.exec("SELECT IFNULL(MAX(`cluster`), 0) + 1 FROM `modlib_clusters`");
+					maxQuery.next();
+					nextCluster = maxQuery.value(0).toInt();
+				}
+				id = nextCluster++;
+			}
+			target = newClusters.insert({ component[i], id }).first;
+		}
+		// The similarity of a member is the best match within its new cluster, so it may decrease here.
+		memberQuery.bindValue(":cluster", target->second);
+		memberQuery.bindValue(":similarity", similarity[i]);
+		memberQuery.bindValue(":filename", fileNames[i]);
+		memberQuery.exec();
+	}
+}
+
+
+bool SimilarityClusters::Rebuild(const ProgressFunc &progress)
+{
+	QSqlQuery query(db);
+	query.exec("SELECT COUNT(*) FROM `modlib_modules`");
+	query.next();
+	const int numModules = query.value(0).toInt();
+
+	// Only the row IDs and the bucket memberships of all modules are kept in memory.
+	// File names and fingerprints are read again when they are needed.
+	struct Item
+	{
+		QString fileName;
+		QByteArray encoded;
+		Bands bands;
+	};
+	struct BucketEntry
+	{
+		int64_t bucket;
+		uint32_t module;
+	};
+	std::vector<int64_t> ids;
+	std::vector<BucketEntry> bucketEntries;
+	ids.reserve(numModules);
+
+	// Pass 1: Compute the LSH bands of all modules and persist them for incremental updates.
+	// Decoding and hashing happens in parallel, batch by batch. Canceling keeps the previous clusters.
+	db.transaction();
+	query.exec("DELETE FROM `modlib_schema` WHERE `name` = 'clusters_built'");
+	query.exec("DELETE FROM `modlib_fingerprint_bands`");
+	query.exec("DELETE FROM `modlib_clusters`");
+	QSqlQuery moduleQuery(db);
+	moduleQuery.setForwardOnly(true);
+	if(!moduleQuery.exec("SELECT `rowid`, `filename`, `fingerprint` FROM `modlib_modules`"))
+	{
+		db.rollback();
+		return false;
+	}
+	static constexpr size_t BATCH_SIZE = 1024;
+	std::vector<Item> batch;
+	batch.reserve(BATCH_SIZE);
+	bool hasMore = true;
+	while(hasMore)
+	{
+		batch.clear();
+		while(batch.size() < BATCH_SIZE && (hasMore = moduleQuery.next()))
+		{
+			ids.push_back(moduleQuery.value(0).toLongLong());
+			batch.push_back({ moduleQuery.value(1).toString(), moduleQuery.value(2).toByteArray(), {} });
+		}
+		QtConcurrent::blockingMap(batch, [](Item &item)
+		{
+			const auto fingerprint = DecodeFingerprint(item.encoded);
+			item.bands = ComputeBands(ComputeSignature(fingerprint.data(), static_cast<int>(fingerprint.size())));
+		});
+		uint32_t module = static_cast<uint32_t>(ids.size() - batch.size());
+		for(const auto &item : batch)
+		{
+			for(int b = 0; b < NUM_BANDS; b++)
+			{
+				if(!item.bands[b])
+				{
+					continue;
+				}
+				bucketEntries.push_back({ item.bands[b], module });
+				insertBandQuery.bindValue(":band", b);
+				insertBandQuery.bindValue(":bucket", QVariant::fromValue(item.bands[b]));
+				insertBandQuery.bindValue(":filename", item.fileName);
+				insertBandQuery.exec();
+			}
+			module++;
+		}
+		if(!progress(QObject::tr("Hashing fingerprints..."), static_cast<int>(ids.size()), numModules))
+		{
+			moduleQuery.finish();
+			db.rollback();
+			return false;
+		}
+	}
+	moduleQuery.finish();
+	built = false;
+	db.commit();
+
+	// Pass 2: Collect candidate pairs from all buckets.
+	if(!progress(QObject::tr("Finding candidate pairs..."), 0, 0))
+	{
+		return false;
+	}
+	ParallelSort(bucketEntries.begin(), bucketEntries.end(), [](const BucketEntry &a, const BucketEntry &b) { return a.bucket < b.bucket; });
+	std::unordered_map<uint32_t, std::unordered_set<uint32_t>> partners;
+	for(size_t start = 0; start < bucketEntries.size();)
+	{
+		size_t end = start + 1;
+		while(end < bucketEntries.size() && bucketEntries[end].bucket == bucketEntries[start].bucket)
+		{
+			end++;
+		}
+		const size_t size = end - start;
+		for(size_t i = start; i < end && size >= 2; i++)
+		{
+			// Degenerate buckets (e.g. modules that are mostly silent) would result in a quadratic number of pairs.
+			const size_t jEnd = (size <= MAX_BUCKET_SIZE || i == start) ? end : 0;
+			for(size_t j = i + 1; j < jEnd; j++)
+			{
+				const uint32_t a = bucketEntries[i].module, b = bucketEntries[j].module;
+				partners[std::min(a, b)].insert(std::max(a, b));
+			}
+		}
+		start = end;
+	}
+	bucketEntries.clear();
+	bucketEntries.shrink_to_fit();
+
+	// Pass 3: Compare all candidate pairs in parallel. The fingerprints are only kept for the current batch of jobs.
+	struct Job
+	{
+		uint32_t module;
+		std::vector<uint32_t> partners;
+		std::vector<std::pair<uint32_t, int>> matches;
+	};
+	std::vector<Job> jobs;
+	jobs.reserve(partners.size());
+	for(auto &p : partners)
+	{
+		jobs.push_back({ p.first, std::vector<uint32_t>(p.second.begin(), p.second.end()), {} });
+	}
+	partners.clear();
+
+	std::unordered_map<uint32_t, QByteArray> fingerprints;
+	QSqlQuery fpQuery(db);
+	fpQuery.prepare("SELECT `fingerprint` FROM `modlib_modules` WHERE `rowid` = :id");
+	const auto loadFingerprint = [&](uint32_t module)
+	{
+		if(fingerprints.count(module))
+			return;
+		fpQuery.bindValue(":id", QVariant::fromValue(ids[module]));
+		if(fpQuery.exec() && fpQuery.next())
+			fingerprints[module] = fpQuery.value(0).toByteArray();
+		else
+			fingerprints[module] = QByteArray();
+	};
+
+	for(size_t start = 0; start < jobs.size(); start += BATCH_SIZE)
+	{
+		if(!progress(QObject::tr("Comparing similar fingerprints..."), static_cast<int>(start), static_cast<int>(jobs.size())))
+		{
+			return false;
+		}
+		const size_t end = std::min(start + BATCH_SIZE, jobs.size());
+		fingerprints.clear();
+		for(size_t i = start; i < end; i++)
+		{
+			loadFingerprint(jobs[i].module);
+			for(const auto other : jobs[i].partners)
+			{
+				loadFingerprint(other);
+			}
+		}
+		const auto &constFingerprints = fingerprints;
+		QtConcurrent::blockingMap(jobs.begin() + start, jobs.begin() + end, [&constFingerprints](Job &job)
+		{
+			const auto fingerprint = DecodeFingerprint(constFingerprints.at(job.module));
+			const FingerprintMatcher matcher(fingerprint.data(), static_cast<int>(fingerprint.size()));
+			for(const auto other : job.partners)
+			{
+				const auto otherFingerprint = DecodeFingerprint(constFingerprints.at(other));
+				const int similarity = matcher.Compare(otherFingerprint.data(), static_cast<int>(otherFingerprint.size()), MIN_SIMILARITY);
+				if(similarity >= MIN_SIMILARITY)
+					job.matches.push_back({ other, similarity });
+			}
+			job.partners.clear();
+			job.partners.shrink_to_fit();
+		});
+	}
+	fingerprints.clear();
+
+	// Pass 4: Connected components of all similar pairs form the clusters.
+	std::vector<uint32_t> parent(ids.size());
+	std::iota(parent.begin(), parent.end(), 0u);
+	const auto findRoot = [&parent](uint32_t x)
+	{
+		while(parent[x] != x)
+		{
+			parent[x] = parent[parent[x]];
+			x = parent[x];
+		}
+		return x;
+	};
+	std::unordered_map<uint32_t, int> similarity;
+	for(const auto &job : jobs)
+	{
+		for(const auto &match : job.matches)
+		{
+			const uint32_t a = findRoot(job.module), b = findRoot(match.first);
+			if(a != b)
+				parent[std::max(a, b)] = std::min(a, b);
+			similarity[job.module] = std::max(similarity[job.module], match.second);
+			similarity[match.first] = std::max(similarity[match.first], match.second);
+		}
+	}
+	jobs.clear();
+
+	QSqlQuery fileNameQuery(db);
+	fileNameQuery.prepare("SELECT `filename` FROM `modlib_modules` WHERE `rowid` = :id");
+	db.transaction();
+	std::unordered_map<uint32_t, int> clusterIDs;
+	for(const auto &member : similarity)
+	{
+		fileNameQuery.bindValue(":id", QVariant::fromValue(ids[member.first]));
+		if(!fileNameQuery.exec() || !fileNameQuery.next())
+		{
+			continue;
+		}
+		const QString fileName = fileNameQuery.value(0).toString();
+		const uint32_t root = findRoot(member.first);
+		auto cluster = clusterIDs.find(root);
+		if(cluster == clusterIDs.end())
+			cluster = clusterIDs.insert({ root, static_cast<int>(clusterIDs.size()) + 1 }).first;
+		insertMemberQuery.bindValue(":filename", fileName);
+		insertMemberQuery.bindValue(":cluster", cluster->second);
+		insertMemberQuery.exec();
+		updateMemberQuery.bindValue(":filename", fileName);
+		updateMemberQuery.bindValue(":cluster", cluster->second);
+		updateMemberQuery.bindValue(":similarity", member.second);
+		updateMemberQuery.exec();
+	}
+	query.exec("INSERT OR REPLACE INTO `modlib_schema` (`name`, `value`) VALUES ('clusters_built', '1')");
+	built = db.commit();
+	return true;
+}
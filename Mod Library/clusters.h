@@ -0,0 +1,67 @@
+/*
+ * clusters.h
+ * ----------
+ * Purpose: Library-wide clustering of similar sounding modules based on their fingerprints.
+ * Notes  : Candidate pairs are found through MinHash locality-sensitive hashing of the sub-fingerprint sets,
+ *          and only those pairs are compared with FingerprintMatcher.
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QtSql/QtSql>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class SimilarityClusters
+{
+public:
+	// Minimum match quality (in percent) for two modules to be considered near-duplicates
+	static constexpr int MIN_SIMILARITY = 80;
+	// One-permutation MinHash with 32 bins, combined into 16 bands of 2 bins each.
+	// Two modules become a candidate pair if any of their bands agree, which happens with
+	// a probability of 1 - (1 - J^2)^16 for a Jaccard similarity J of their sub-fingerprint sets.
+	static constexpr int NUM_BINS = 32;
+	static constexpr int ROWS_PER_BAND = 2;
+	static constexpr int NUM_BANDS = NUM_BINS / ROWS_PER_BAND;
+	// Buckets that are larger than this only pair their first member with all other members.
+	static constexpr size_t MAX_BUCKET_SIZE = 100;
+	// When a module is removed, the remaining members of its cluster are compared with each other to find out if the
+	// cluster falls apart. Larger clusters are kept together until the next rebuild, even if the removed module was their only link.
+	static constexpr size_t MAX_SPLIT_SIZE = 32;
+
+	using Signature = std::array<uint32_t, NUM_BINS>;
+	using Bands = std::array<int64_t, NUM_BANDS>;	// 0 = band contains an empty bin
+
+	// Return false from the progress callback to cancel the operation.
+	using ProgressFunc = std::function<bool(const QString &status, int value, int maximum)>;
+
+protected:
+	QSqlDatabase db;
+	QSqlQuery insertBandQuery, findBandQuery, removeBandsQuery;
+	QSqlQuery fingerprintQuery, clusterQuery, insertMemberQuery, updateMemberQuery, mergeQuery, removeMemberQuery;
+	bool built = false;
+
+public:
+	void Open(QSqlDatabase &database);
+
+	// Have the clusters ever been computed for this library?
+	bool IsBuilt() const { return built; }
+	// Recompute all clusters from scratch. Returns false if canceled. Once the previous clusters have been discarded, canceling leaves the library without clusters.
+	bool Rebuild(const ProgressFunc &progress);
+
+	// Incremental maintenance, called whenever a module is added, updated or removed.
+	void AddModule(const QString &fileName, const uint32_t *fingerprint, int size);
+	void RemoveModule(const QString &fileName);
+
+	static Signature ComputeSignature(const uint32_t *fingerprint, int size);
+	static Bands ComputeBands(const Signature &signature);
+
+protected:
+	int ClusterOf(const QString &fileName);
+	void Merge(const QString &fileName, const std::vector<std::pair<QString, int>> &matches);
+	void Split(int cluster);
+};
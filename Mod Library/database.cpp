@@ -12,11 +12,18 @@
 #include <QCryptographicHash>
 #include <QDebug>
 #include <QSettings>
+#include <atomic>
+#include <limits>
 #include <libopenmpt/libopenmpt.hpp>
-#include <chromaprint.h>
+#include "analyzers.h"
 #include "base64.h"
+#include "modulecache.h"
+#include "fingerprint.h"
+#include "notesimilarity.h"
+#include "sqlregexp.h"
+#include <sqlite3.h>
 
-#define SCHEMA_VERSION 1
+#define SCHEMA_VERSION 6
 #define VER_HELPER_STRINGIZE(x) #x
 #define VER_STRINGIZE(x)        VER_HELPER_STRINGIZE(x)
 #define SCHEMA_VERSION_STR VER_STRINGIZE(SCHEMA_VERSION)
@@ -24,11 +31,60 @@
 
 ModDatabase ModDatabase::instance;
 
-void ModDatabase::Open()
+static std::atomic<bool> sqliteConnectionSeen{ false };
+
+static int SqliteConnectionOpened(sqlite3 *, char **, const sqlite3_api_routines *)
+{
+	sqliteConnectionSeen = true;
+	return SQLITE_OK;
+}
+
+
+// Auto extensions are only run by the copy of SQLite that they were registered with,
+// so if a new QSQLITE connection runs ours, Qt's driver uses the same library as we do.
+static bool QtUsesOurSqlite()
+{
+	static const bool shared = []()
+	{
+		static const QString PROBE_CONNECTION = "sqlite_probe";
+		const auto extension = reinterpret_cast<void (*)()>(SqliteConnectionOpened);
+		sqlite3_auto_extension(extension);
+		{
+			QSqlDatabase probe = QSqlDatabase::addDatabase("QSQLITE", PROBE_CONNECTION);
+			probe.setDatabaseName(":memory:");
+			probe.open();
+			probe.close();
+		}
+		QSqlDatabase::removeDatabase(PROBE_CONNECTION);
+		sqlite3_cancel_auto_extension(extension);
+		if(!sqliteConnectionSeen)
+			qWarning() << "Qt's SQLite driver does not use the system SQLite library; regular expression search and canceling running queries are unavailable";
+		return sqliteConnectionSeen.load();
+	}();
+	return shared;
+}
+
+
+sqlite3 *ModDatabase::NativeHandle(const QSqlDatabase &db)
+{
+	if(!db.isOpen() || !QtUsesOurSqlite())
+	{
+		return nullptr;
+	}
+	const QVariant v = db.driver()->handle();
+	if(!v.isValid() || qstrcmp(v.typeName(), "sqlite3*") != 0)
+	{
+		return nullptr;
+	}
+	return *static_cast<sqlite3 *const *>(v.constData());
+}
+
+void ModDatabase::Open(const QString &directory)
 {
 	db = QSqlDatabase::addDatabase("QSQLITE");
-	QString dbFile = QFileInfo(QSettings().fileName()).absoluteDir().absolutePath() + QDir::separator();
+	QString dbFile = (directory.isEmpty() ? QFileInfo(QSettings().fileName()).absoluteDir().absolutePath() : directory) + QDir::separator();
 	QDir().mkpath(dbFile);
+	const QString previewFile = dbFile + "Mod Library Previews.sqlite";
 	dbFile += "Mod Library.sqlite";
 	const QString dbBackup = dbFile + "~";
 	QFile::remove(dbBackup);
@@ -92,7 +148,60 @@ void ModDatabase::Open()
 		{
 			throw Exception("Cannot create library indices: ", query.lastError());
 		}
-
+	}
+	if(schemaVersion < 2)
+	{
+		// Existing modules receive their note similarity hash the next time they are updated (NULL = not computed yet).
+		if(!query.exec("ALTER TABLE `modlib_modules` ADD COLUMN `note_simhash` INT"))
+		{
+			throw Exception("Cannot update library schema: ", query.lastError());
+		}
+	}
+	if(schemaVersion < 3)
+	{
+		// Allows sorting search results in the database
+		if(!query.exec("CREATE INDEX IF NOT EXISTS `modlib_filesize` ON `modlib_modules` (`filesize`)")
+			|| !query.exec("CREATE INDEX IF NOT EXISTS `modlib_filedate` ON `modlib_modules` (`filedate`)"))
+		{
+			throw Exception("Cannot create library indices: ", query.lastError());
+		}
+	}
+	if(schemaVersion < 4)
+	{
+		// Structural search filters. The combined index answers format and channel queries such as "all 8-channel XMs" on its own.
+		if(!query.exec("CREATE INDEX IF NOT EXISTS `modlib_format_channels` ON `modlib_modules` (`format`, `num_channels`)")
+			|| !query.exec("CREATE INDEX IF NOT EXISTS `modlib_num_channels` ON `modlib_modules` (`num_channels`)")
+			|| !query.exec("CREATE INDEX IF NOT EXISTS `modlib_num_samples` ON `modlib_modules` (`num_samples`)")
+			|| !query.exec("CREATE INDEX IF NOT EXISTS `modlib_num_instruments` ON `modlib_modules` (`num_instruments`)"))
+		{
+			throw Exception("Cannot create library indices: ", query.lastError());
+		}
+	}
+	if(schemaVersion < 5)
+	{
+		// Selecting a release year or artist facet
+		if(!query.exec("CREATE INDEX IF NOT EXISTS `modlib_editdate` ON `modlib_modules` (`editdate`)")
+			|| !query.exec("CREATE INDEX IF NOT EXISTS `modlib_artist` ON `modlib_modules` (`artist`)"))
+		{
+			throw Exception("Cannot create library indices: ", query.lastError());
+		}
+	}
+	if(schemaVersion < 6)
+	{
+		// Audio analysis results. Existing modules are analyzed again the next time they are updated (analysis_version is NULL).
+		if(!query.exec("ALTER TABLE `modlib_modules` ADD COLUMN `loudness` REAL")
+			|| !query.exec("ALTER TABLE `modlib_modules` ADD COLUMN `peak` REAL")
+			|| !query.exec("ALTER TABLE `modlib_modules` ADD COLUMN `leading_silence` INT")
+			|| !query.exec("ALTER TABLE `modlib_modules` ADD COLUMN `trailing_silence` INT")
+			|| !query.exec("ALTER TABLE `modlib_modules` ADD COLUMN `intro_length` INT")
+			|| !query.exec("ALTER TABLE `modlib_modules` ADD COLUMN `bpm` REAL")
+			|| !query.exec("ALTER TABLE `modlib_modules` ADD COLUMN `analysis_version` INT"))
+		{
+			throw Exception("Cannot update library schema: ", query.lastError());
+		}
+	}
+	if(schemaVersion < SCHEMA_VERSION)
+	{
 		if(!query.exec("INSERT OR IGNORE INTO `modlib_schema` (`name`, `value`) VALUES ('schema_version', '" SCHEMA_VERSION_STR "')")
 			|| !query.exec("UPDATE `modlib_schema` SET `value` = '" SCHEMA_VERSION_STR "' WHERE `name` = 'schema_version'"))
 		{
@@ -103,8 +212,10 @@ void ModDatabase::Open()
 	insertQuery = QSqlQuery(db);
 	if(!insertQuery.prepare(R"(
 		INSERT INTO `modlib_modules` (
-		`hash`, `filename`, `filesize`, `filedate`, `editdate`, `format`, `title`, `length`, `num_channels`, `num_patterns`, `num_orders`, `num_subsongs`, `num_samples`, `num_instruments`, `sample_text`, `instrument_text`, `comments`, `artist`, `fingerprint`, `note_data`, `pattern_hash`)
-		 VALUES (:hash, :filename, :filesize, :filedate, :editdate, :format, :title, :length, :num_channels, :num_patterns, :num_orders, :num_subsongs, :num_samples, :num_instruments, :sample_text, :instrument_text, :comments, :artist, :fingerprint, :note_data, :pattern_hash)
+		`hash`, `filename`, `filesize`, `filedate`, `editdate`, `format`, `title`, `length`, `num_channels`, `num_patterns`, `num_orders`, `num_subsongs`, `num_samples`, `num_instruments`, `sample_text`, `instrument_text`, `comments`, `artist`, `fingerprint`, `note_data`, `pattern_hash`, `note_simhash`,
+		`loudness`, `peak`, `leading_silence`, `trailing_silence`, `intro_length`, `bpm`, `analysis_version`)
+		 VALUES (:hash, :filename, :filesize, :filedate, :editdate, :format, :title, :length, :num_channels, :num_patterns, :num_orders, :num_subsongs, :num_samples, :num_instruments, :sample_text, :instrument_text, :comments, :artist, :fingerprint, :note_data, :pattern_hash, :note_simhash,
+		 :loudness, :peak, :leading_silence, :trailing_silence, :intro_length, :bpm, :analysis_version)
 		)"))
 	{
 		throw Exception("Cannot prepare insert query: ", insertQuery.lastError());
@@ -115,7 +226,8 @@ void ModDatabase::Open()
 		UPDATE `modlib_modules` SET
 		`hash` = :hash, `filename` = :filename, `filesize` = :filesize, `filedate` = :filedate, `editdate` = :editdate, `format` = :format, `title` = :title, `length` = :length,
 		`num_channels` = :num_channels, `num_patterns` = :num_patterns, `num_orders` = :num_orders, `num_subsongs` = :num_subsongs, `num_samples` = :num_samples,
-		`num_instruments` = :num_instruments, `sample_text` = :sample_text, `instrument_text` = :instrument_text, `comments` = :comments, `artist` = :artist, `fingerprint` = :fingerprint, `note_data` = :note_data, `pattern_hash` = :pattern_hash
+		`num_instruments` = :num_instruments, `sample_text` = :sample_text, `instrument_text` = :instrument_text, `comments` = :comments, `artist` = :artist, `fingerprint` = :fingerprint, `note_data` = :note_data, `pattern_hash` = :pattern_hash, `note_simhash` = :note_simhash,
+		`loudness` = :loudness, `peak` = :peak, `leading_silence` = :leading_silence, `trailing_silence` = :trailing_silence, `intro_length` = :intro_length, `bpm` = :bpm, `analysis_version` = :analysis_version
 		WHERE `filename` = :filename_old
 		)"))
 	{
@@ -134,7 +246,7 @@ void ModDatabase::Open()
 	}
 
 	selectQuery = QSqlQuery(db);
-	if(!selectQuery.prepare("SELECT * FROM `modlib_modules` WHERE `filename` = :filename"))
+	if(!selectQuery.prepare("SELECT `rowid`, * FROM `modlib_modules` WHERE `filename` = :filename"))
 	{
 		throw Exception("Cannot prepare select query: ", selectQuery.lastError());
 	}
@@ -145,11 +257,31 @@ void ModDatabase::Open()
 		throw Exception("Cannot prepare fingerprint query: ", selectQuery.lastError());
 	}
 
+	idQuery = QSqlQuery(db);
+	if(!idQuery.prepare("SELECT `rowid` FROM `modlib_modules` WHERE `filename` = :filename"))
+	{
+		throw Exception("Cannot prepare ID query: ", idQuery.lastError());
+	}
+
+	fileNameQuery = QSqlQuery(db);
+	if(!fileNameQuery.prepare("SELECT `filename` FROM `modlib_modules` WHERE `rowid` = :id"))
+	{
+		throw Exception("Cannot prepare file name query: ", fileNameQuery.lastError());
+	}
+
 	removeQuery = QSqlQuery(db);
 	if(!removeQuery.prepare("DELETE FROM `modlib_modules` WHERE `filename` = :filename"))
 	{
 		throw Exception("Cannot prepare delete query: ", selectQuery.lastError());
 	}
+
+	// Smart playlists may contain regular expression searches
+	hasRegexp = SqlRegexp::Register(db);
+	clusters.Open(db);
+	playlists.Open(db);
+	facets.Open(db);
+	thumbnails.Open(db);
+	previews.Open(previewFile);
 }
 
 
@@ -183,12 +315,30 @@ bool ModDatabase::UpdateCustom(const QString &path, const QString &artist, const
 	updateCustomQuery.bindValue(":filename", path);
 	updateCustomQuery.bindValue(":artist", artist);
 	updateCustomQuery.bindValue(":personal_comments", comments);
-	return updateCustomQuery.exec();
+	const bool ownTransaction = db.transaction();
+	FacetCounts::Values oldFacets, newFacets;
+	const bool hadOld = facets.GetValues(path, oldFacets);
+	if(!updateCustomQuery.exec())
+	{
+		if(ownTransaction)
+			db.rollback();
+		return false;
+	}
+	facets.Update(hadOld, oldFacets, facets.GetValues(path, newFacets), newFacets);
+	playlists.UpdateModule(path);
+	if(ownTransaction && !db.commit())
+	{
+		db.rollback();
+		return false;
+	}
+	generation++;
+	return true;
 }
 
 
 // Extract the notes from some module's patterns, as a byte sequence of note deltas.
-static int64_t BuildNoteString(openmpt::module &mod, QByteArray &notes)
+// The same note intervals also feed the exact pattern hash and the similarity hash.
+int64_t ModDatabase::BuildNoteString(openmpt::module &mod, QByteArray &notes, NoteSimHash &simHash)
 {
 	const int32_t numChannels = mod.get_num_channels();
 	const int32_t numSongs = mod.get_num_subsongs();
@@ -228,6 +378,7 @@ static int64_t BuildNoteString(openmpt::module &mod, QByteArray &notes)
 							prevNoteHash = static_cast<int8_t>(note);
 						const uint8_t noteDiff = static_cast<uint8_t>(static_cast<int8_t>(note) - prevNoteHash);
 						hash = (hash ^ noteDiff) * FNV1a_PRIME;
+						simHash.AddInterval(noteDiff);
 						prevNote = prevNoteHash = static_cast<int8_t>(note);
 					}
 				}
@@ -277,44 +428,85 @@ static int64_t BuildNoteString(openmpt::module &mod, QByteArray &notes)
 
 ModDatabase::AddResult ModDatabase::PrepareQuery(const QString &path, QSqlQuery &query)
 {
-	QFile file(path);
-	if(!file.open(QIODevice::ReadOnly))
+	QByteArray content;
+	QString hash;
+	// Adding and updating modules mostly happens while scanning the whole library
+	if(!ModuleCache::Instance().Load(path, content, &hash, ModuleCache::Scan))
 	{
 		return IOError;
 	}
-	QByteArray content(file.readAll());
+	const QString dbPath = QDir::fromNativeSeparators(path);
 
-	try
+	// Check if this file already exists as-is in the database.
+	selectQuery.bindValue(":filename", dbPath);
+	if(selectQuery.exec() && selectQuery.next())
 	{
-		openmpt::module mod(content.cbegin(), content.cend());
-		const QByteArray hash = QCryptographicHash::hash(content, QCryptographicHash::Sha512);
-		const QString hashStr = hash.toBase64();
-
-		const QString dbPath = QDir::fromNativeSeparators(path);
-		// Check if this file already exists as-is in the database.
-		selectQuery.bindValue(":filename", dbPath);
-		if(selectQuery.exec() && selectQuery.next())
+		// Modules analyzed by older versions are missing some of the data
+		if(selectQuery.value("hash").toString() == hash && !selectQuery.value("note_simhash").isNull()
+			&& selectQuery.value("analysis_version").toInt() >= AnalysisPipeline::VERSION && previews.Contains(dbPath))
 		{
-			if(selectQuery.value("hash").toString() == hashStr)
-			{
-				return NoChange;
-			}
+			return NoChange;
 		}
+	}
+
+	ModuleAnalysis analysis;
+	if(!Analyze(path, content, hash, analysis))
+	{
+		return NotAdded;
+	}
+	return StoreAnalysis(analysis, query);
+}
+
+
+QString ModDatabase::HashContent(const QByteArray &content)
+{
+	return QCryptographicHash::hash(content, QCryptographicHash::Sha512).toBase64();
+}
+
+
+ModDatabase::Freshness ModDatabase::CheckFreshness(const QString &path, const Module &stored, QByteArray &content, QString &hash)
+{
+	const QFileInfo info(path);
+	if(!info.exists())
+	{
+		return Unreadable;
+	}
+	if(!stored.hash.isEmpty() && info.size() == stored.fileSize && info.lastModified().toSecsSinceEpoch() == stored.fileDate.toSecsSinceEpoch())
+	{
+		return Unchanged;
+	}
+
+	// Files are often copied or touched without being modified
+	if(!ModuleCache::Instance().Load(path, content, &hash))
+	{
+		return Unreadable;
+	}
+	return (hash == stored.hash) ? Unchanged : Changed;
+}
 
-		query.bindValue(":hash", hashStr);
-		query.bindValue(":filename", dbPath);
-		query.bindValue(":filesize", content.size());
-		query.bindValue(":filedate", QFileInfo(file).lastModified().toTime_t());
-		query.bindValue(":editdate", QDateTime::fromString(QString::fromStdString(mod.get_metadata("date")), Qt::ISODate).toTime_t());
-		query.bindValue(":format", QString::fromStdString(mod.get_metadata("type")));
-		query.bindValue(":title", QString::fromStdString(mod.get_metadata("title")));
-		query.bindValue(":length", static_cast<int>(mod.get_duration_seconds() * 1000));
-		query.bindValue(":num_channels", mod.get_num_channels());
-		query.bindValue(":num_patterns", mod.get_num_patterns());
-		query.bindValue(":num_orders", mod.get_num_orders());
-		query.bindValue(":num_subsongs", mod.get_num_subsongs());
-		query.bindValue(":num_samples", mod.get_num_samples());
-		query.bindValue(":num_instruments", mod.get_num_instruments());
+
+bool ModDatabase::Analyze(const QString &path, const QByteArray &content, const QString &hash, ModuleAnalysis &analysis)
+{
+	try
+	{
+		openmpt::module mod(content.cbegin(), content.cend());
+		analysis.fileName = QDir::fromNativeSeparators(path);
+		QVariantMap &values = analysis.values;
+
+		values[":hash"] = hash;
+		values[":filename"] = analysis.fileName;
+		values[":filesize"] = content.size();
+		values[":filedate"] = QFileInfo(path).lastModified().toTime_t();
+		values[":editdate"] = QDateTime::fromString(QString::fromStdString(mod.get_metadata("date")), Qt::ISODate).toTime_t();
+		values[":format"] = QString::fromStdString(mod.get_metadata("type"));
+		values[":title"] = QString::fromStdString(mod.get_metadata("title"));
+		values[":length"] = static_cast<int>(mod.get_duration_seconds() * 1000);
+		values[":num_channels"] = mod.get_num_channels();
+		values[":num_patterns"] = mod.get_num_patterns();
+		values[":num_orders"] = mod.get_num_orders();
+		values[":num_subsongs"] = mod.get_num_subsongs();
+		values[":num_samples"] = mod.get_num_samples();
+		values[":num_instruments"] = mod.get_num_instruments();
 		{
 			QString sampleText;
 			auto names = mod.get_sample_names();
@@ -322,7 +514,7 @@ ModDatabase::AddResult ModDatabase::PrepareQuery(const QString &path, QSqlQuery
 			{
 				sampleText += QString::fromStdString(name) + "\n";
 			}
-			query.bindValue(":sample_text", sampleText);
+			values[":sample_text"] = sampleText;
 		}
 		{
 			QString instrText;
@@ -331,72 +523,123 @@ ModDatabase::AddResult ModDatabase::PrepareQuery(const QString &path, QSqlQuery
 			{
 				instrText += QString::fromStdString(name) + "\n";
 			}
-			query.bindValue(":instrument_text", instrText);
-		}
-		query.bindValue(":comments", QString::fromStdString(mod.get_metadata("message_raw")));
-		QString artist = QString::fromStdString(mod.get_metadata("artist"));
-		if(artist.isEmpty())
-		{
-			artist = selectQuery.value("artist").toString();
+			values[":instrument_text"] = instrText;
 		}
-		query.bindValue(":artist", artist);
+		values[":comments"] = QString::fromStdString(mod.get_metadata("message_raw"));
+		values[":artist"] = QString::fromStdString(mod.get_metadata("artist"));
 
 		QByteArray notes;
-		const auto patternHash = BuildNoteString(mod, notes);
-		query.bindValue(":note_data", notes);
-		query.bindValue(":pattern_hash", QVariant::fromValue(patternHash));
-
-		ChromaprintContext *chromaprint_ctx = chromaprint_new(CHROMAPRINT_ALGORITHM_DEFAULT);
-		const int32_t samplerate = 22050;
-		chromaprint_start(chromaprint_ctx, samplerate, 1);
-		std::vector<int16_t> data(512);
-		double modLength = mod.get_duration_seconds() * samplerate;	// Prevent endless pattern loops
-		mod.set_render_param(openmpt::module::RENDER_INTERPOLATIONFILTER_LENGTH, 2);
-		while(modLength >= 0.0)
-		{
-			std::size_t count = mod.read(samplerate, data.size(), data.data());
-			modLength -= count;
-			if(!count || !chromaprint_feed(chromaprint_ctx, data.data(), static_cast<int>(count)))
-			{
-				break;
-			}
-		}
-		chromaprint_finish(chromaprint_ctx);
+		NoteSimHash simHash;
+		const auto patternHash = BuildNoteString(mod, notes, simHash);
+		values[":note_data"] = notes;
+		values[":pattern_hash"] = QVariant::fromValue(patternHash);
+		// 0 = not enough notes for a meaningful hash. Integers are signed in sqlite.
+		values[":note_simhash"] = QVariant::fromValue(simHash.IsValid() ? static_cast<int64_t>(simHash.GetHash()) : int64_t(0));
+
+		// Everything that needs the rendered audio is computed from the same render pass
+		AnalysisPipeline pipeline;
+		const auto &chromaprint = pipeline.Add<ChromaprintAnalyzer>();
+		pipeline.Add<LoudnessAnalyzer>();
+		pipeline.Add<SilenceAnalyzer>();
+		pipeline.Add<TempoAnalyzer>();
+		auto &preview = pipeline.Add<PreviewCapture>();
+		const auto &thumbnail = pipeline.Add<ThumbnailCapture>();
+		pipeline.Run(mod);
+		pipeline.Bind(values);
+		analysis.fingerprint = chromaprint.GetFingerprint();
+		analysis.preview = preview.Encode();
+		analysis.thumbnail = thumbnail.Encode();
+	} catch(openmpt::exception &e)
+	{
+		qDebug() << e.what();
+		return false;
+	}
+	return true;
+}
 
-		int rawFingerprintSize = 0, encodedFingerprintSize = 0;
-		uint32_t *rawFingerprint = nullptr;
-		char *encodedFingerprint = nullptr;
-		if(chromaprint_get_raw_fingerprint(chromaprint_ctx, &rawFingerprint, &rawFingerprintSize))
-		{
-			chromaprint_encode_fingerprint(rawFingerprint, rawFingerprintSize, CHROMAPRINT_ALGORITHM_DEFAULT, &encodedFingerprint, &encodedFingerprintSize, 0);
-		}
-		query.bindValue(":fingerprint", QByteArray(encodedFingerprint, encodedFingerprintSize));
-		chromaprint_dealloc(rawFingerprint);
-		chromaprint_dealloc(encodedFingerprint);
-		chromaprint_free(chromaprint_ctx);
 
-		if(!query.exec())
-		{
-			// May happen if identical file already exists
+ModDatabase::AddResult ModDatabase::UpdateModule(const ModuleAnalysis &analysis)
+{
+	updateQuery.bindValue(":filename_old", analysis.fileName);
+	AddResult result = StoreAnalysis(analysis, updateQuery);
+	return result == Added ? Updated : result;
+}
+
+
+ModDatabase::AddResult ModDatabase::StoreAnalysis(const ModuleAnalysis &analysis, QSqlQuery &query)
+{
+	const QString &dbPath = analysis.fileName;
+	int64_t existingId = -1;
+	QString oldArtist;
+	selectQuery.bindValue(":filename", dbPath);
+	if(selectQuery.exec() && selectQuery.next())
+	{
+		existingId = selectQuery.value("rowid").toLongLong();
+		oldArtist = selectQuery.value("artist").toString();
+	}
+	selectQuery.finish();
+
+	for(auto value = analysis.values.cbegin(); value != analysis.values.cend(); value++)
+	{
+		query.bindValue(value.key(), value.value());
+	}
+	// Keep an artist name that was entered manually if the module doesn't provide one
+	if(analysis.values.value(":artist").toString().isEmpty())
+	{
+		query.bindValue(":artist", oldArtist);
+	}
+
+	// The module and everything derived from it in this database are written in one transaction,
+	// so that e.g. the facet counts always agree with the module table. Callers may have opened a transaction of their own.
+	const bool ownTransaction = db.transaction();
+	FacetCounts::Values oldFacets, newFacets;
+	const bool hadOld = facets.GetValues(dbPath, oldFacets);
+	if(!query.exec() || query.numRowsAffected() <= 0)
+	{
+		// May happen if identical file already exists, or when updating a module that has been removed from the library in the meantime
+		if(query.lastError().isValid())
 			qDebug() << query.lastError();
-			return NotAdded;
-		}
-	} catch(openmpt::exception &e)
+		if(ownTransaction)
+			db.rollback();
+		return NotAdded;
+	}
+	// lastInsertId is only meaningful right after an insert
+	const int64_t id = (existingId != -1) ? existingId : ((&query == &insertQuery) ? query.lastInsertId().toLongLong() : -1);
+	facets.Update(hadOld, oldFacets, facets.GetValues(dbPath, newFacets), newFacets);
+	thumbnails.Store(dbPath, analysis.thumbnail);
+
+	const std::vector<uint32_t> &fingerprint = analysis.fingerprint;
+	if(clusters.IsBuilt())
 	{
-		qDebug() << e.what();
+		// Otherwise the module is picked up when the clusters are computed for the first time.
+		clusters.AddModule(dbPath, fingerprint.data(), static_cast<int>(fingerprint.size()));
+	}
+	playlists.UpdateModule(dbPath);
+	if(ownTransaction && !db.commit())
+	{
+		qDebug() << db.lastError();
+		db.rollback();
 		return NotAdded;
 	}
+	generation++;
 
+	// Previews live in their own database, and the fingerprint index in memory
+	previews.Store(dbPath, analysis.preview);
+	if(id > 0)
+	{
+		FingerprintIndex::Instance().Add(id, fingerprint.data(), static_cast<int>(fingerprint.size()));
+	}
 	return Added;
 }
 
 
-void ModDatabase::GetModule(const QString &path, Module &mod)
+bool ModDatabase::GetModule(const QString &path, Module &mod)
 {
 	selectQuery.bindValue(":filename", QDir::fromNativeSeparators(path));
-	selectQuery.exec();
-	selectQuery.next();
+	const bool found = selectQuery.exec() && selectQuery.next();
 	GetModule(selectQuery, mod);
+	selectQuery.finish();
+	return found;
 }
 
 
@@ -421,6 +664,17 @@ void ModDatabase::GetModule(QSqlQuery &query, Module &mod)
 	mod.comments = query.value("comments").toString();
 	mod.artist = query.value("artist").toString();
 	mod.personalComment = query.value("personal_comments").toString();
+	const auto optional = [&query](const char *column)
+	{
+		const QVariant value = query.value(column);
+		return value.isNull() ? std::numeric_limits<double>::quiet_NaN() : value.toDouble();
+	};
+	mod.loudness = optional("loudness");
+	mod.peak = optional("peak");
+	mod.bpm = optional("bpm");
+	mod.leadingSilence = query.value("leading_silence").toInt();
+	mod.trailingSilence = query.value("trailing_silence").toInt();
+	mod.introLength = query.value("intro_length").toInt();
 }
 
 
@@ -434,8 +688,56 @@ QString ModDatabase::GetPrintableFingerprint(const QString &path)
 }
 
 
+QString ModDatabase::GetFileName(int64_t id)
+{
+	fileNameQuery.bindValue(":id", QVariant::fromValue(id));
+	if(!fileNameQuery.exec() || !fileNameQuery.next())
+	{
+		return QString();
+	}
+	const QString fileName = fileNameQuery.value(0).toString();
+	fileNameQuery.finish();
+	return fileName;
+}
+
+
 bool ModDatabase::RemoveModule(const QString &path)
 {
-	removeQuery.bindValue(":filename", QDir::fromNativeSeparators(path));
-	return removeQuery.exec();
+	const QString dbPath = QDir::fromNativeSeparators(path);
+	int64_t id = -1;
+	idQuery.bindValue(":filename", dbPath);
+	if(idQuery.exec() && idQuery.next())
+	{
+		id = idQuery.value(0).toLongLong();
+	}
+	idQuery.finish();
+
+	// See StoreAnalysis
+	const bool ownTransaction = db.transaction();
+	clusters.RemoveModule(dbPath);
+	playlists.RemoveModule(dbPath);
+	thumbnails.Remove(dbPath);
+	FacetCounts::Values oldFacets;
+	const bool hadOld = facets.GetValues(dbPath, oldFacets);
+	removeQuery.bindValue(":filename", dbPath);
+	if(!removeQuery.exec())
+	{
+		if(ownTransaction)
+			db.rollback();
+		return false;
+	}
+	facets.Update(hadOld, oldFacets, false, oldFacets);
+	if(ownTransaction && !db.commit())
+	{
+		db.rollback();
+		return false;
+	}
+	generation++;
+
+	previews.Remove(dbPath);
+	if(id != -1)
+	{
+		FingerprintIndex::Instance().Remove(id);
+	}
+	return true;
 }
@@ -10,6 +10,14 @@
 #pragma once
 
 #include <QtSql/QtSql>
+#include "clusters.h"
+#include "smartplaylists.h"
+#include "facets.h"
+#include "previews.h"
+#include "thumbnails.h"
+
+class NoteSimHash;
+struct sqlite3;
 
 struct Module
 {
@@ -32,6 +40,23 @@ struct Module
 	QString comments;
 	QString artist;
 	QString personalComment;
+	double loudness;	// LUFS, NaN if not analyzed
+	double peak;	// dBFS, NaN if not analyzed or silent
+	double bpm;	// NaN if not analyzed or unknown
+	int leadingSilence;	// Milliseconds
+	int trailingSilence;
+	int introLength;
+};
+
+
+// Everything that is derived from the contents of a module file. Computing it does not touch the database,
+// so it can happen on any thread, and only storing it has to happen on the thread owning the database.
+struct ModuleAnalysis
+{
+	QString fileName;	// As stored in the database
+	QVariantMap values;	// Bound to the insert or update query
+	std::vector<uint32_t> fingerprint;
+	QByteArray preview, thumbnail;
 };
 
 
@@ -40,7 +65,14 @@ class ModDatabase
 protected:
 	static ModDatabase instance;
 	QSqlDatabase db;
-	QSqlQuery insertQuery, updateQuery, updateCustomQuery, selectQuery, fpQuery, removeQuery;
+	QSqlQuery insertQuery, updateQuery, updateCustomQuery, selectQuery, fpQuery, idQuery, removeQuery, fileNameQuery;
+	SimilarityClusters clusters;
+	SmartPlaylists playlists;
+	FacetCounts facets;
+	PreviewStore previews;
+	ThumbnailStore thumbnails;
+	uint64_t generation = 0;
+	bool hasRegexp = false;
 
 public:
 	enum AddResult
@@ -55,6 +87,13 @@ public:
 		OK			= Added | Updated | NoChange,
 	};
 
+	enum Freshness
+	{
+		Unchanged,
+		Changed,
+		Unreadable,
+	};
+
 	class Exception
 	{
 	protected:
@@ -69,17 +108,43 @@ public:
 
 	static ModDatabase &Instance() { return instance; }
 
-	void Open();
+	// Opens the library in the given directory, or next to the settings file if none is given
+	void Open(const QString &directory = QString());
 	AddResult AddModule(const QString &path);
 	AddResult UpdateModule(const QString &path);
+	// Stores a module that has been analyzed elsewhere in place of its previous data
+	AddResult UpdateModule(const ModuleAnalysis &analysis);
 	bool UpdateCustom(const QString &path, const QString &artist, const QString &comments);
-	void GetModule(const QString &path, Module &mod);
+	// Returns false if the module is not in the library
+	bool GetModule(const QString &path, Module &mod);
 	static void GetModule(QSqlQuery &query, Module &mod);
 	QString GetPrintableFingerprint(const QString &path);
+	QString GetFileName(int64_t id);
 	bool RemoveModule(const QString &path);
 
 	QSqlDatabase &GetDB() { return db; }
+	SimilarityClusters &GetClusters() { return clusters; }
+	SmartPlaylists &GetPlaylists() { return playlists; }
+	FacetCounts &GetFacets() { return facets; }
+	PreviewStore &GetPreviews() { return previews; }
+	// Changes whenever a module is added, updated or removed, so that anything derived from search results can tell if it is outdated.
+	uint64_t GetGeneration() const { return generation; }
+	// False if the REGEXP operator could not be installed, e.g. because Qt uses its bundled SQLite
+	bool HasRegexp() const { return hasRegexp; }
+	// Returns the SQLite connection behind a QSQLITE database, or nullptr if Qt's driver was built with its own copy of SQLite
+	// (as in the official Qt builds), in which case the connection must not be passed to the sqlite3 library that we link against.
+	static sqlite3 *NativeHandle(const QSqlDatabase &db);
+
+	// Thread-safe: Compares a module file with its stored data, first by size and date, then by content.
+	// If the file has to be read, its content and hash are returned for Analyze.
+	static Freshness CheckFreshness(const QString &path, const Module &stored, QByteArray &content, QString &hash);
+	// Thread-safe: Returns false if the module cannot be loaded
+	static bool Analyze(const QString &path, const QByteArray &content, const QString &hash, ModuleAnalysis &analysis);
+	static QString HashContent(const QByteArray &content);
+	// Returns the pattern hash of the module and fills in its note data and similarity hash
+	static int64_t BuildNoteString(openmpt::module &mod, QByteArray &notes, NoteSimHash &simHash);
 
 protected:
 	AddResult PrepareQuery(const QString &path, QSqlQuery &query);
+	AddResult StoreAnalysis(const ModuleAnalysis &analysis, QSqlQuery &query);
 };
\ No newline at end of file
@@ -0,0 +1,258 @@
+/*
+ * facets.cpp
+ * ----------
+ * Purpose: Distribution of modules over format, channel count, release year and artist.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "facets.h"
+#include "database.h"
+#include <algorithm>
+#include <unordered_set>
+
+
+// Results up to this size are looked up by rowid, larger ones are filtered during a table scan.
+static constexpr size_t MAX_ID_LIST = 10000;
+
+// How the value of each facet is derived from a module. Empty strings stand for unknown values.
+static const char *const FACET_EXPRESSIONS[FacetCounts::NUM_FACETS] =
+{
+	"COALESCE(`format`, '')",
+	"COALESCE(`num_channels`, 0)",
+	"CASE WHEN `editdate` > 0 THEN strftime('%Y', `editdate`, 'unixepoch') ELSE '' END",
+	"COALESCE(`artist`, '')",
+};
+
+static const char *const FACET_NAMES[FacetCounts::NUM_FACETS] = { "format", "channels", "year", "artist" };
+
+
+static QString FacetColumns()
+{
+	QStringList columns;
+	for(const auto expression : FACET_EXPRESSIONS)
+	{
+		columns.push_back(expression);
+	}
+	return columns.join(", ");
+}
+
+
+void FacetCounts::Open(QSqlDatabase &database)
+{
+	db = database;
+	QSqlQuery query(db);
+	if(!query.exec("CREATE TABLE IF NOT EXISTS `modlib_facets` (`facet` TEXT, `value` TEXT, `count` INT, PRIMARY KEY (`facet`, `value`)) WITHOUT ROWID"))
+	{
+		throw ModDatabase::Exception("Cannot create facet table: ", query.lastError());
+	}
+	// Lists the most frequent values of a facet without sorting all of them
+	if(!query.exec("CREATE INDEX IF NOT EXISTS `modlib_facets_count` ON `modlib_facets` (`facet`, `count` DESC, `value`)"))
+	{
+		throw ModDatabase::Exception("Cannot create facet index: ", query.lastError());
+	}
+
+	valuesQuery = QSqlQuery(db);
+	incrementQuery = QSqlQuery(db);
+	insertQuery = QSqlQuery(db);
+	decrementQuery = QSqlQuery(db);
+	cleanupQuery = QSqlQuery(db);
+	if(!valuesQuery.prepare("SELECT " + FacetColumns() + " FROM `modlib_modules` WHERE `filename` = :filename")
+		|| !incrementQuery.prepare("UPDATE `modlib_facets` SET `count` = `count` + 1 WHERE `facet` = :facet AND `value` = :value")
+		|| !insertQuery.prepare("INSERT INTO `modlib_facets` (`facet`, `value`, `count`) VALUES (:facet, :value, 1)")
+		|| !decrementQuery.prepare("UPDATE `modlib_facets` SET `count` = `count` - 1 WHERE `facet` = :facet AND `value` = :value")
+		|| !cleanupQuery.prepare("DELETE FROM `modlib_facets` WHERE `facet` = :facet AND `value` = :value AND `count` <= 0"))
+	{
+		throw ModDatabase::Exception("Cannot prepare facet queries: ", valuesQuery.lastError());
+	}
+
+	// Libraries created before facets existed are counted once
+	if(!query.exec("SELECT `value` FROM `modlib_schema` WHERE `name` = 'facets_built'") || !query.next())
+	{
+		Rebuild();
+	}
+}
+
+
+void FacetCounts::Rebuild()
+{
+	db.transaction();
+	QSqlQuery query(db);
+	query.exec("DELETE FROM `modlib_facets`");
+	for(int facet = 0; facet < NUM_FACETS; facet++)
+	{
+		query.exec(QString("INSERT INTO `modlib_facets` (`facet`, `value`, `count`) SELECT '%1', %2 AS `v`, COUNT(*) FROM `modlib_modules` GROUP BY `v`")
+			.arg(FACET_NAMES[facet]).arg(FACET_EXPRESSIONS[facet]));
+	}
+	query.exec("INSERT OR REPLACE INTO `modlib_schema` (`name`, `value`) VALUES ('facets_built', '1')");
+	db.commit();
+}
+
+
+bool FacetCounts::GetValues(const QString &fileName, Values &values)
+{
+	valuesQuery.bindValue(":filename", fileName);
+	if(!valuesQuery.exec() || !valuesQuery.next())
+	{
+		valuesQuery.finish();
+		return false;
+	}
+	for(int facet = 0; facet < NUM_FACETS; facet++)
+	{
+		values[facet] = valuesQuery.value(facet).toString();
+	}
+	valuesQuery.finish();
+	return true;
+}
+
+
+void FacetCounts::Update(bool hadOld, const Values &oldValues, bool hasNew, const Values &newValues)
+{
+	for(int facet = 0; facet < NUM_FACETS; facet++)
+	{
+		if(hadOld && hasNew && oldValues[facet] == newValues[facet])
+		{
+			continue;
+		}
+		if(hadOld)
+			Change(facet, oldValues[facet], -1);
+		if(hasNew)
+			Change(facet, newValues[facet], 1);
+	}
+}
+
+
+void FacetCounts::Change(int facet, const QString &value, int delta)
+{
+	QSqlQuery &query = (delta > 0) ? incrementQuery : decrementQuery;
+	query.bindValue(":facet", FACET_NAMES[facet]);
+	query.bindValue(":value", value);
+	query.exec();
+	if(delta > 0 && query.numRowsAffected() == 0)
+	{
+		insertQuery.bindValue(":facet", FACET_NAMES[facet]);
+		insertQuery.bindValue(":value", value);
+		insertQuery.exec();
+	} else if(delta < 0)
+	{
+		cleanupQuery.bindValue(":facet", FACET_NAMES[facet]);
+		cleanupQuery.bindValue(":value", value);
+		cleanupQuery.exec();
+	}
+}
+
+
+FacetCounts::Counts FacetCounts::GetLibraryCounts(int maxValues)
+{
+	Counts counts;
+	QSqlQuery query(db);
+	query.setForwardOnly(true);
+	query.prepare("SELECT `value`, `count` FROM `modlib_facets` WHERE `facet` = :facet AND `count` > 0 ORDER BY `count` DESC, `value` LIMIT :limit");
+	for(int facet = 0; facet < NUM_FACETS; facet++)
+	{
+		query.bindValue(":facet", FACET_NAMES[facet]);
+		query.bindValue(":limit", maxValues);
+		query.exec();
+		while(query.next())
+		{
+			counts.facets[facet].push_back({ query.value(0).toString(), query.value(1).toInt() });
+		}
+		query.finish();
+	}
+	return counts;
+}
+
+
+FacetCounts::Counts FacetCounts::Compute(QSqlDatabase &db, const std::vector<int64_t> &ids, const std::function<bool()> &isCanceled)
+{
+	QString queryStr = "SELECT `rowid`, " + FacetColumns() + " FROM `modlib_modules`";
+	std::unordered_set<int64_t> members;
+	if(ids.size() <= MAX_ID_LIST)
+	{
+		QStringList idList;
+		idList.reserve(static_cast<int>(ids.size()));
+		for(const auto id : ids)
+		{
+			idList.push_back(QString::number(id));
+		}
+		queryStr += " WHERE `rowid` IN (" + idList.join(',') + ")";
+	} else
+	{
+		members.insert(ids.begin(), ids.end());
+	}
+
+	std::array<QHash<QString, int>, NUM_FACETS> counts;
+	QSqlQuery query(db);
+	query.setForwardOnly(true);
+	query.exec(queryStr);
+	while(!isCanceled() && query.next())
+	{
+		if(!members.empty() && !members.count(query.value(0).toLongLong()))
+		{
+			continue;
+		}
+		for(int facet = 0; facet < NUM_FACETS; facet++)
+		{
+			counts[facet][query.value(facet + 1).toString()]++;
+		}
+	}
+
+	Counts result;
+	for(int facet = 0; facet < NUM_FACETS; facet++)
+	{
+		result.facets[facet] = Sorted(counts[facet]);
+	}
+	return result;
+}
+
+
+FacetCounts::FacetList FacetCounts::Sorted(const QHash<QString, int> &counts)
+{
+	FacetList list;
+	list.reserve(counts.size());
+	for(auto it = counts.cbegin(); it != counts.cend(); it++)
+	{
+		list.push_back({ it.key(), it.value() });
+	}
+	std::sort(list.begin(), list.end(), [](const auto &a, const auto &b)
+	{
+		return a.second != b.second ? a.second > b.second : a.first < b.first;
+	});
+	return list;
+}
+
+
+// Written in terms of the plain columns, so that the indices on them can be used
+QString FacetCounts::Condition(Facet facet, const QString &value)
+{
+	QString literal = value;
+	literal = "'" + literal.replace('\'', "''") + "'";
+	switch(facet)
+	{
+	case FORMAT:
+		return value.isEmpty() ? QString("(COALESCE(`format`, '') = '') ") : "(`format` = " + literal + ") ";
+	case CHANNELS:
+		return value.toInt() == 0 ? QString("(COALESCE(`num_channels`, 0) = 0) ") : "(`num_channels` = " + QString::number(value.toInt()) + ") ";
+	case YEAR:
+		if(value.isEmpty())
+		{
+			return "(COALESCE(`editdate`, 0) <= 0) ";
+		} else
+		{
+			const QDateTime start(QDate(value.toInt(), 1, 1), QTime(0, 0), Qt::UTC);
+			return "(`editdate` BETWEEN " + QString::number(start.toSecsSinceEpoch()) + " AND " + QString::number(start.addYears(1).toSecsSinceEpoch() - 1) + ") ";
+		}
+	case ARTIST:
+		return value.isEmpty() ? QString("(COALESCE(`artist`, '') = '') ") : "(`artist` = " + literal + ") ";
+	case NUM_FACETS:
+		break;
+	}
+	return QString();
+}
+
+
+QString FacetCounts::Name(Facet facet)
+{
+	return FACET_NAMES[facet];
+}
@@ -0,0 +1,62 @@
+/*
+ * facets.h
+ * --------
+ * Purpose: Distribution of modules over format, channel count, release year and artist.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QtSql/QtSql>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// The counts for the whole library are stored in the database and updated whenever a module is added,
+// updated or removed, so they never require a scan of the module table. Counts for a search result are
+// computed from its rowids in a single query.
+class FacetCounts
+{
+public:
+	enum Facet { FORMAT = 0, CHANNELS, YEAR, ARTIST, NUM_FACETS };
+
+	using Values = std::array<QString, NUM_FACETS>;
+	// Value and number of modules, most frequent values first
+	using FacetList = std::vector<std::pair<QString, int>>;
+	struct Counts
+	{
+		std::array<FacetList, NUM_FACETS> facets;
+	};
+
+protected:
+	QSqlDatabase db;
+	QSqlQuery valuesQuery, incrementQuery, insertQuery, decrementQuery, cleanupQuery;
+
+public:
+	void Open(QSqlDatabase &database);
+
+	// Current facet values of a module. Returns false if it is not in the database.
+	bool GetValues(const QString &fileName, Values &values);
+	// Move a module from its old to its new facet values. Either side is ignored if the module didn't or doesn't exist.
+	void Update(bool hadOld, const Values &oldValues, bool hasNew, const Values &newValues);
+
+	// The most frequent values of each facet in the whole library, read from the index without looking at the other values
+	Counts GetLibraryCounts(int maxValues);
+	// Counts for a set of modules. Return true from isCanceled to abort the computation.
+	static Counts Compute(QSqlDatabase &db, const std::vector<int64_t> &ids, const std::function<bool()> &isCanceled);
+
+	// SQL condition selecting all modules with the given facet value
+	static QString Condition(Facet facet, const QString &value);
+	static QString Name(Facet facet);
+
+protected:
+	void Rebuild();
+	void Change(int facet, const QString &value, int delta);
+	static FacetList Sorted(const QHash<QString, int> &counts);
+};
+
+Q_DECLARE_METATYPE(FacetCounts::Counts)
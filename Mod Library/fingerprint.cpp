@@ -0,0 +1,410 @@
+/*
+ * fingerprint.cpp
+ * ---------------
+ * Purpose: Chromaprint fingerprint comparison and sub-fingerprint index for fast audio lookup.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "fingerprint.h"
+#include <QtSql/QSqlQuery>
+#include <QVariant>
+#include <climits>
+#include <algorithm>
+#include <chromaprint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <nmmintrin.h>
+#endif
+
+
+static const uint8_t BitsSetTable256[256] =
+{
+#	define B2(n) n,     n+1,     n+1,     n+2
+#	define B4(n) B2(n), B2(n+1), B2(n+1), B2(n+2)
+#	define B6(n) B4(n), B4(n+1), B4(n+1), B4(n+2)
+	B6(0), B6(1), B6(1), B6(2)
+};
+
+#ifdef _MSC_VER
+static const bool HasPopCnt = []()
+{
+	int CPUInfo[4];
+	__cpuid(CPUInfo, 1);
+	return (CPUInfo[2] & (1 << 23)) != 0;
+}();
+#endif
+
+
+FingerprintMatcher::FingerprintMatcher(const uint32_t *fingerprint, int size) : fingerprint(fingerprint), size(std::max(size, 0))
+{
+	uint32_t prevKey = 0;
+	for(int i = 0; i < this->size; i++)
+	{
+		const uint32_t key = Key(fingerprint[i]);
+		if(i > 0 && key == prevKey)
+		{
+			continue;
+		}
+		prevKey = key;
+		positions[key].push_back(i);
+	}
+}
+
+
+uint32_t FingerprintMatcher::Key(uint32_t subFingerprint)
+{
+	return FingerprintIndex::Key(subFingerprint);
+}
+
+
+int FingerprintMatcher::HammingDistance(const uint32_t *a, const uint32_t *b, int length, int limit)
+{
+	// Sub-fingerprints are compared in blocks so that hopeless comparisons can be abandoned early.
+	static constexpr int BLOCK_SIZE = 64;
+	int differences = 0;
+	for(int start = 0; start < length && differences <= limit; start += BLOCK_SIZE)
+	{
+		const int end = std::min(start + BLOCK_SIZE, length);
+#ifdef _MSC_VER
+		if(HasPopCnt)
+		{
+			for(int i = start; i < end; i++)
+			{
+				differences += _mm_popcnt_u32(a[i] ^ b[i]);
+			}
+		} else
+#elif defined(__GNUC__)
+		for(int i = start; i < end; i++)
+		{
+			differences += __builtin_popcount(a[i] ^ b[i]);
+		}
+		if(0)
+#endif
+		{
+			for(int i = start; i < end; i++)
+			{
+				union { uint32_t u32; uint8_t u8[4]; } v;
+				v.u32 = a[i] ^ b[i];
+				differences += BitsSetTable256[v.u8[0]]
+				+ BitsSetTable256[v.u8[1]]
+				+ BitsSetTable256[v.u8[2]]
+				+ BitsSetTable256[v.u8[3]];
+			}
+		}
+	}
+	return differences;
+}
+
+
+int FingerprintMatcher::Compare(const uint32_t *other, int otherSize, int minMatch) const
+{
+	if(!size || otherSize <= 0)
+	{
+		return minMatch > 0 ? -1 : 0;
+	}
+
+	// Histogram of alignments (other frame - query frame) at which identical sub-fingerprints occur.
+	// Offsets range from -(size - 1) to otherSize - 1, both directions are possible.
+	const int bias = size - 1;
+	std::vector<int> histogram(size + otherSize - 1, 0);
+	uint32_t prevKey = 0;
+	for(int j = 0; j < otherSize; j++)
+	{
+		const uint32_t key = Key(other[j]);
+		if(j > 0 && key == prevKey)
+		{
+			continue;
+		}
+		prevKey = key;
+		const auto it = positions.find(key);
+		if(it == positions.end())
+		{
+			continue;
+		}
+		for(const int i : it->second)
+		{
+			histogram[j - i + bias]++;
+		}
+	}
+
+	// Pick the strongest peaks. The unshifted alignment is always tried as well, as two renderings
+	// of the same song may not share a single exact sub-fingerprint but still be very similar.
+	int offsets[NUM_ALIGNMENTS + 1];
+	int votes[NUM_ALIGNMENTS + 1];
+	int numOffsets = 0;
+	offsets[numOffsets] = 0;
+	votes[numOffsets++] = INT_MAX;
+	for(int h = 0; h < static_cast<int>(histogram.size()); h++)
+	{
+		const int count = histogram[h];
+		if(!count || h == bias)
+		{
+			continue;
+		}
+		if(numOffsets <= NUM_ALIGNMENTS || count > votes[numOffsets - 1])
+		{
+			int pos = std::min(numOffsets, NUM_ALIGNMENTS);
+			while(pos > 1 && votes[pos - 1] < count)
+			{
+				offsets[pos] = offsets[pos - 1];
+				votes[pos] = votes[pos - 1];
+				pos--;
+			}
+			offsets[pos] = h - bias;
+			votes[pos] = count;
+			if(numOffsets <= NUM_ALIGNMENTS)
+				numOffsets++;
+		}
+	}
+
+	// Score the overlapping part of each candidate alignment, normalized to its length so that
+	// short clips taken from anywhere in a song can still result in a high match quality.
+	// Each alignment only has to beat the best one found so far, which allows for abandoning most comparisons early.
+	int bestMatch = -1;
+	for(int o = 0; o < numOffsets; o++)
+	{
+		const int offset = offsets[o];
+		const int queryStart = std::max(0, -offset), otherStart = std::max(0, offset);
+		const int overlap = std::min(size - queryStart, otherSize - otherStart);
+		if(overlap < std::min(MIN_OVERLAP, std::min(size, otherSize)) || overlap <= 0)
+		{
+			continue;
+		}
+		const int maxDifferences = 32 * overlap;
+		const int requiredMatch = std::max(minMatch, bestMatch + 1);
+		if(requiredMatch > 100)
+		{
+			break;
+		}
+		const int limit = ((100 - requiredMatch) * maxDifferences) / 100;
+		const int differences = HammingDistance(fingerprint + queryStart, other + otherStart, overlap, limit);
+		if(differences <= limit)
+		{
+			bestMatch = (100 * (maxDifferences - differences)) / maxDifferences;
+		}
+	}
+	if(bestMatch < minMatch)
+	{
+		return minMatch > 0 ? -1 : 0;
+	}
+	return bestMatch;
+}
+
+
+FingerprintIndex FingerprintIndex::instance;
+
+void FingerprintIndex::Build(QSqlDatabase &db)
+{
+	QWriteLocker locker(&lock);
+	if(built)
+	{
+		return;
+	}
+
+	QSqlQuery query(db);
+	query.setForwardOnly(true);
+	if(!query.exec("SELECT `rowid`, `fingerprint` FROM `modlib_modules`"))
+	{
+		return;
+	}
+	while(query.next())
+	{
+		const QByteArray fingerprint = query.value(1).toByteArray();
+		uint32_t *rawFingerprint = nullptr;
+		int rawFingerprintSize = 0;
+		if(chromaprint_decode_fingerprint(fingerprint.constData(), fingerprint.size(), &rawFingerprint, &rawFingerprintSize, nullptr, 0))
+		{
+			AddUnlocked(query.value(0).toLongLong(), rawFingerprint, rawFingerprintSize);
+		}
+		chromaprint_dealloc(rawFingerprint);
+	}
+	built = true;
+}
+
+
+bool FingerprintIndex::IsBuilt() const
+{
+	QReadLocker locker(&lock);
+	return built;
+}
+
+
+void FingerprintIndex::Clear()
+{
+	QWriteLocker locker(&lock);
+	postings.clear();
+	entries.clear();
+	slotOfModule.clear();
+	numPostings = numDeadPostings = 0;
+	built = false;
+}
+
+
+void FingerprintIndex::Add(int64_t id, const uint32_t *fingerprint, int size)
+{
+	QWriteLocker locker(&lock);
+	if(built)
+	{
+		// If the index hasn't been built yet, the module will be picked up from the database later.
+		AddUnlocked(id, fingerprint, size);
+	}
+}
+
+
+void FingerprintIndex::Remove(int64_t id)
+{
+	QWriteLocker locker(&lock);
+	RemoveUnlocked(id);
+}
+
+
+void FingerprintIndex::AddUnlocked(int64_t id, const uint32_t *fingerprint, int size)
+{
+	RemoveUnlocked(id);
+	if(size <= 0)
+	{
+		return;
+	}
+
+	const uint32_t slot = static_cast<uint32_t>(entries.size());
+	entries.push_back({ id, 0 });
+	slotOfModule[id] = slot;
+
+	uint32_t prevKey = 0;
+	for(int i = 0; i < size; i++)
+	{
+		// Sustained notes and silence produce long runs of the same sub-fingerprint; only the start of a run is interesting.
+		const uint32_t key = Key(fingerprint[i]);
+		if(i > 0 && key == prevKey)
+		{
+			continue;
+		}
+		prevKey = key;
+		postings[key].push_back({ slot, static_cast<uint32_t>(i) });
+		entries[slot].numPostings++;
+	}
+	numPostings += entries[slot].numPostings;
+}
+
+
+void FingerprintIndex::RemoveUnlocked(int64_t id)
+{
+	auto it = slotOfModule.find(id);
+	if(it == slotOfModule.end())
+	{
+		return;
+	}
+	// Postings of removed modules are skipped while querying and purged once they make up a sizeable part of the index.
+	entries[it->second].id = -1;
+	numDeadPostings += entries[it->second].numPostings;
+	slotOfModule.erase(it);
+	if(numDeadPostings * 2 > numPostings)
+	{
+		Compact();
+	}
+}
+
+
+void FingerprintIndex::Compact()
+{
+	// Renumber the remaining slots so that removed and re-added modules don't keep growing the slot list
+	std::vector<uint32_t> newSlot(entries.size(), uint32_t(-1));
+	uint32_t numSlots = 0;
+	for(uint32_t slot = 0; slot < entries.size(); slot++)
+	{
+		if(entries[slot].id == -1)
+		{
+			continue;
+		}
+		newSlot[slot] = numSlots;
+		entries[numSlots] = entries[slot];
+		slotOfModule[entries[numSlots].id] = numSlots;
+		numSlots++;
+	}
+	entries.resize(numSlots);
+	entries.shrink_to_fit();
+
+	numPostings = 0;
+	for(auto it = postings.begin(); it != postings.end();)
+	{
+		auto &list = it->second;
+		list.erase(std::remove_if(list.begin(), list.end(), [&newSlot](const Posting &p) { return newSlot[p.slot] == uint32_t(-1); }), list.end());
+		for(auto &posting : list)
+		{
+			posting.slot = newSlot[posting.slot];
+		}
+		numPostings += list.size();
+		if(list.empty())
+			it = postings.erase(it);
+		else
+			++it;
+	}
+	numDeadPostings = 0;
+}
+
+
+std::vector<FingerprintIndex::Candidate> FingerprintIndex::Query(const uint32_t *fingerprint, int size, size_t maxCandidates, int minHits) const
+{
+	QReadLocker locker(&lock);
+
+	// Offset voting: Every matching sub-fingerprint votes for the alignment (slot, module frame - query frame).
+	// A true match produces a sharp peak at a single offset, while random collisions spread out.
+	std::unordered_map<uint64_t, int> votes;
+	uint32_t prevKey = 0;
+	for(int i = 0; i < size; i++)
+	{
+		const uint32_t key = Key(fingerprint[i]);
+		if(i > 0 && key == prevKey)
+		{
+			continue;
+		}
+		prevKey = key;
+
+		const auto list = postings.find(key);
+		if(list == postings.end() || list->second.size() > MAX_POSTINGS_PER_KEY)
+		{
+			continue;
+		}
+		for(const auto &posting : list->second)
+		{
+			if(entries[posting.slot].id == -1)
+			{
+				continue;
+			}
+			const int32_t offset = static_cast<int32_t>(posting.offset) - i;
+			votes[(uint64_t(posting.slot) << 32) | static_cast<uint32_t>(offset)]++;
+		}
+	}
+
+	// Keep the best offset of each module
+	std::unordered_map<uint32_t, Candidate> best;
+	for(const auto &vote : votes)
+	{
+		if(vote.second < minHits)
+		{
+			continue;
+		}
+		const uint32_t slot = static_cast<uint32_t>(vote.first >> 32);
+		const int32_t offset = static_cast<int32_t>(static_cast<uint32_t>(vote.first));
+		auto it = best.find(slot);
+		if(it == best.end())
+			best[slot] = { entries[slot].id, vote.second, offset };
+		else if(vote.second > it->second.hits)
+			it->second = { entries[slot].id, vote.second, offset };
+	}
+
+	std::vector<Candidate> candidates;
+	candidates.reserve(best.size());
+	for(const auto &b : best)
+	{
+		candidates.push_back(b.second);
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) { return a.hits > b.hits || (a.hits == b.hits && a.id < b.id); });
+	if(candidates.size() > maxCandidates)
+	{
+		candidates.resize(maxCandidates);
+	}
+	return candidates;
+}
@@ -0,0 +1,110 @@
+/*
+ * fingerprint.h
+ * -------------
+ * Purpose: Chromaprint fingerprint comparison and sub-fingerprint index for fast audio lookup.
+ * Notes  : Module IDs are SQLite rowids, which are only stable for the lifetime of a session
+ *          (VACUUM may renumber them), so the index lives in memory and is rebuilt on demand.
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QReadWriteLock>
+#include <QtSql/QSqlDatabase>
+#include <climits>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Compares a query fingerprint against module fingerprints.
+// Instead of trying every possible alignment, the offsets at which the fingerprints share the most
+// sub-fingerprints are determined through a histogram, and only those few offsets are scored.
+class FingerprintMatcher
+{
+public:
+	// Number of histogram peaks that are fully scored
+	static constexpr int NUM_ALIGNMENTS = 3;
+	// Overlaps shorter than this (about two seconds) are too short to be meaningful
+	static constexpr int MIN_OVERLAP = 16;
+
+protected:
+	const uint32_t *fingerprint;
+	int size;
+	std::unordered_map<uint32_t, std::vector<int>> positions;	// Sub-fingerprint key -> frames in the query
+
+public:
+	FingerprintMatcher(const uint32_t *fingerprint, int size);
+
+	// Returns the match quality in percent for the best alignment of both fingerprints.
+	// If the match quality cannot reach minMatch, the comparison is abandoned early and -1 is returned.
+	int Compare(const uint32_t *other, int otherSize, int minMatch = 0) const;
+
+	// Number of differing bits between two sub-fingerprint sequences.
+	// Counting stops as soon as the distance exceeds the limit; the returned value is then only guaranteed to be greater than the limit.
+	static int HammingDistance(const uint32_t *a, const uint32_t *b, int length, int limit = INT_MAX);
+
+	static uint32_t Key(uint32_t subFingerprint);
+};
+
+
+class FingerprintIndex
+{
+public:
+	struct Candidate
+	{
+		int64_t id;	// rowid of the module in modlib_modules
+		int hits;	// Number of sub-fingerprints that agree on the best offset
+		int offset;	// Best alignment (module frame - query frame)
+	};
+
+	// Only the upper 28 bits of each sub-fingerprint are used as a key, like AcoustID does.
+	// The lowest classifiers are the noisiest ones and would just spread the postings.
+	static constexpr uint32_t KEY_MASK = 0xFFFFFFF0u;
+	// Keys that occur in more modules than this are "stop words" (e.g. silence) and are not voted on.
+	static constexpr size_t MAX_POSTINGS_PER_KEY = 20000;
+
+protected:
+	struct Posting
+	{
+		uint32_t slot;
+		uint32_t offset;
+	};
+
+	struct Slot
+	{
+		int64_t id;	// rowid, or -1 if the module has been removed
+		size_t numPostings;
+	};
+
+	static FingerprintIndex instance;
+
+	mutable QReadWriteLock lock;
+	std::unordered_map<uint32_t, std::vector<Posting>> postings;
+	std::vector<Slot> entries;
+	std::unordered_map<int64_t, uint32_t> slotOfModule;
+	size_t numPostings = 0, numDeadPostings = 0;
+	bool built = false;
+
+public:
+	static FingerprintIndex &Instance() { return instance; }
+
+	// Build the index from the stored fingerprints if this hasn't happened yet in this session.
+	void Build(QSqlDatabase &db);
+	bool IsBuilt() const;
+	void Clear();
+
+	// Incremental maintenance during ingest. Add replaces any previous entry of the same module.
+	void Add(int64_t id, const uint32_t *fingerprint, int size);
+	void Remove(int64_t id);
+
+	// Return the modules sharing the most sub-fingerprints with the query at a consistent offset, best first.
+	std::vector<Candidate> Query(const uint32_t *fingerprint, int size, size_t maxCandidates, int minHits) const;
+
+protected:
+	static uint32_t Key(uint32_t subFingerprint) { return subFingerprint & KEY_MASK; }
+	friend class FingerprintMatcher;
+	void AddUnlocked(int64_t id, const uint32_t *fingerprint, int size);
+	void RemoveUnlocked(int64_t id);
+	void Compact();
+};
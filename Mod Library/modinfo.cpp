@@ -9,14 +9,17 @@
 
 #include "modinfo.h"
 #include "database.h"
-#include "audioplayer.h"
+#include "audioengine.h"
+#include "modulecache.h"
 #include <QtWidgets/QMenu>
 #include <QtWidgets/QMessageBox>
 #include <QClipboard>
+#include <QtConcurrent/QtConcurrent>
+#include <cmath>
 
 
 ModInfo::ModInfo(const QString &fileName, QWidget *parent)
-	: QDialog(parent), fileName(fileName), audio(nullptr)
+	: QDialog(parent), fileName(fileName)
 {
 	ui.setupUi(this);
 	QString nativeName = QDir::toNativeSeparators(fileName);
@@ -24,20 +27,75 @@ ModInfo::ModInfo(const QString &fileName, QWidget *parent)
 	ui.fileName->setText(nativeName);
 	this->setWindowFlags(Qt::Dialog | Qt::WindowMinMaxButtonsHint | Qt::WindowCloseButtonHint);
 
-	if(ModDatabase::Instance().UpdateModule(fileName) & ModDatabase::Error)
+	// Show what is known about the module right away. It is only analyzed again if it has changed since then.
+	Module mod;
+	const bool inDatabase = ModDatabase::Instance().GetModule(fileName, mod);
+	ShowModule(mod);
+	ui.editArtist->setText(mod.artist);
+	ui.personalComments->setPlainText(mod.personalComment);
+
+	connect(ui.close, &QPushButton::clicked, this, &ModInfo::close);
+	connect(ui.openFile, &QPushButton::clicked, this, &ModInfo::OnOpenFileMenu);
+	connect(ui.play, &QPushButton::clicked, this, &ModInfo::OnPlay);
+	connect(ui.volumeSlider, &QSlider::valueChanged, this, &ModInfo::OnVolumeChanged);
+	connect(&AudioEngine::Instance(), &AudioEngine::Finished, this, &ModInfo::OnPlaybackFinished);
+	connect(ui.copyFingerprint, &QPushButton::clicked, this, &ModInfo::OnCopyFingerprint);
+	connect(&checkWatcher, &QFutureWatcher<CheckResult>::finished, this, &ModInfo::OnModuleChecked);
+	// A module that is not in the library has nothing to update, and nothing to remove either
+	if(inDatabase)
+	{
+		checkWatcher.setFuture(QtConcurrent::run(&ModInfo::CheckModule, fileName, mod));
+	}
+}
+
+
+// Runs in the thread pool. If the dialog is closed before this finishes, the result is simply dropped.
+ModInfo::CheckResult ModInfo::CheckModule(const QString &fileName, const Module &stored)
+{
+	CheckResult result;
+	QByteArray content;
+	QString hash;
+	result.freshness = ModDatabase::CheckFreshness(fileName, stored, content, hash);
+	if(result.freshness == ModDatabase::Changed)
 	{
-		QMessageBox mb(QMessageBox::Question, tr("Mod Library"), tr("Error while loading information for file\n%1\nWould you like to remove it form the database?").arg(nativeName), QMessageBox::Yes | QMessageBox::No);
+		result.analyzed = ModDatabase::Analyze(fileName, content, hash, result.analysis);
+	}
+	return result;
+}
+
+
+void ModInfo::OnModuleChecked()
+{
+	const CheckResult result = checkWatcher.result();
+	if(result.freshness == ModDatabase::Unchanged)
+	{
+		return;
+	}
+	if(!result.analyzed || (ModDatabase::Instance().UpdateModule(result.analysis) & ModDatabase::Error))
+	{
+		QMessageBox mb(QMessageBox::Question, tr("Mod Library"), tr("Error while loading information for file\n%1\nWould you like to remove it form the database?").arg(QDir::toNativeSeparators(fileName)), QMessageBox::Yes | QMessageBox::No);
 		mb.setDefaultButton(QMessageBox::Yes);
 		if(mb.exec() == QMessageBox::Yes)
 		{
 			ModDatabase::Instance().RemoveModule(fileName);
-			QTimer::singleShot(0, this, &ModInfo::close);
-			return;
+			close();
 		}
+		return;
 	}
-	
+
 	Module mod;
 	ModDatabase::Instance().GetModule(fileName, mod);
+	ShowModule(mod);
+	// Don't overwrite what the user is typing
+	if(!ui.editArtist->isModified())
+	{
+		ui.editArtist->setText(mod.artist);
+	}
+}
+
+
+void ModInfo::ShowModule(const Module &mod)
+{
 	ui.songTitle->setText(mod.title);
 	QString info;
 	info +=
@@ -50,10 +108,25 @@ ModInfo::ModInfo(const QString &fileName, QWidget *parent)
 		.arg(mod.numPatterns)
 		.arg(mod.numSamples)
 		.arg(mod.numInstruments);
+	if(!std::isnan(mod.loudness))
+	{
+		info += tr("\nLoudness: %1 LUFS, peak %2 dBFS").arg(mod.loudness, 0, 'f', 1).arg(std::isnan(mod.peak) ? tr("-inf") : QString::number(mod.peak, 'f', 1));
+	}
+	if(!std::isnan(mod.bpm))
+	{
+		info += tr("\nTempo: %1 BPM").arg(mod.bpm, 0, 'f', 1);
+	}
+	if(mod.leadingSilence || mod.trailingSilence || mod.introLength)
+	{
+		info += tr("\nSilence: %1 s at the start, %2 s at the end, intro %3 s")
+			.arg(mod.leadingSilence / 1000.0, 0, 'f', 1)
+			.arg(mod.trailingSilence / 1000.0, 0, 'f', 1)
+			.arg(mod.introLength / 1000.0, 0, 'f', 1);
+	}
 	ui.varInfo->setPlainText(info);
-	ui.editArtist->setText(mod.artist);
 
 	setUpdatesEnabled(false);
+	ui.sampleNames->clear();
 	auto names = mod.sampleText.split('\n');
 	for(int i = 0; i < mod.numSamples; i++)
 	{
@@ -61,6 +134,7 @@ ModInfo::ModInfo(const QString &fileName, QWidget *parent)
 		ui.sampleNames->addItem(name);
 	}
 
+	ui.instrumentNames->clear();
 	names = mod.instrumentText.split('\n');
 	for(int i = 0; i < mod.numInstruments; i++)
 	{
@@ -70,22 +144,12 @@ ModInfo::ModInfo(const QString &fileName, QWidget *parent)
 	setUpdatesEnabled(true);
 
 	ui.comments->setPlainText(mod.comments);
-	ui.personalComments->setPlainText(mod.personalComment);
-
-	connect(ui.close, &QPushButton::clicked, this, &ModInfo::close);
-	connect(ui.openFile, &QPushButton::clicked, this, &ModInfo::OnOpenFileMenu);
-	connect(ui.play, &QPushButton::clicked, this, &ModInfo::OnPlay);
-	connect(ui.volumeSlider, &QSlider::valueChanged, this, &ModInfo::OnVolumeChanged);
-	connect(ui.copyFingerprint, &QPushButton::clicked, this, &ModInfo::OnCopyFingerprint);
 }
 
 
 ModInfo::~ModInfo()
 {
-	if(audio != nullptr)
-	{
-		audio->kill = true;
-	}
+	AudioEngine::Instance().Stop(playbackId);
 	ModDatabase::Instance().UpdateCustom(fileName, ui.editArtist->text(), ui.personalComments->toPlainText());
 }
 
@@ -111,27 +175,33 @@ void ModInfo::OnOpenExplorer()
 
 void ModInfo::OnPlay()
 {
-	if(audio == nullptr)
+	if(playbackId == 0)
 	{
-		QFile file(fileName);
-		if(!file.open(QIODevice::ReadOnly))
+		QByteArray content;
+		if(!ModuleCache::Instance().Load(fileName, content))
 		{
 			return;
 		}
 
-		QThread *thread = new QThread;
-		audio = new AudioThread(file, ui.volumeSlider->value());
-		audio->moveToThread(thread);
-		connect(thread, &QThread::started, audio, &AudioThread::process);
-		connect(audio, &AudioThread::finished, thread, &QThread::quit);
-		connect(audio, &AudioThread::finished, audio, &AudioThread::deleteLater);
-		connect(thread, &QThread::finished, thread, &QThread::deleteLater);
-		thread->start();
-		ui.play->setText("&Stop");
+		std::unique_ptr<AudioSource> source;
+		try
+		{
+			source = std::make_unique<ModuleSource>(content, true);
+		} catch(const openmpt::exception &)
+		{
+			return;
+		}
+		AudioEngine &engine = AudioEngine::Instance();
+		engine.SetVolume(ui.volumeSlider->value());
+		playbackId = engine.Play(std::move(source));
+		if(playbackId != 0)
+		{
+			ui.play->setText("&Stop");
+		}
 	} else
 	{
-		audio->kill = true;
-		audio = nullptr;
+		AudioEngine::Instance().Stop(playbackId);
+		playbackId = 0;
 		ui.play->setText("&Play");
 	}
 }
@@ -139,9 +209,19 @@ void ModInfo::OnPlay()
 
 void ModInfo::OnVolumeChanged(int volume)
 {
-	if(audio != nullptr)
+	if(playbackId != 0)
 	{
-		audio->setVolume(volume);
+		AudioEngine::Instance().SetVolume(volume);
+	}
+}
+
+
+void ModInfo::OnPlaybackFinished(quint64 id)
+{
+	if(id == playbackId)
+	{
+		playbackId = 0;
+		ui.play->setText("&Play");
 	}
 }
 
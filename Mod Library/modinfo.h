@@ -10,11 +10,10 @@
 #pragma once
 
 #include <QtWidgets/QDialog>
+#include <QFutureWatcher>
 #include "ui_modinfo.h"
 #include "database.h"
 
-class AudioThread;
-
 class DefaultPrograms
 {
 	QString name, path, parameters;
@@ -25,8 +24,16 @@ class ModInfo : public QDialog
 	Q_OBJECT
 
 protected:
+	struct CheckResult
+	{
+		ModDatabase::Freshness freshness = ModDatabase::Unchanged;
+		bool analyzed = false;
+		ModuleAnalysis analysis;
+	};
+
 	QString fileName;
-	AudioThread *audio;
+	uint64_t playbackId = 0;	// Playback started from this dialog, 0 if not playing
+	QFutureWatcher<CheckResult> checkWatcher;
 
 public:
 	ModInfo(const QString &fileName, QWidget *parent = nullptr);
@@ -37,7 +44,13 @@ protected slots:
 	void OnOpenExplorer();
 	void OnPlay();
 	void OnVolumeChanged(int);
+	void OnPlaybackFinished(quint64 id);
 	void OnCopyFingerprint();
+	void OnModuleChecked();
+
+protected:
+	void ShowModule(const Module &mod);
+	static CheckResult CheckModule(const QString &fileName, const Module &stored);
 
 private:
 	Ui_ModInfo ui;
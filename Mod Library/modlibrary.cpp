@@ -13,18 +13,81 @@
 #include "about.h"
 #include "database.h"
 #include "tablemodel.h"
+#include "searchworker.h"
+#include "notesimilarity.h"
+#include "sqlregexp.h"
+#include "audioengine.h"
+#include "previews.h"
+#include "queueplayer.h"
+#include "audioexport.h"
+#include "modulecache.h"
+#include "thumbnaildelegate.h"
+#include "thumbnails.h"
 #include <QtWidgets/QMessageBox>
 #include <QtWidgets/QFileDialog>
 #include <QThread>
+#include <QEventLoop>
 #include <QtWidgets/QProgressDialog>
+#include <QtWidgets/QInputDialog>
+#include <QtWidgets/QToolButton>
 #include <QClipboard>
 #include <QSettings>
+#include <QRegularExpression>
+#include <QKeyEvent>
+#include <QFutureWatcher>
+#include <QtConcurrent/QtConcurrent>
+#include <algorithm>
+#include <atomic>
+#include <unordered_map>
 #include <utility>
 #include <libopenmpt/libopenmpt.hpp>
 #include <chromaprint.h>
-#ifdef _MSC_VER
-#include <smmintrin.h>
-#endif
+
+
+// Delay after the last keystroke before searching as you type, in milliseconds
+static constexpr int LIVE_SEARCH_DELAY = 60;
+// Time the mouse has to rest on a result before its preview starts playing
+static constexpr int HOVER_PREVIEW_DELAY = 250;
+// Number of most frequent values listed for each facet
+static constexpr size_t MAX_FACET_VALUES = 50;
+// Results of larger searches are not kept for refining them, as listing their rowids would take longer than scanning the table
+static constexpr size_t MAX_REFINABLE_RESULTS = 50000;
+
+
+static QString EscapeLike(QString str)
+{
+	return str.replace('\\', "\\\\")
+		.replace('%', "\\%")
+		.replace('_', "\\_");
+}
+
+
+// Replace all placeholders by SQL literals of their values, in a single pass so that placeholder names inside of values are left alone.
+static QString InlineBindValues(const QString &sql, const std::vector<std::pair<QString, QVariant>> &bindValues)
+{
+	QString result;
+	for(int i = 0; i < sql.size(); i++)
+	{
+		bool replaced = false;
+		if(sql[i] == ':')
+		{
+			for(const auto &value : bindValues)
+			{
+				const int length = value.first.size();
+				if(sql.midRef(i, length) == value.first && (i + length == sql.size() || !(sql[i + length].isLetterOrNumber() || sql[i + length] == '_')))
+				{
+					result += "'" + value.second.toString().replace('\'', "''") + "'";
+					i += length - 1;
+					replaced = true;
+					break;
+				}
+			}
+		}
+		if(!replaced)
+			result += sql[i];
+	}
+	return result;
+}
 
 
 ModLibrary::ModLibrary(QWidget *parent)
@@ -52,25 +115,90 @@ ModLibrary::ModLibrary(QWidget *parent)
 		QTimer::singleShot(0, this, &ModLibrary::close);
 		return;
 	}
+	if(!ModDatabase::Instance().HasRegexp())
+	{
+		ui.findRegex->setChecked(false);
+		ui.findRegex->setEnabled(false);
+		ui.findRegex->setToolTip(tr("Regular expression search requires Qt to use the system SQLite library."));
+	}
+
+	// Searches run on their own thread, so that the window stays responsive
+	searchWorker = new SearchWorker(ModDatabase::Instance().GetDB().databaseName());
+	searchWorker->moveToThread(&searchThread);
+	connect(&searchThread, &QThread::finished, searchWorker, &QObject::deleteLater);
+	connect(searchWorker, &SearchWorker::ResultsReady, this, &ModLibrary::OnSearchResults);
+	connect(searchWorker, &SearchWorker::Finished, this, &ModLibrary::OnSearchFinished);
+	connect(searchWorker, &SearchWorker::FacetsReady, this, &ModLibrary::OnFacetsReady);
+	searchThread.start();
 
 	// Menu
 	connect(ui.actionAddFile, &QAction::triggered, this, &ModLibrary::OnAddFile);
 	connect(ui.actionAddFolder, &QAction::triggered, this, &ModLibrary::OnAddFolder);
 	connect(ui.actionExportPlaylist, &QAction::triggered, this, &ModLibrary::OnExportPlaylist);
+	connect(ui.actionExportAudio, &QAction::triggered, this, &ModLibrary::OnExportAudio);
 	connect(ui.actionSettings, &QAction::triggered, this, &ModLibrary::OnSettings);
 	connect(ui.actionAbout, &QAction::triggered, this, &ModLibrary::OnAbout);
 	connect(ui.actionFindDuplicates, &QAction::triggered, this, &ModLibrary::OnFindDupes);
+	connect(ui.actionFindSimilar, &QAction::triggered, this, &ModLibrary::OnFindSimilar);
+	connect(ui.actionSavePlaylist, &QAction::triggered, this, &ModLibrary::OnSavePlaylist);
+
+	// Smart playlists are listed in a drop-down menu that is rebuilt every time it is opened
+	playlistMenu = new QMenu(this);
+	removePlaylistMenu = new QMenu(tr("&Delete"), this);
+	ui.actionSmartPlaylists->setMenu(playlistMenu);
+	if(auto *button = qobject_cast<QToolButton *>(ui.mainToolBar->widgetForAction(ui.actionSmartPlaylists)))
+	{
+		button->setPopupMode(QToolButton::InstantPopup);
+	}
+	connect(playlistMenu, &QMenu::aboutToShow, this, &ModLibrary::OnShowPlaylistMenu);
 
 	// Search navigation
 	connect(ui.doSearch, &QPushButton::clicked, this, &ModLibrary::OnSearch);
 	connect(ui.actionShow, &QAction::triggered, this, &ModLibrary::OnShowAll);
 	connect(ui.actionMaintain, &QAction::triggered, this, &ModLibrary::OnMaintain);
 	connect(ui.findWhat, &QLineEdit::returnPressed, this, &ModLibrary::OnSearch);
+	liveSearchTimer.setSingleShot(true);
+	liveSearchTimer.setInterval(LIVE_SEARCH_DELAY);
+	connect(&liveSearchTimer, &QTimer::timeout, this, &ModLibrary::OnLiveSearch);
+	connect(ui.findWhat, &QLineEdit::textEdited, this, [this]() { liveSearchTimer.start(); });
 	connect(ui.melody, &QLineEdit::returnPressed, this, &ModLibrary::OnSearch);
 	connect(ui.fingerprint, &QLineEdit::returnPressed, this, &ModLibrary::OnSearch);
 	connect(ui.pasteMPT, &QPushButton::clicked, this, &ModLibrary::OnPasteMPT);
 
 	connect(ui.resultTable, &QTableView::doubleClicked, this, &ModLibrary::OnCellClicked);
+	thumbnailDelegate = new ThumbnailDelegate(this);
+	connect(ui.facetTree, &QTreeWidget::itemClicked, this, &ModLibrary::OnFacetClicked);
+
+	// Previews: Space plays the selected result, and optionally resting the mouse on a result plays it as well
+	ui.resultTable->installEventFilter(this);
+	ui.resultTable->viewport()->installEventFilter(this);
+	previewOnHover = SettingsDialog::GetPreviewOnHover();
+	ui.resultTable->setMouseTracking(previewOnHover);
+	ModuleCache::Instance().SetBudget(static_cast<size_t>(SettingsDialog::GetModuleCacheSize()) << 20);
+	hoverPreviewTimer.setSingleShot(true);
+	hoverPreviewTimer.setInterval(HOVER_PREVIEW_DELAY);
+	connect(&hoverPreviewTimer, &QTimer::timeout, this, &ModLibrary::OnHoverPreview);
+	connect(ui.resultTable, &QTableView::entered, this, [this](const QModelIndex &index)
+	{
+		if(previewOnHover)
+		{
+			hoverIndex = index;
+			hoverPreviewTimer.start();
+		}
+	});
+	connect(&AudioEngine::Instance(), &AudioEngine::Finished, this, &ModLibrary::OnPlaybackFinished);
+
+	queuePlayer = new QueuePlayer(this);
+	connect(ui.actionPlayResults, &QAction::triggered, this, &ModLibrary::OnPlayResults);
+	connect(queuePlayer, &QueuePlayer::TrackStarted, this, [this](int index, int count, const QString &fileName)
+	{
+		ui.actionPlayResults->setText(tr("Stop P&laying"));
+		ui.statusBar->showMessage(tr("Playing %1 of %2: %3").arg(index + 1).arg(count).arg(QDir::toNativeSeparators(fileName)));
+	});
+	connect(queuePlayer, &QueuePlayer::Stopped, this, [this]()
+	{
+		ui.actionPlayResults->setText(tr("P&lay Results"));
+	});
 
 	checkBoxes.push_back(ui.findFilename);
 	checkBoxes.push_back(ui.findTitle);
@@ -89,7 +217,12 @@ ModLibrary::ModLibrary(QWidget *parent)
 
 ModLibrary::~ModLibrary()
 {
-
+	if(searchWorker)
+	{
+		searchWorker->Cancel();
+	}
+	searchThread.quit();
+	searchThread.wait();
 }
 
 
@@ -106,10 +239,98 @@ void ModLibrary::closeEvent(QCloseEvent *event)
 	settings.endGroup();
 	settings.setValue("lastdir", lastDir);
 
+	StopPreview();
 	event->accept();
 }
 
 
+bool ModLibrary::eventFilter(QObject *watched, QEvent *event)
+{
+	if(watched == ui.resultTable && event->type() == QEvent::KeyPress && static_cast<QKeyEvent *>(event)->key() == Qt::Key_Space)
+	{
+		const QModelIndex index = ui.resultTable->currentIndex();
+		if(previewId != 0 && index.isValid() && index.data(Qt::UserRole).toString() == previewFile)
+			StopPreview();
+		else
+			PlayPreview(index);
+		return true;
+	} else if(watched == ui.resultTable->viewport() && event->type() == QEvent::Leave && previewOnHover)
+	{
+		hoverPreviewTimer.stop();
+		StopPreview();
+	}
+	return QMainWindow::eventFilter(watched, event);
+}
+
+
+void ModLibrary::OnHoverPreview()
+{
+	if(hoverIndex.isValid() && hoverIndex.data(Qt::UserRole).toString() != previewFile)
+	{
+		PlayPreview(hoverIndex);
+	}
+}
+
+
+// Previews are decoded from the preview database, so they start playing without touching the module file.
+void ModLibrary::PlayPreview(const QModelIndex &index)
+{
+	if(!index.isValid())
+	{
+		return;
+	}
+	const QString fileName = index.data(Qt::UserRole).toString();
+	auto source = PreviewSource::Create(ModDatabase::Instance().GetPreviews().Load(fileName));
+	if(source == nullptr)
+	{
+		ui.statusBar->showMessage(tr("No preview available for %1. Update the file to create one.").arg(QDir::toNativeSeparators(fileName)));
+		return;
+	}
+	previewId = AudioEngine::Instance().Play(std::move(source));
+	previewFile = (previewId != 0) ? fileName : QString();
+}
+
+
+void ModLibrary::StopPreview()
+{
+	if(previewId != 0)
+	{
+		AudioEngine::Instance().Stop(previewId);
+	}
+	previewId = 0;
+	previewFile.clear();
+}
+
+
+// The list of results is taken as it is right now, later searches or sorting don't change what is being played.
+void ModLibrary::OnPlayResults()
+{
+	if(queuePlayer->IsPlaying())
+	{
+		queuePlayer->Stop();
+		return;
+	}
+	const TableModel *model = static_cast<const TableModel *>(ui.resultTable->model());
+	if(model == nullptr || model->GetIds().empty())
+	{
+		return;
+	}
+	StopPreview();
+	const int row = ui.resultTable->currentIndex().isValid() ? ui.resultTable->currentIndex().row() : 0;
+	queuePlayer->Start(model->GetIds(), static_cast<size_t>(row));
+}
+
+
+void ModLibrary::OnPlaybackFinished(quint64 id)
+{
+	if(id == previewId)
+	{
+		previewId = 0;
+		previewFile.clear();
+	}
+}
+
+
 void ModLibrary::OnAddFile()
 {
 	static QString modExtensions;
@@ -227,127 +448,280 @@ void ModLibrary::OnMaintain()
 }
 
 
-void ModLibrary::DoSearch(bool showAll)
+void ModLibrary::DoSearch(bool showAll, bool live)
 {
-	setCursor(Qt::BusyCursor);
-
-	QString what = ui.findWhat->text();
-	what.replace('\\', "\\\\")
-		.replace('%', "\\%")
-		.replace('_', "\\_")
+	liveSearchTimer.stop();
+	QString what = EscapeLike(ui.findWhat->text())
 		.replace('*', "%")
 		.replace('?', "_");
 	what = "%" + what + "%";
 
-	std::vector<QByteArray> melodyBytes;
+	// Regular expressions are only evaluated on rows that contain the text that every match requires, which LIKE finds much faster.
+	const bool useRegex = ui.findRegex->isChecked() && !showAll;
+	QString regexLiteral;
+	if(useRegex)
+	{
+		const QRegularExpression regex(ui.findWhat->text());
+		if(!regex.isValid())
+		{
+			ui.statusBar->showMessage(tr("Invalid regular expression: %1").arg(regex.errorString()));
+			return;
+		}
+		regexLiteral = SqlRegexp::RequiredLiteral(ui.findWhat->text());
+	}
+	const auto textCondition = [useRegex, &regexLiteral](const char *column)
+	{
+		const QString name = QString("`") + column + "`";
+		if(!useRegex)
+			return "OR " + name + " LIKE :str ESCAPE '\\' ";
+		else if(regexLiteral.isEmpty())
+			return "OR " + name + " REGEXP :str ";
+		else
+			return "OR (" + name + " LIKE :literal ESCAPE '\\' AND " + name + " REGEXP :str) ";
+	};
+
+	SearchRequest request;
 	QByteArray fingerprint = ui.fingerprint->text().trimmed().toLatin1();
 	uint32_t *rawFingerprint = nullptr;
 	int rawFingerprintSize = 0;
 	chromaprint_decode_fingerprint(fingerprint.data(), fingerprint.size(), &rawFingerprint, &rawFingerprintSize, nullptr, 1);
+	request.fingerprint.assign(rawFingerprint, rawFingerprint + std::max(rawFingerprintSize, 0));
+	request.maxMatches = SettingsDialog::GetMaxFingerprintMatches();
+	chromaprint_dealloc(rawFingerprint);
 
-	QString queryStr = "SELECT `filename`, `title`, `filesize`, `filedate` ";
-	if(rawFingerprintSize)
+	request.select = "SELECT `rowid` ";
+	if(!request.fingerprint.empty())
 	{
-		queryStr += ", `fingerprint` ";
-
+		request.select += ", `fingerprint` ";
 	}
-	queryStr += "FROM `modlib_modules` ";
-	if(!showAll)
+	request.select += "FROM `modlib_modules` ";
+	SearchPredicate search;
+	if(showAll)
+	{
+		facetFilters.clear();
+	} else
 	{
-		queryStr += "WHERE (0 ";
-		if(ui.findFilename->isChecked())		queryStr += "OR `filename` LIKE :str ESCAPE '\\' ";
-		if(ui.findTitle->isChecked())			queryStr += "OR `title` LIKE :str ESCAPE '\\' ";
-		if(ui.findArtist->isChecked())			queryStr += "OR `artist` LIKE :str ESCAPE '\\' ";
-		if(ui.findSampleText->isChecked())		queryStr += "OR `sample_text` LIKE :str ESCAPE '\\' ";
-		if(ui.findInstrumentText->isChecked())	queryStr += "OR `instrument_text` LIKE :str ESCAPE '\\' ";
-		if(ui.findComments->isChecked())		queryStr += "OR `comments` LIKE :str ESCAPE '\\' ";
-		if(ui.findPersonal->isChecked())		queryStr += "OR `personal_comments` LIKE :str ESCAPE '\\' ";
+		QString &queryStr = search.columns;
+		queryStr += "(0 ";
+		if(ui.findFilename->isChecked())		queryStr += textCondition("filename");
+		if(ui.findTitle->isChecked())			queryStr += textCondition("title");
+		if(ui.findArtist->isChecked())			queryStr += textCondition("artist");
+		if(ui.findSampleText->isChecked())		queryStr += textCondition("sample_text");
+		if(ui.findInstrumentText->isChecked())	queryStr += textCondition("instrument_text");
+		if(ui.findComments->isChecked())		queryStr += textCondition("comments");
+		if(ui.findPersonal->isChecked())		queryStr += textCondition("personal_comments");
 		queryStr += ") ";
+		request.bindValues.push_back({ ":str", useRegex ? ui.findWhat->text() : what });
+		if(useRegex && !regexLiteral.isEmpty())
+		{
+			request.bindValues.push_back({ ":literal", "%" + EscapeLike(regexLiteral) + "%" });
+		}
+		search.text = ui.findWhat->text();
 
 		if(ui.limitSize->isChecked())
 		{
 			const auto factor = 1 << (10 * ui.limitSizeUnit->currentIndex());
 			auto sizeMin = ui.limitMinSize->value() * factor, sizeMax = ui.limitMaxSize->value() * factor;
 			if(sizeMin > sizeMax) std::swap(sizeMin, sizeMax);
-			queryStr += "AND (`filesize` BETWEEN " + QString::number(sizeMin) + " AND " + QString::number(sizeMax) + ") ";
+			search.filters.push_back("(`filesize` BETWEEN " + QString::number(sizeMin) + " AND " + QString::number(sizeMax) + ") ");
 		}
 		if(ui.limitFileDate->isChecked())
 		{
 			auto dateMin = QDateTime(ui.limitFileDateMin->date(), QTime(0, 0, 0)).toTime_t();
 			auto dateMax = QDateTime(ui.limitFileDateMax->date(), QTime(23, 59, 59)).toTime_t();
 			if(dateMin > dateMax) std::swap(dateMin, dateMax);
-			queryStr += "AND (`filedate` BETWEEN " + QString::number(dateMin) + " AND " + QString::number(dateMax) + ") ";
+			search.filters.push_back("(`filedate` BETWEEN " + QString::number(dateMin) + " AND " + QString::number(dateMax) + ") ");
 		}
 		if(ui.limitYear->isChecked())
 		{
 			auto dateMin = QDateTime(ui.limitReleaseDateMin->date(), QTime(0, 0, 0)).toTime_t();
 			auto dateMax = QDateTime(ui.limitReleaseDateMax->date(), QTime(23, 59, 59)).toTime_t();
 			if(dateMin > dateMax) std::swap(dateMin, dateMax);
-			queryStr += "AND (`editdate` BETWEEN " + QString::number(dateMin) + " AND " + QString::number(dateMax) + ") ";
+			search.filters.push_back("(`editdate` BETWEEN " + QString::number(dateMin) + " AND " + QString::number(dateMax) + ") ");
 		}
 		if(ui.limitTime->isChecked())
 		{
 			auto timeMin = ui.limitTimeMin->value() * 1000, timeMax = ui.limitTimeMax->value() * 1000;
 			if(timeMin > timeMax) std::swap(timeMin, timeMax);
-			queryStr += "AND (`length` BETWEEN " + QString::number(timeMin) + " AND " + QString::number(timeMax) + ") ";
+			search.filters.push_back("(`length` BETWEEN " + QString::number(timeMin) + " AND " + QString::number(timeMax) + ") ");
 		}
 
-		// Search for melody
+		// Structural filters, all of which are backed by an index
+		if(ui.limitFormat->isChecked())
+		{
+			QStringList formats;
+			for(const auto &format : ui.limitFormatList->text().toLower().split(QRegularExpression("[^a-z0-9]+"), Qt::SkipEmptyParts))
+			{
+				formats.push_back("'" + format + "'");
+			}
+			formats.sort();
+			formats.removeDuplicates();
+			if(!formats.isEmpty())
+				search.filters.push_back("(`format` IN (" + formats.join(',') + ")) ");
+		}
+		if(ui.limitChannels->isChecked())
+		{
+			auto channelsMin = ui.limitChannelsMin->value(), channelsMax = ui.limitChannelsMax->value();
+			if(channelsMin > channelsMax) std::swap(channelsMin, channelsMax);
+			search.filters.push_back("(`num_channels` BETWEEN " + QString::number(channelsMin) + " AND " + QString::number(channelsMax) + ") ");
+		}
+		if(ui.limitSamples->isChecked())
+		{
+			auto samplesMin = ui.limitSamplesMin->value(), samplesMax = ui.limitSamplesMax->value();
+			if(samplesMin > samplesMax) std::swap(samplesMin, samplesMax);
+			search.filters.push_back("(`num_samples` BETWEEN " + QString::number(samplesMin) + " AND " + QString::number(samplesMax) + ") ");
+		}
+		if(ui.limitInstruments->isChecked())
+		{
+			search.filters.push_back("(`num_instruments` > 0) ");
+		}
+		for(const auto &facet : facetFilters)
+		{
+			search.filters.push_back(FacetCounts::Condition(facet.first, facet.second));
+		}
+
+		// Search for melody. The notes are part of the condition, so that identical melodies can be recognized when refining a search.
 		const auto melodies = ui.melody->text().split('|');
-		int melodyCount = 0;
 		for(const auto &melody : melodies)
 		{
 			const auto melodyStr = melody.simplified();
 			const auto notes = melodyStr.split(' ');
 			if(!melodyStr.isEmpty() && !notes.isEmpty())
 			{
-				melodyBytes.push_back(QByteArray());
-				melodyBytes[melodyCount].reserve(notes.size());
+				QByteArray melodyBytes;
+				melodyBytes.reserve(notes.size());
 				for(const auto &note : notes)
 				{
 					int8_t n = static_cast<int8_t>(note.toInt());
-					melodyBytes[melodyCount].push_back(n);
+					melodyBytes.push_back(n);
 				}
-				queryStr += "AND INSTR(`note_data`, :note_data" + QString::number(melodyCount) + ") > 0 ";
-				melodyCount++;
+				search.filters.push_back("INSTR(`note_data`, X'" + QString::fromLatin1(melodyBytes.toHex()) + "') > 0 ");
 			}
 		}
+
+		request.where = search.columns;
+		for(const auto &filter : search.filters)
+		{
+			request.where += "AND " + filter;
+		}
+
+		// Fingerprint searches rank their results among the whole library, so they cannot be refined.
+		// A longer regular expression doesn't necessarily match fewer rows.
+		search.valid = request.fingerprint.empty() && !useRegex;
+		search.dbGeneration = ModDatabase::Instance().GetGeneration();
+		if(lastSearch.IsRefinedBy(search))
+		{
+			request.restrictToIds = true;
+			request.ids = lastSearch.ids;
+		}
 	}
 
-	QSqlQuery query(ModDatabase::Instance().GetDB());
-	query.prepare(queryStr);
-	query.bindValue(":str", what);
-	for(size_t i = 0; i < melodyBytes.size(); i++)
+	// Let the database sort the results if possible. Titles are not sorted there, as SQLite's collation differs from QCollator.
+	TableModel *model = new TableModel(ModDatabase::Instance().GetDB(), !request.fingerprint.empty());
+	const QHeaderView *header = ui.resultTable->horizontalHeader();
+	const int sortColumn = header->sortIndicatorSection();
+	const Qt::SortOrder sortOrder = header->sortIndicatorOrder();
+	if(!request.fingerprint.empty() && request.maxMatches > 0)
 	{
-		query.bindValue(":note_data" + QString::number(i), melodyBytes[i]);
+		// Best matches come first
+		model->SetPresorted(TableModel::FINGERPRINT_TABLE, Qt::DescendingOrder);
+	} else if(ui.resultTable->isSortingEnabled() && TableModel::IndexedSortColumn(sortColumn))
+	{
+		request.orderBy = QString("ORDER BY `") + TableModel::IndexedSortColumn(sortColumn) + (sortOrder == Qt::DescendingOrder ? "` DESC " : "` ");
+		model->SetPresorted(sortColumn, sortOrder);
 	}
 
-	TableModel *model = new TableModel(query, rawFingerprint, rawFingerprintSize);
-	ui.resultTable->setModel(model);
+	searchShowAll = showAll;
+	searchLive = live;
+	pendingSearch = std::move(search);
+	searchKey = ResultCache::Key(request);
+	searchCondition.clear();
+	if(request.fingerprint.empty())
+	{
+		// Fingerprint searches only keep the best matches, which is not a property of a single module
+		searchCondition = request.where.isEmpty() ? QString("1") : InlineBindValues(request.where, request.bindValues);
+	}
+	searchDBGeneration = ModDatabase::Instance().GetGeneration();
 
-	QHeaderView *verticalHeader = ui.resultTable->verticalHeader();
-	verticalHeader->setSectionResizeMode(QHeaderView::Fixed);
+	// Repeated searches are answered from the cache, as long as the library has not been modified in the meantime.
+	if(const auto *rows = resultCache.Find(searchKey, searchDBGeneration))
+	{
+		CancelSearch();
+		SetResultModel(model);
+		model->AppendRows(*rows);
+		ShowSearchResults(rows->size(), true);
+		return;
+	}
 
-	QHeaderView *horizontalHeader = ui.resultTable->horizontalHeader();
-	horizontalHeader->setStretchLastSection(false);
-	horizontalHeader->setSectionResizeMode(0, QHeaderView::Stretch);
-	for(int i = model->columnCount() - 1; i >= 1; i--)
+	// Any search that is still running is superseded by this one.
+	searchRunning = true;
+	searchGeneration = searchWorker->Start(request);
+	SetResultModel(model);
+	ui.statusBar->showMessage(tr("Searching..."));
+}
+
+
+void ModLibrary::OnSearchResults(int generation, const QVector<TableModel::Row> &rows)
+{
+	if(generation != searchGeneration)
 	{
-		horizontalHeader->setSectionResizeMode(i, QHeaderView::ResizeToContents);
+		return;
 	}
+	TableModel *model = static_cast<TableModel *>(ui.resultTable->model());
+	model->AppendRows(rows);
+	ui.statusBar->showMessage(tr("Searching... %1 files found so far.").arg(model->rowCount()));
+}
 
-	const int numRows = model->rowCount();
-	ui.statusBar->showMessage(tr("%1 files found.").arg(numRows));
 
-	if(rawFingerprintSize)
+void ModLibrary::OnSearchFinished(int generation, int numResults, bool canceled)
+{
+	if(generation != searchGeneration)
+	{
+		return;
+	}
+	searchRunning = false;
+	emit SearchFinished();
+	if(canceled)
+	{
+		ui.statusBar->showMessage(tr("Search canceled, %1 files found.").arg(numResults));
+		return;
+	}
+	ShowSearchResults(numResults, false);
+}
+
+
+void ModLibrary::ShowSearchResults(int numResults, bool cached)
+{
+	ui.statusBar->showMessage(tr("%1 files found.").arg(numResults));
+
+	TableModel *model = static_cast<TableModel *>(ui.resultTable->model());
+	// Results are cached in the order they came from the database, i.e. before sorting them.
+	// If the library was modified while searching, they may already be outdated.
+	if(!cached && searchDBGeneration == ModDatabase::Instance().GetGeneration())
+	{
+		resultCache.Insert(searchKey, searchDBGeneration, model->GetRows());
+	}
+	if(pendingSearch.valid && static_cast<size_t>(numResults) <= MAX_REFINABLE_RESULTS)
+	{
+		lastSearch = std::move(pendingSearch);
+		lastSearch.ids = model->GetIds();
+	}
+	pendingSearch.valid = false;
+	if(model->hasFingerprint)
 	{
 		// Sort by match quality when searching for fingerprints
-		ui.resultTable->sortByColumn(3, Qt::DescendingOrder);
+		ui.resultTable->sortByColumn(TableModel::FINGERPRINT_TABLE, Qt::DescendingOrder);
+	} else if(ui.resultTable->isSortingEnabled())
+	{
+		// Rows have been appended in database order while the search was running
+		const QHeaderView *header = ui.resultTable->horizontalHeader();
+		model->sort(header->sortIndicatorSection(), header->sortIndicatorOrder());
 	}
 
-	unsetCursor();
+	UpdateFacets();
 
-	if(numRows == 1 && !showAll)
+	// Don't interrupt typing with a dialog
+	if(numResults == 1 && !searchShowAll && !searchLive)
 	{
 		// Show the only result
 		OnCellClicked(model->index(0, 0));
@@ -355,20 +729,120 @@ void ModLibrary::DoSearch(bool showAll)
 }
 
 
-void ModLibrary::OnFindDupes()
+// The facets of the whole library are always up to date, those of other results are counted in the background.
+void ModLibrary::UpdateFacets()
 {
-	setCursor(Qt::BusyCursor);
+	const TableModel *model = static_cast<const TableModel *>(ui.resultTable->model());
+	if(searchShowAll || model == nullptr)
+	{
+		facetGeneration = 0;
+		ShowFacets(ModDatabase::Instance().GetFacets().GetLibraryCounts(static_cast<int>(MAX_FACET_VALUES)));
+	} else
+	{
+		facetGeneration = searchWorker->StartFacets(model->GetIds());
+	}
+}
 
-	QSqlQuery query(ModDatabase::Instance().GetDB());
-	query.prepare(
-//		"SELECT `filename`, `title`, `filesize`, `filedate` FROM `modlib_modules` AS `m1` WHERE `filename` IN "
-//		"(SELECT `filename` FROM `modlib_modules` AS `m2` WHERE `m1`.`hash` = `m2`.`hash` AND `m1`.`filename` <> `m2`.`filename`) ORDER BY `hash`"
-		"SELECT `filename`, `title`, `filesize`, `filedate`, COUNT(*) FROM `modlib_modules`"
-		"GROUP BY `pattern_hash` HAVING COUNT(*) > 1"
-		);
 
-	TableModel *model = new TableModel(query, nullptr, 0);
+void ModLibrary::OnFacetsReady(int generation, const FacetCounts::Counts &counts)
+{
+	if(generation == facetGeneration)
+	{
+		ShowFacets(counts);
+	}
+}
+
+
+void ModLibrary::ShowFacets(const FacetCounts::Counts &counts)
+{
+	const QString titles[FacetCounts::NUM_FACETS] = { tr("Format"), tr("Channels"), tr("Release Year"), tr("Artist") };
+	ui.facetTree->clear();
+	for(int facet = 0; facet < FacetCounts::NUM_FACETS; facet++)
+	{
+		auto *group = new QTreeWidgetItem(ui.facetTree, QStringList(titles[facet]));
+		const auto &values = counts.facets[facet];
+		for(size_t i = 0; i < values.size() && i < MAX_FACET_VALUES; i++)
+		{
+			const QString &value = values[i].first;
+			const QString label = value.isEmpty() ? tr("Unknown") : (facet == FacetCounts::FORMAT ? value.toUpper() : value);
+			auto *item = new QTreeWidgetItem(group, QStringList(tr("%1 (%2)").arg(label).arg(values[i].second)));
+			item->setData(0, Qt::UserRole, facet);
+			item->setData(0, Qt::UserRole + 1, value);
+			const bool selected = std::find(facetFilters.begin(), facetFilters.end(), std::make_pair(static_cast<FacetCounts::Facet>(facet), value)) != facetFilters.end();
+			item->setCheckState(0, selected ? Qt::Checked : Qt::Unchecked);
+		}
+		// There are usually lots of artists
+		group->setExpanded(facet != FacetCounts::ARTIST);
+	}
+}
+
+
+// Selecting a facet value narrows down the current search, selecting it again removes it from the search.
+void ModLibrary::OnFacetClicked(QTreeWidgetItem *item)
+{
+	if(item == nullptr || item->parent() == nullptr)
+	{
+		return;
+	}
+	const auto facet = std::make_pair(static_cast<FacetCounts::Facet>(item->data(0, Qt::UserRole).toInt()), item->data(0, Qt::UserRole + 1).toString());
+	const auto it = std::find(facetFilters.begin(), facetFilters.end(), facet);
+	if(it != facetFilters.end())
+		facetFilters.erase(it);
+	else
+		facetFilters.push_back(facet);
+	DoSearch(false);
+}
+
+
+// A search only narrows this one down if it looks for a longer text in the same columns and applies at least the same filters.
+// The text is translated to a LIKE pattern character by character, so anything matching the longer text also matches the shorter one.
+bool ModLibrary::SearchPredicate::IsRefinedBy(const SearchPredicate &other) const
+{
+	if(!valid || !other.valid || dbGeneration != other.dbGeneration || columns != other.columns || !other.text.contains(text))
+	{
+		return false;
+	}
+	for(const auto &filter : filters)
+	{
+		if(!other.filters.contains(filter))
+			return false;
+	}
+	return true;
+}
+
+
+void ModLibrary::CancelSearch()
+{
+	// Results of a search that may still be running are not wanted anymore
+	searchWorker->Cancel();
+	searchGeneration = 0;
+	if(searchRunning)
+	{
+		searchRunning = false;
+		emit SearchFinished();
+	}
+}
+
+
+void ModLibrary::WaitForSearch()
+{
+	if(!searchRunning)
+	{
+		return;
+	}
+	QEventLoop loop;
+	connect(this, &ModLibrary::SearchFinished, &loop, &QEventLoop::quit);
+	loop.exec();
+}
+
+
+void ModLibrary::SetResultModel(TableModel *model)
+{
+	QAbstractItemModel *oldModel = ui.resultTable->model();
+	QItemSelectionModel *oldSelection = ui.resultTable->selectionModel();
 	ui.resultTable->setModel(model);
+	delete oldSelection;
+	delete oldModel;
 
 	QHeaderView *verticalHeader = ui.resultTable->verticalHeader();
 	verticalHeader->setSectionResizeMode(QHeaderView::Fixed);
@@ -381,8 +855,160 @@ void ModLibrary::OnFindDupes()
 		horizontalHeader->setSectionResizeMode(i, QHeaderView::ResizeToContents);
 	}
 
+	// The thumbnail column moves depending on the kind of result
+	for(int i = 0; i < model->columnCount(); i++)
+	{
+		ui.resultTable->setItemDelegateForColumn(i, (i == model->ThumbnailColumn()) ? thumbnailDelegate : nullptr);
+	}
+	horizontalHeader->setSectionResizeMode(model->ThumbnailColumn(), QHeaderView::Fixed);
+	horizontalHeader->resizeSection(model->ThumbnailColumn(), ThumbnailCapture::ENVELOPE_POINTS + 2 * ThumbnailDelegate::MARGIN);
+}
+
+
+void ModLibrary::OnFindDupes()
+{
+	setCursor(Qt::BusyCursor);
+
+	// Modules with identical patterns or near-identical note similarity hashes are grouped together.
+	// Edits, remixes and transpositions are found this way without having to compare any audio.
+	QSqlQuery query(ModDatabase::Instance().GetDB());
+	query.setForwardOnly(true);
+	query.exec("SELECT `rowid`, `pattern_hash`, `note_simhash` FROM `modlib_modules`");
+	std::vector<int64_t> ids;
+	std::vector<uint64_t> simHashes;
+	std::unordered_map<int64_t, uint32_t> firstOfPatternHash;
+	std::vector<uint32_t> parent;
+	NoteSimilarityIndex index;
+	std::vector<uint32_t> moduleOfIndex;
+	std::vector<int> similarity;
+	const auto findRoot = [&parent](uint32_t x)
+	{
+		while(parent[x] != x)
+		{
+			parent[x] = parent[parent[x]];
+			x = parent[x];
+		}
+		return x;
+	};
+	const auto join = [&](uint32_t a, uint32_t b, int sim)
+	{
+		const uint32_t rootA = findRoot(a), rootB = findRoot(b);
+		if(rootA != rootB)
+			parent[std::max(rootA, rootB)] = std::min(rootA, rootB);
+		similarity[a] = std::max(similarity[a], sim);
+		similarity[b] = std::max(similarity[b], sim);
+	};
+	while(query.next())
+	{
+		const uint32_t module = static_cast<uint32_t>(ids.size());
+		ids.push_back(query.value(0).toLongLong());
+		parent.push_back(module);
+		similarity.push_back(0);
+
+		const auto exact = firstOfPatternHash.insert({ query.value(1).toLongLong(), module });
+		if(!exact.second)
+		{
+			join(exact.first->second, module, 100);
+		}
+
+		const uint64_t simHash = static_cast<uint64_t>(query.value(2).toLongLong());
+		if(simHash)
+		{
+			for(const auto other : index.Find(simHash))
+			{
+				join(moduleOfIndex[other], module, NoteSimilarityIndex::Similarity(simHash, simHashes[other]));
+			}
+			index.Add(simHash);
+			simHashes.push_back(simHash);
+			moduleOfIndex.push_back(module);
+		}
+	}
+	query.finish();
+
+	query.exec("CREATE TEMP TABLE IF NOT EXISTS `modlib_dupes` (`id` INT PRIMARY KEY, `cluster` INT, `similarity` INT)");
+	query.exec("DELETE FROM `modlib_dupes`");
+	ModDatabase::Instance().GetDB().transaction();
+	query.prepare("INSERT INTO `modlib_dupes` (`id`, `cluster`, `similarity`) VALUES (:id, :cluster, :similarity)");
+	for(uint32_t module = 0; module < ids.size(); module++)
+	{
+		if(!similarity[module])
+		{
+			continue;
+		}
+		query.bindValue(":id", QVariant::fromValue(ids[module]));
+		query.bindValue(":cluster", findRoot(module) + 1);
+		query.bindValue(":similarity", similarity[module]);
+		query.exec();
+	}
+	ModDatabase::Instance().GetDB().commit();
+
+	query.setForwardOnly(false);
+	query.prepare(
+		"SELECT `d`.`id`, `d`.`cluster`, `d`.`similarity` "
+		"FROM `modlib_dupes` AS `d` JOIN `modlib_modules` AS `m` ON `m`.`rowid` = `d`.`id` "
+		"ORDER BY `d`.`cluster`, `d`.`similarity` DESC"
+		);
+
+	CancelSearch();
+	searchCondition.clear();
+	searchShowAll = false;
+	TableModel *model = new TableModel(ModDatabase::Instance().GetDB(), query);
+	SetResultModel(model);
+
+	const int numRows = model->rowCount();
+	ui.statusBar->showMessage(tr("%1 files found.").arg(numRows));
+	model->SetPresorted(TableModel::CLUSTER_TABLE, Qt::AscendingOrder);
+	ui.resultTable->sortByColumn(TableModel::CLUSTER_TABLE, Qt::AscendingOrder);
+	UpdateFacets();
+
+	unsetCursor();
+}
+
+
+void ModLibrary::OnFindSimilar()
+{
+	auto &clusters = ModDatabase::Instance().GetClusters();
+	if(!clusters.IsBuilt())
+	{
+		// First use: Compute the clusters for the whole library. From then on they are maintained whenever files are added or removed.
+		QProgressDialog progress(tr("Finding similar files..."), tr("Cancel"), 0, 0, this);
+		progress.setWindowModality(Qt::WindowModal);
+		progress.setMinimumDuration(0);
+		progress.show();
+		const bool finished = clusters.Rebuild([&progress](const QString &status, int value, int maximum)
+		{
+			progress.setLabelText(status);
+			progress.setRange(0, maximum);
+			progress.setValue(value);
+			QCoreApplication::processEvents();
+			return !progress.wasCanceled();
+		});
+		if(!finished)
+		{
+			return;
+		}
+	}
+
+	setCursor(Qt::BusyCursor);
+
+	QSqlQuery query(ModDatabase::Instance().GetDB());
+	query.prepare(
+		"SELECT `m`.`rowid`, `c`.`cluster`, `c`.`similarity` "
+		"FROM `modlib_clusters` AS `c` JOIN `modlib_modules` AS `m` ON `m`.`filename` = `c`.`filename` "
+		"ORDER BY `c`.`cluster`, `c`.`similarity` DESC"
+		);
+
+	CancelSearch();
+	searchCondition.clear();
+	searchShowAll = false;
+	TableModel *model = new TableModel(ModDatabase::Instance().GetDB(), query);
+	SetResultModel(model);
+
 	const int numRows = model->rowCount();
 	ui.statusBar->showMessage(tr("%1 files found.").arg(numRows));
+	model->SetPresorted(TableModel::CLUSTER_TABLE, Qt::AscendingOrder);
+	ui.resultTable->sortByColumn(TableModel::CLUSTER_TABLE, Qt::AscendingOrder);
+	UpdateFacets();
 
 	unsetCursor();
 }
@@ -429,6 +1055,7 @@ void ModLibrary::OnExportPlaylist()
 	{
 		OnShowAll();
 	}
+	WaitForSearch();
 
 	const auto numRows = (ui.resultTable->model() == nullptr) ? 0 : ui.resultTable->model()->rowCount();
 	if(!numRows)
@@ -464,6 +1091,158 @@ void ModLibrary::OnExportPlaylist()
 }
 
 
+// Every core renders a module of its own, each writing its WAV file in large chunks.
+void ModLibrary::OnExportAudio()
+{
+	WaitForSearch();
+	const TableModel *model = static_cast<const TableModel *>(ui.resultTable->model());
+	if(model == nullptr || model->GetIds().empty())
+	{
+		QMessageBox(QMessageBox::Information, tr("Mod Library"), tr("There are no search results to export.")).exec();
+		return;
+	}
+
+	const QString targetDir = QFileDialog::getExistingDirectory(this, tr("Export Audio To..."), lastDir);
+	if(targetDir.isEmpty())
+	{
+		return;
+	}
+	bool ok = false;
+	const QStringList sampleRates = { "44100", "48000", "96000" };
+	const QString sampleRate = QInputDialog::getItem(this, tr("Export Audio"), tr("Sample rate (Hz):"), sampleRates, 1, false, &ok);
+	if(!ok)
+	{
+		return;
+	}
+	const QStringList formats = { tr("16-bit PCM"), tr("32-bit floating point") };
+	const QString formatName = QInputDialog::getItem(this, tr("Export Audio"), tr("Sample format:"), formats, 0, false, &ok);
+	if(!ok)
+	{
+		return;
+	}
+	const int32_t rate = sampleRate.toInt();
+	const WavWriter::Format format = (formats.indexOf(formatName) == 1) ? WavWriter::FLOAT_32 : WavWriter::PCM_16;
+
+	std::vector<QString> fileNames;
+	fileNames.reserve(model->GetIds().size());
+	for(const auto id : model->GetIds())
+	{
+		fileNames.push_back(ModDatabase::Instance().GetFileName(id));
+	}
+	std::vector<AudioExport::Job> jobs = AudioExport::CreateJobs(fileNames, targetDir);
+
+	QProgressDialog progress(tr("Exporting %1 files...").arg(jobs.size()), tr("Cancel"), 0, static_cast<int>(jobs.size()), this);
+	progress.setWindowModality(Qt::WindowModal);
+	progress.setValue(0);
+
+	std::atomic<int> failed{ 0 };
+	QFutureWatcher<void> watcher;
+	QEventLoop loop;
+	connect(&watcher, &QFutureWatcher<void>::progressValueChanged, &progress, &QProgressDialog::setValue);
+	connect(&watcher, &QFutureWatcher<void>::finished, &loop, &QEventLoop::quit);
+	connect(&progress, &QProgressDialog::canceled, &watcher, &QFutureWatcher<void>::cancel);
+	watcher.setFuture(QtConcurrent::map(jobs, [rate, format, &failed](const AudioExport::Job &job)
+	{
+		if(!AudioExport::ExportModule(job, rate, format))
+			failed++;
+	}));
+	loop.exec();
+	progress.close();
+
+	const int done = watcher.progressValue();
+	ui.statusBar->showMessage(tr("%1 of %2 files exported, %3 failed.").arg(done - failed).arg(jobs.size()).arg(failed.load()));
+}
+
+
+void ModLibrary::OnShowPlaylistMenu()
+{
+	playlistMenu->clear();
+	removePlaylistMenu->clear();
+	const auto &playlists = ModDatabase::Instance().GetPlaylists().GetPlaylists();
+	for(const auto &playlist : playlists)
+	{
+		const int id = playlist.id;
+		const QString name = playlist.name;
+		// Outdated playlists still show their last members, but these are no longer updated
+		QAction *action = playlistMenu->addAction(playlist.outdated ? tr("%1 (outdated)").arg(name) : name);
+		connect(action, &QAction::triggered, this, [this, id, name]() { OpenPlaylist(id, name); });
+		connect(removePlaylistMenu->addAction(name), &QAction::triggered, this, [this, id, name]() { RemovePlaylist(id, name); });
+	}
+	if(!playlists.empty())
+	{
+		playlistMenu->addSeparator();
+	}
+	ui.actionSavePlaylist->setEnabled(!searchCondition.isEmpty());
+	playlistMenu->addAction(ui.actionSavePlaylist);
+	if(!playlists.empty())
+	{
+		playlistMenu->addMenu(removePlaylistMenu);
+	}
+}
+
+
+void ModLibrary::OnSavePlaylist()
+{
+	if(searchCondition.isEmpty())
+	{
+		return;
+	}
+	bool ok = false;
+	const QString name = QInputDialog::getText(this, tr("Save Smart Playlist"), tr("Playlist name:"), QLineEdit::Normal, ui.findWhat->text(), &ok).trimmed();
+	if(!ok || name.isEmpty())
+	{
+		return;
+	}
+
+	// Finding the initial members is the only time the whole library has to be searched
+	setCursor(Qt::BusyCursor);
+	const bool created = ModDatabase::Instance().GetPlaylists().Create(name, searchCondition);
+	unsetCursor();
+	if(!created)
+	{
+		QMessageBox(QMessageBox::Critical, "Mod Library", tr("Cannot save the smart playlist.")).exec();
+	}
+}
+
+
+void ModLibrary::OpenPlaylist(int id, const QString &name)
+{
+	CancelSearch();
+	searchCondition.clear();
+	searchShowAll = false;
+
+	const auto ids = ModDatabase::Instance().GetPlaylists().GetMembers(id);
+	QVector<TableModel::Row> rows(static_cast<int>(ids.size()));
+	for(int i = 0; i < rows.size(); i++)
+	{
+		rows[i].id = ids[i];
+	}
+	TableModel *model = new TableModel(ModDatabase::Instance().GetDB());
+	SetResultModel(model);
+	model->AppendRows(rows);
+	ui.statusBar->showMessage(tr("%1 files in playlist \"%2\".").arg(rows.size()).arg(name));
+	UpdateFacets();
+
+	if(ui.resultTable->isSortingEnabled())
+	{
+		const QHeaderView *header = ui.resultTable->horizontalHeader();
+		model->sort(header->sortIndicatorSection(), header->sortIndicatorOrder());
+	}
+}
+
+
+void ModLibrary::RemovePlaylist(int id, const QString &name)
+{
+	if(QMessageBox::question(this, "Mod Library", tr("Delete the smart playlist \"%1\"?").arg(name)) == QMessageBox::Yes)
+	{
+		if(!ModDatabase::Instance().GetPlaylists().Remove(id))
+		{
+			QMessageBox(QMessageBox::Critical, "Mod Library", tr("Cannot delete the smart playlist.")).exec();
+		}
+	}
+}
+
+
 // Interpret pasted OpenMPT pattern format for melody search
 void ModLibrary::OnPasteMPT()
 {
@@ -546,7 +1325,12 @@ void ModLibrary::OnPasteMPT()
 void ModLibrary::OnSettings()
 {
 	SettingsDialog dlg(this);
-	dlg.exec();
+	if(dlg.exec() == QDialog::Accepted)
+	{
+		previewOnHover = SettingsDialog::GetPreviewOnHover();
+		ui.resultTable->setMouseTracking(previewOnHover);
+		ModuleCache::Instance().SetBudget(static_cast<size_t>(SettingsDialog::GetModuleCacheSize()) << 20);
+	}
 }
 
 
@@ -11,15 +11,63 @@
 
 #include <QtWidgets/QMainWindow>
 #include <QtWidgets/QWidget>
+#include <QtWidgets/QMenu>
+#include <QtWidgets/QTreeWidget>
+#include <QThread>
+#include <QTimer>
+#include <QPersistentModelIndex>
+#include <QStringList>
+#include <cstdint>
+#include <vector>
 #include "ui_modlibrary.h"
+#include "tablemodel.h"
+#include "resultcache.h"
+#include "facets.h"
+
+class SearchWorker;
+class QueuePlayer;
+class ThumbnailDelegate;
 
 class ModLibrary : public QMainWindow
 {
 	Q_OBJECT
 
 protected:
+	// The conditions of a text search, so that a later search can tell if it merely narrows it down
+	struct SearchPredicate
+	{
+		QString text;
+		QString columns;
+		QStringList filters;
+		uint64_t dbGeneration = 0;
+		std::vector<int64_t> ids;	// The results, once the search has finished
+		bool valid = false;
+
+		bool IsRefinedBy(const SearchPredicate &other) const;
+	};
+
 	QString lastDir;
 	std::vector<QCheckBoxEx *> checkBoxes;
+	QThread searchThread;
+	SearchWorker *searchWorker = nullptr;
+	int searchGeneration = 0;
+	bool searchRunning = false, searchShowAll = false, searchLive = false;
+	QTimer liveSearchTimer;
+	SearchPredicate pendingSearch, lastSearch;
+	ResultCache resultCache;
+	QByteArray searchKey;
+	uint64_t searchDBGeneration = 0;
+	QString searchCondition;	// The current search as it would be saved in a smart playlist, empty if it cannot be saved
+	QMenu *playlistMenu = nullptr, *removePlaylistMenu = nullptr;
+	int facetGeneration = 0;
+	std::vector<std::pair<FacetCounts::Facet, QString>> facetFilters;	// Facet values selected by the user
+	uint64_t previewId = 0;	// Preview that is currently playing, 0 if none
+	QString previewFile;
+	QTimer hoverPreviewTimer;
+	QPersistentModelIndex hoverIndex;
+	bool previewOnHover = false;
+	QueuePlayer *queuePlayer = nullptr;
+	ThumbnailDelegate *thumbnailDelegate = nullptr;
 
 public:
 	ModLibrary(QWidget *parent = nullptr);
@@ -31,18 +79,44 @@ protected slots:
 	void OnMaintain();
 	void OnSearch() { DoSearch(false); }
 	void OnShowAll() { DoSearch(true); }
+	void OnLiveSearch() { DoSearch(false, true); }
 	void OnSelectOne(QCheckBoxEx *sender);
 	void OnSelectAllButOne(QCheckBoxEx *sender);
 	void OnCellClicked(const QModelIndex &index);
 	void OnFindDupes();
+	void OnFindSimilar();
 	void OnExportPlaylist();
+	void OnExportAudio();
+	void OnShowPlaylistMenu();
+	void OnSavePlaylist();
 	void OnPasteMPT();
 	void OnSettings();
 	void OnAbout();
+	void OnSearchResults(int generation, const QVector<TableModel::Row> &rows);
+	void OnSearchFinished(int generation, int numResults, bool canceled);
+	void OnFacetsReady(int generation, const FacetCounts::Counts &counts);
+	void OnFacetClicked(QTreeWidgetItem *item);
+	void OnHoverPreview();
+	void OnPlaybackFinished(quint64 id);
+	void OnPlayResults();
+
+signals:
+	void SearchFinished();
 
 protected:
-	void DoSearch(bool showAll);
+	void DoSearch(bool showAll, bool live = false);
+	void ShowSearchResults(int numResults, bool cached);
+	void OpenPlaylist(int id, const QString &name);
+	void UpdateFacets();
+	void ShowFacets(const FacetCounts::Counts &counts);
+	void RemovePlaylist(int id, const QString &name);
+	void CancelSearch();
+	void WaitForSearch();
+	void SetResultModel(TableModel *model);
+	void PlayPreview(const QModelIndex &index);
+	void StopPreview();
 	void closeEvent(QCloseEvent *event);
+	bool eventFilter(QObject *watched, QEvent *event) override;
 
 private:
 	Ui_ModLibararyClass ui;
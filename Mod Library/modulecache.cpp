@@ -0,0 +1,136 @@
+/*
+ * modulecache.cpp
+ * ---------------
+ * Purpose: Memory-bounded cache of recently loaded module files.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "modulecache.h"
+#include "database.h"
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+
+ModuleCache ModuleCache::instance;
+
+
+bool ModuleCache::Load(const QString &path, QByteArray &content, QString *hash, Access access)
+{
+	const QFileInfo info(path);
+	const int64_t size = info.size(), modified = info.lastModified().toMSecsSinceEpoch();
+	bool cached = false;
+	{
+		QMutexLocker lock(&mutex);
+		auto entry = entries.find(path);
+		if(entry != entries.end())
+		{
+			if(entry->size == size && entry->modified == modified)
+			{
+				if(access == Interactive)
+					lru.splice(lru.begin(), lru, entry->lruPos);
+				content = entry->content;
+				cached = true;
+				if(hash == nullptr)
+				{
+					return true;
+				}
+				if(!entry->hash.isEmpty())
+				{
+					*hash = entry->hash;
+					return true;
+				}
+			} else
+			{
+				Erase(entry);
+			}
+		}
+	}
+
+	// Reading and hashing happens without holding the lock
+	if(!cached)
+	{
+		QFile file(path);
+		if(!file.open(QIODevice::ReadOnly))
+		{
+			return false;
+		}
+		content = file.readAll();
+		file.close();
+		// If the file was modified while reading it, the content may not belong to the size and date it would be cached with
+		const QFileInfo infoAfter(path);
+		if(content.size() != size || infoAfter.size() != size || infoAfter.lastModified().toMSecsSinceEpoch() != modified)
+		{
+			if(hash != nullptr)
+				*hash = ModDatabase::HashContent(content);
+			return true;
+		}
+	}
+	QString contentHash;
+	if(hash != nullptr)
+	{
+		contentHash = ModDatabase::HashContent(content);
+		*hash = contentHash;
+	}
+
+	QMutexLocker lock(&mutex);
+	auto entry = entries.find(path);
+	if(entry != entries.end())
+	{
+		// Somebody else loaded the same file in the meantime
+		if(entry->size == size && entry->modified == modified && entry->hash.isEmpty())
+			entry->hash = contentHash;
+		return true;
+	}
+	if(static_cast<size_t>(content.size()) > budget)
+	{
+		return true;
+	}
+	Evict(budget - content.size());
+	// Scanned files are inserted as the least recently used entry, so a library update only ever evicts other scanned files.
+	// They still serve the next load of the same file, e.g. when an insert turns into an update.
+	const auto lruPos = (access == Interactive) ? lru.insert(lru.begin(), path) : lru.insert(lru.end(), path);
+	Entry &newEntry = entries[path];
+	newEntry.content = content;
+	newEntry.hash = contentHash;
+	newEntry.size = size;
+	newEntry.modified = modified;
+	newEntry.lruPos = lruPos;
+	used += content.size();
+	return true;
+}
+
+
+void ModuleCache::SetBudget(size_t bytes)
+{
+	QMutexLocker lock(&mutex);
+	budget = bytes;
+	Evict(budget);
+}
+
+
+void ModuleCache::Clear()
+{
+	QMutexLocker lock(&mutex);
+	Evict(0);
+}
+
+
+// Drops the least recently used entries until at most the given number of bytes is used
+void ModuleCache::Evict(size_t limit)
+{
+	while(used > limit && !lru.empty())
+	{
+		Erase(entries.find(lru.back()));
+	}
+}
+
+
+void ModuleCache::Erase(QHash<QString, Entry>::iterator entry)
+{
+	used -= entry->content.size();
+	lru.erase(entry->lruPos);
+	entries.erase(entry);
+}
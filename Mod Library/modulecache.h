@@ -0,0 +1,60 @@
+/*
+ * modulecache.h
+ * -------------
+ * Purpose: Memory-bounded cache of recently loaded module files.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <cstdint>
+#include <list>
+
+// The same module is often loaded several times in a row: for its info window, when it is played, and when the library is updated.
+// libopenmpt modules cannot be copied, so the cache keeps the file contents along with their hash, from which every user
+// creates its own module with independent playback state. This skips reading and hashing the file, but not parsing it.
+// Entries are only used as long as the file's size and modification time are unchanged.
+class ModuleCache
+{
+public:
+	static constexpr int DEFAULT_BUDGET_MB = 128;
+
+	enum Access
+	{
+		Interactive,	// The file is likely to be loaded again soon
+		Scan,	// Part of a pass over many files, e.g. updating the library. Such files are not kept at the expense of interactively used ones.
+	};
+
+protected:
+	struct Entry
+	{
+		QByteArray content;
+		QString hash;	// Computed on first request
+		int64_t size = 0, modified = 0;
+		std::list<QString>::iterator lruPos;
+	};
+
+	static ModuleCache instance;
+	QMutex mutex;
+	QHash<QString, Entry> entries;
+	std::list<QString> lru;	// Most recently used file first
+	size_t used = 0, budget = size_t(DEFAULT_BUDGET_MB) << 20;
+
+public:
+	static ModuleCache &Instance() { return instance; }
+
+	// Thread-safe: Returns the contents of the file and optionally their hash, or false if the file cannot be read.
+	bool Load(const QString &path, QByteArray &content, QString *hash = nullptr, Access access = Interactive);
+	void SetBudget(size_t bytes);
+	void Clear();
+
+protected:
+	void Evict(size_t limit);
+	void Erase(QHash<QString, Entry>::iterator entry);
+};
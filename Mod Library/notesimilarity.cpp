@@ -0,0 +1,103 @@
+/*
+ * notesimilarity.cpp
+ * ------------------
+ * Purpose: Locality-sensitive hashing of pattern note data for finding edited or transposed copies of a module.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "notesimilarity.h"
+#include <algorithm>
+
+
+void NoteSimHash::AddInterval(uint8_t interval)
+{
+	shingle = (shingle << 8) | interval;
+	if(++numNotes < SHINGLE_LENGTH)
+	{
+		return;
+	}
+
+	// splitmix64 finalizer, spreads the shingle over all 64 bits
+	uint64_t h = shingle + 0x9E3779B97F4A7C15ull;
+	h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+	h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+	h ^= h >> 31;
+	for(int bit = 0; bit < 64; bit++)
+	{
+		weights[bit] += ((h >> bit) & 1) ? 1 : -1;
+	}
+}
+
+
+uint64_t NoteSimHash::GetHash() const
+{
+	uint64_t hash = 0;
+	for(int bit = 0; bit < 64; bit++)
+	{
+		if(weights[bit] > 0)
+			hash |= uint64_t(1) << bit;
+	}
+	return hash;
+}
+
+
+uint32_t NoteSimilarityIndex::Add(uint64_t hash)
+{
+	const uint32_t index = static_cast<uint32_t>(hashes.size());
+	hashes.push_back(hash);
+	for(int c = 0; c < NUM_CHUNKS; c++)
+	{
+		chunks[c][Chunk(hash, c)].push_back(index);
+	}
+	return index;
+}
+
+
+std::vector<uint32_t> NoteSimilarityIndex::Find(uint64_t hash, int maxDistance) const
+{
+	maxDistance = std::min(maxDistance, static_cast<int>(MAX_DISTANCE));
+	const int chunkRadius = maxDistance / NUM_CHUNKS;
+	std::vector<uint32_t> result;
+	const auto probe = [&](int c, uint16_t value)
+	{
+		const auto bucket = chunks[c].find(value);
+		if(bucket == chunks[c].end())
+		{
+			return;
+		}
+		for(const auto index : bucket->second)
+		{
+			if(Distance(hash, hashes[index]) <= maxDistance)
+				result.push_back(index);
+		}
+	};
+	for(int c = 0; c < NUM_CHUNKS; c++)
+	{
+		const uint16_t value = Chunk(hash, c);
+		probe(c, value);
+		for(int bit = 0; bit < 16 && chunkRadius > 0; bit++)
+		{
+			probe(c, value ^ static_cast<uint16_t>(1 << bit));
+		}
+	}
+	// Signatures that are close in several chunks are found more than once
+	std::sort(result.begin(), result.end());
+	result.erase(std::unique(result.begin(), result.end()), result.end());
+	return result;
+}
+
+
+int NoteSimilarityIndex::Distance(uint64_t a, uint64_t b)
+{
+#if defined(__GNUC__)
+	return __builtin_popcountll(a ^ b);
+#else
+	uint64_t x = a ^ b;
+	int count = 0;
+	for(; x; count++)
+		x &= x - 1;
+	return count;
+#endif
+}
@@ -0,0 +1,72 @@
+/*
+ * notesimilarity.h
+ * ----------------
+ * Purpose: Locality-sensitive hashing of pattern note data for finding edited or transposed copies of a module.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// 64-bit SimHash over shingles of consecutive note intervals.
+// Intervals make the hash invariant to transposition, and adding or dropping a single note
+// only affects a few shingles, so similar note sequences end up with a small Hamming distance.
+class NoteSimHash
+{
+public:
+	static constexpr int SHINGLE_LENGTH = 4;
+	// Fewer notes than this don't produce a meaningful signature
+	static constexpr int MIN_NOTES = 16;
+
+protected:
+	std::array<int32_t, 64> weights;
+	uint32_t shingle = 0;
+	int numNotes = 0;
+
+public:
+	NoteSimHash() { weights.fill(0); }
+
+	void AddInterval(uint8_t interval);
+	bool IsValid() const { return numNotes >= MIN_NOTES; }
+	uint64_t GetHash() const;
+};
+
+
+// Finds all signatures within a small Hamming distance of a query using multi-index hashing:
+// The signature is split into NUM_CHUNKS chunks, and if two signatures differ in at most
+// MAX_DISTANCE bits, at least one of their chunks differs in at most MAX_DISTANCE / NUM_CHUNKS bits.
+// Hence only the buckets of each query chunk and its neighbours within that radius have to be probed.
+class NoteSimilarityIndex
+{
+public:
+	static constexpr int NUM_CHUNKS = 4;
+	static constexpr int MAX_DISTANCE = 7;
+	static constexpr int CHUNK_RADIUS = MAX_DISTANCE / NUM_CHUNKS;
+	static_assert(CHUNK_RADIUS <= 1, "Find only probes chunk neighbours at distance 1");
+
+protected:
+	std::vector<uint64_t> hashes;
+	std::array<std::unordered_map<uint16_t, std::vector<uint32_t>>, NUM_CHUNKS> chunks;
+
+public:
+	// Returns the index of the added signature
+	uint32_t Add(uint64_t hash);
+	size_t Size() const { return hashes.size(); }
+
+	// Indices of all signatures within maxDistance of the query (including identical ones)
+	std::vector<uint32_t> Find(uint64_t hash, int maxDistance = MAX_DISTANCE) const;
+
+	static int Distance(uint64_t a, uint64_t b);
+	// Similarity in percent, based on the number of differing bits
+	static int Similarity(uint64_t a, uint64_t b) { return ((64 - Distance(a, b)) * 100) / 64; }
+
+protected:
+	static uint16_t Chunk(uint64_t hash, int chunk) { return static_cast<uint16_t>(hash >> (chunk * 16)); }
+};
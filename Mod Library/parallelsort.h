@@ -0,0 +1,66 @@
+/*
+ * parallelsort.h
+ * --------------
+ * Purpose: Multi-threaded sorting of large random-access ranges.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QThread>
+#include <QtConcurrent/QtConcurrent>
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <vector>
+
+// The range is split into one chunk per core, the chunks are sorted concurrently,
+// and then merged pairwise, with the merges of each round running concurrently as well.
+// Not a stable sort, just like std::sort.
+template<typename Iterator, typename Compare>
+void ParallelSort(Iterator first, Iterator last, Compare comp)
+{
+	// Below this size, the threading overhead outweighs any gains
+	static constexpr std::ptrdiff_t MIN_PARALLEL_SIZE = 16384;
+
+	const std::ptrdiff_t size = std::distance(first, last);
+	const int numThreads = QThread::idealThreadCount();
+	if(size < MIN_PARALLEL_SIZE || numThreads <= 1)
+	{
+		std::sort(first, last, comp);
+		return;
+	}
+
+	int numChunks = 1;
+	while(numChunks < numThreads)
+	{
+		numChunks *= 2;
+	}
+	std::vector<Iterator> bounds(numChunks + 1);
+	for(int i = 0; i <= numChunks; i++)
+	{
+		bounds[i] = first + (size * i) / numChunks;
+	}
+
+	std::vector<int> chunks(numChunks);
+	std::iota(chunks.begin(), chunks.end(), 0);
+	QtConcurrent::blockingMap(chunks, [&bounds, &comp](int chunk)
+	{
+		std::sort(bounds[chunk], bounds[chunk + 1], comp);
+	});
+
+	for(int width = 1; width < numChunks; width *= 2)
+	{
+		std::vector<int> merges;
+		for(int i = 0; i + width < numChunks; i += 2 * width)
+		{
+			merges.push_back(i);
+		}
+		QtConcurrent::blockingMap(merges, [&bounds, &comp, width, numChunks](int i)
+		{
+			std::inplace_merge(bounds[i], bounds[i + width], bounds[std::min(i + 2 * width, numChunks)], comp);
+		});
+	}
+}
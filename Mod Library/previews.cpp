@@ -0,0 +1,289 @@
+/*
+ * previews.cpp
+ * ------------
+ * Purpose: Short audio previews of modules, captured while analyzing them and stored next to the library.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "previews.h"
+#include "database.h"
+#include <QtSql/QSqlError>
+#include <algorithm>
+#include <cmath>
+
+static const QString CONNECTION_NAME = "previews";
+
+// Stored preview layout: 32-bit sample count, 16-bit sample rate, 16-bit initial predictor, 8-bit initial step index, 8-bit padding, followed by the 4-bit codes (low nibble first).
+static constexpr int HEADER_SIZE = 10;
+// Fade in and out over this many seconds, as the preview is cut out of the middle of a song
+static constexpr double FADE_SECONDS = 0.02;
+
+static constexpr int16_t ADPCM_STEPS[89] =
+{
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static constexpr int8_t ADPCM_INDEX_ADJUST[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+
+// IMA ADPCM state shared by the encoder and the decoder, so that the encoder always predicts from what the decoder will see
+struct AdpcmState
+{
+	int predictor = 0;
+	int index = 0;
+
+	int16_t Decode(uint8_t code)
+	{
+		const int step = ADPCM_STEPS[index];
+		int diff = step >> 3;
+		if(code & 4)
+			diff += step;
+		if(code & 2)
+			diff += step >> 1;
+		if(code & 1)
+			diff += step >> 2;
+		predictor = std::clamp((code & 8) ? predictor - diff : predictor + diff, -32768, 32767);
+		index = std::clamp(index + ADPCM_INDEX_ADJUST[code & 7], 0, 88);
+		return static_cast<int16_t>(predictor);
+	}
+
+	uint8_t Encode(int16_t sample)
+	{
+		const int step = ADPCM_STEPS[index];
+		int diff = sample - predictor;
+		uint8_t code = 0;
+		if(diff < 0)
+		{
+			code = 8;
+			diff = -diff;
+		}
+		if(diff >= step)
+		{
+			code |= 4;
+			diff -= step;
+		}
+		if(diff >= (step >> 1))
+		{
+			code |= 2;
+			diff -= step >> 1;
+		}
+		if(diff >= (step >> 2))
+		{
+			code |= 1;
+		}
+		Decode(code);
+		return code;
+	}
+};
+
+
+void PreviewCapture::Start(openmpt::module &mod, int32_t sampleRate)
+{
+	this->sampleRate = sampleRate;
+	const double durationSeconds = mod.get_duration_seconds();
+	// Skip the intro, but don't go too far into long songs
+	double startSeconds = std::min(durationSeconds * 0.25, 60.0);
+	if(startSeconds + PREVIEW_SECONDS > durationSeconds)
+	{
+		startSeconds = std::max(0.0, durationSeconds - PREVIEW_SECONDS);
+	}
+	start = static_cast<int64_t>(startSeconds * sampleRate);
+	end = start + static_cast<int64_t>(PREVIEW_SECONDS * sampleRate);
+	samples.reserve(static_cast<size_t>((end - start) / 2));
+}
+
+
+void PreviewCapture::Feed(openmpt::module &, const int16_t *data, size_t count)
+{
+	const int64_t first = std::max(start - position, int64_t(0)), last = std::min(end - position, static_cast<int64_t>(count));
+	for(int64_t i = first; i < last; i++)
+	{
+		// Average pairs of samples to halve the sample rate
+		if(hasPending)
+			samples.push_back(static_cast<int16_t>((pending + data[i]) / 2));
+		else
+			pending = data[i];
+		hasPending = !hasPending;
+	}
+	position += count;
+}
+
+
+QByteArray PreviewCapture::Encode()
+{
+	const size_t numSamples = samples.size();
+	const size_t fadeLength = std::min(static_cast<size_t>(FADE_SECONDS * sampleRate / 2), numSamples / 2);
+	for(size_t i = 0; i < fadeLength; i++)
+	{
+		const double gain = static_cast<double>(i) / fadeLength;
+		samples[i] = static_cast<int16_t>(samples[i] * gain);
+		samples[numSamples - 1 - i] = static_cast<int16_t>(samples[numSamples - 1 - i] * gain);
+	}
+
+	QByteArray preview(HEADER_SIZE + static_cast<int>((numSamples + 1) / 2), '\0');
+	uint8_t *out = reinterpret_cast<uint8_t *>(preview.data());
+	const uint32_t count = static_cast<uint32_t>(numSamples);
+	const uint16_t rate = static_cast<uint16_t>(sampleRate / 2);
+	const int16_t initial = numSamples ? samples[0] : 0;
+	out[0] = static_cast<uint8_t>(count);
+	out[1] = static_cast<uint8_t>(count >> 8);
+	out[2] = static_cast<uint8_t>(count >> 16);
+	out[3] = static_cast<uint8_t>(count >> 24);
+	out[4] = static_cast<uint8_t>(rate);
+	out[5] = static_cast<uint8_t>(rate >> 8);
+	out[6] = static_cast<uint8_t>(initial);
+	out[7] = static_cast<uint8_t>(static_cast<uint16_t>(initial) >> 8);
+	out[8] = 0;
+
+	AdpcmState state;
+	state.predictor = initial;
+	for(size_t i = 0; i < numSamples; i++)
+	{
+		const uint8_t code = state.Encode(samples[i]);
+		out[HEADER_SIZE + i / 2] |= (i & 1) ? (code << 4) : code;
+	}
+	return preview;
+}
+
+
+std::unique_ptr<PreviewSource> PreviewSource::Create(const QByteArray &preview)
+{
+	if(preview.size() < HEADER_SIZE)
+	{
+		return nullptr;
+	}
+	const uint8_t *in = reinterpret_cast<const uint8_t *>(preview.constData());
+	const uint32_t numSamples = in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<uint32_t>(in[3]) << 24);
+	const int32_t sampleRate = in[4] | (in[5] << 8);
+	if(numSamples == 0 || sampleRate == 0 || in[8] > 88 || (numSamples + 1) / 2 > static_cast<uint32_t>(preview.size() - HEADER_SIZE))
+	{
+		return nullptr;
+	}
+
+	std::unique_ptr<PreviewSource> source(new PreviewSource());
+	source->sampleRate = sampleRate;
+	source->samples.resize(numSamples);
+	AdpcmState state;
+	state.predictor = static_cast<int16_t>(in[6] | (in[7] << 8));
+	state.index = in[8];
+	for(uint32_t i = 0; i < numSamples; i++)
+	{
+		const uint8_t byte = in[HEADER_SIZE + i / 2];
+		source->samples[i] = state.Decode((i & 1) ? (byte >> 4) : (byte & 0x0F));
+	}
+	return source;
+}
+
+
+size_t PreviewSource::Render(float *interleaved, size_t frames, int32_t outputRate)
+{
+	// Linear interpolation is good enough for a preview
+	const double step = static_cast<double>(sampleRate) / outputRate;
+	const double last = static_cast<double>(samples.size() - 1);
+	size_t rendered = 0;
+	for(; rendered < frames && position < last; rendered++)
+	{
+		const size_t index = static_cast<size_t>(position);
+		const double frac = position - index;
+		const float sample = static_cast<float>((samples[index] + (samples[index + 1] - samples[index]) * frac) / 32768.0);
+		interleaved[rendered * 2] = sample;
+		interleaved[rendered * 2 + 1] = sample;
+		position += step;
+	}
+	return rendered;
+}
+
+
+PreviewStore::~PreviewStore()
+{
+	if(db.isValid())
+	{
+		storeQuery = loadQuery = containsQuery = removeQuery = QSqlQuery();
+		db.close();
+		db = QSqlDatabase();
+		QSqlDatabase::removeDatabase(CONNECTION_NAME);
+	}
+}
+
+
+void PreviewStore::Open(const QString &fileName)
+{
+	db = QSqlDatabase::addDatabase("QSQLITE", CONNECTION_NAME);
+	db.setDatabaseName(fileName);
+	if(!db.open())
+	{
+		throw ModDatabase::Exception("Cannot open preview database: ", db.lastError());
+	}
+
+	QSqlQuery query(db);
+	// Previews can always be recreated, so there is no need to wait for the disk after every module.
+	query.exec("PRAGMA synchronous = OFF");
+	if(!query.exec("CREATE TABLE IF NOT EXISTS `modlib_previews` (`filename` TEXT PRIMARY KEY, `preview` BLOB) WITHOUT ROWID"))
+	{
+		throw ModDatabase::Exception("Cannot create preview table: ", query.lastError());
+	}
+
+	storeQuery = QSqlQuery(db);
+	if(!storeQuery.prepare("INSERT OR REPLACE INTO `modlib_previews` (`filename`, `preview`) VALUES (:filename, :preview)"))
+	{
+		throw ModDatabase::Exception("Cannot prepare preview query: ", storeQuery.lastError());
+	}
+	loadQuery = QSqlQuery(db);
+	if(!loadQuery.prepare("SELECT `preview` FROM `modlib_previews` WHERE `filename` = :filename"))
+	{
+		throw ModDatabase::Exception("Cannot prepare preview query: ", loadQuery.lastError());
+	}
+	containsQuery = QSqlQuery(db);
+	if(!containsQuery.prepare("SELECT 1 FROM `modlib_previews` WHERE `filename` = :filename"))
+	{
+		throw ModDatabase::Exception("Cannot prepare preview query: ", containsQuery.lastError());
+	}
+	removeQuery = QSqlQuery(db);
+	if(!removeQuery.prepare("DELETE FROM `modlib_previews` WHERE `filename` = :filename"))
+	{
+		throw ModDatabase::Exception("Cannot prepare preview query: ", removeQuery.lastError());
+	}
+}
+
+
+void PreviewStore::Store(const QString &fileName, const QByteArray &preview)
+{
+	storeQuery.bindValue(":filename", fileName);
+	storeQuery.bindValue(":preview", preview);
+	storeQuery.exec();
+}
+
+
+QByteArray PreviewStore::Load(const QString &fileName)
+{
+	loadQuery.bindValue(":filename", fileName);
+	if(!loadQuery.exec() || !loadQuery.next())
+	{
+		return QByteArray();
+	}
+	const QByteArray preview = loadQuery.value(0).toByteArray();
+	loadQuery.finish();
+	return preview;
+}
+
+
+bool PreviewStore::Contains(const QString &fileName)
+{
+	containsQuery.bindValue(":filename", fileName);
+	const bool found = containsQuery.exec() && containsQuery.next();
+	containsQuery.finish();
+	return found;
+}
+
+
+void PreviewStore::Remove(const QString &fileName)
+{
+	removeQuery.bindValue(":filename", fileName);
+	removeQuery.exec();
+}
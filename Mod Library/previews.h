@@ -0,0 +1,77 @@
+/*
+ * previews.h
+ * ----------
+ * Purpose: Short audio previews of modules, captured while analyzing them and stored next to the library.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+#include <cstdint>
+#include <vector>
+#include "audioengine.h"
+#include "analyzers.h"
+
+// Collects a few seconds from the middle of the analysis render and compresses them with IMA ADPCM.
+// The analysis audio is mono at 22.05 kHz, previews are stored at half that rate, which is about 5.5 KB per second.
+class PreviewCapture : public AudioAnalyzer
+{
+public:
+	static constexpr double PREVIEW_SECONDS = 6.0;
+
+protected:
+	std::vector<int16_t> samples;
+	int64_t start = 0, end = 0, position = 0;
+	int32_t sampleRate = 0;
+	int32_t pending = 0;
+	bool hasPending = false;
+
+public:
+	void Start(openmpt::module &mod, int32_t sampleRate) override;
+	void Feed(openmpt::module &mod, const int16_t *data, size_t count) override;
+	// Compressed preview, possibly without any samples if the module is too short or broken
+	QByteArray Encode();
+};
+
+
+// Plays a decoded preview through the audio engine
+class PreviewSource : public AudioSource
+{
+protected:
+	std::vector<int16_t> samples;
+	double position = 0.0;
+	int32_t sampleRate = 0;
+
+public:
+	// Returns nullptr if the preview cannot be decoded or is empty
+	static std::unique_ptr<PreviewSource> Create(const QByteArray &preview);
+
+	size_t Render(float *interleaved, size_t frames, int32_t outputRate) override;
+};
+
+
+// Previews are kept in their own database file, so that the library itself stays small and fast to back up.
+// They can be recreated from the modules at any time.
+class PreviewStore
+{
+protected:
+	QSqlDatabase db;
+	QSqlQuery storeQuery, loadQuery, containsQuery, removeQuery;
+
+public:
+	~PreviewStore();
+
+	void Open(const QString &fileName);
+	bool IsOpen() const { return db.isOpen(); }
+
+	void Store(const QString &fileName, const QByteArray &preview);
+	QByteArray Load(const QString &fileName);
+	bool Contains(const QString &fileName);
+	void Remove(const QString &fileName);
+};
@@ -0,0 +1,193 @@
+/*
+ * queueplayer.cpp
+ * ---------------
+ * Purpose: Plays a list of modules one after another without gaps.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "queueplayer.h"
+#include "audioengine.h"
+#include "database.h"
+#include "modulecache.h"
+#include "settings.h"
+#include <QtConcurrent/QtConcurrent>
+
+
+QueuePlayer::QueuePlayer(QObject *parent) : QObject(parent)
+{
+	connect(&loader, &QFutureWatcher<ModuleSource *>::finished, this, &QueuePlayer::OnLoaded);
+	connect(&AudioEngine::Instance(), &AudioEngine::Started, this, &QueuePlayer::OnStarted);
+	connect(&AudioEngine::Instance(), &AudioEngine::Finished, this, &QueuePlayer::OnFinished);
+}
+
+
+QueuePlayer::~QueuePlayer()
+{
+	Stop();
+	if(loadPending)
+	{
+		loader.waitForFinished();
+		delete loader.result();
+	}
+}
+
+
+void QueuePlayer::Start(std::vector<int64_t> ids, size_t first)
+{
+	Stop();
+	this->ids = std::move(ids);
+	loadIndex = first;
+	listGeneration++;
+	playing = true;
+	if(!loadPending)
+	{
+		LoadNext();
+	}
+	// Otherwise the outdated load is discarded and replaced once it has finished
+}
+
+
+void QueuePlayer::Stop()
+{
+	const uint64_t id = currentId;
+	currentId = queuedId = 0;
+	if(id != 0)
+	{
+		AudioEngine::Instance().Stop(id);
+	}
+	if(playing)
+	{
+		playing = false;
+		emit Stopped();
+	}
+}
+
+
+// Reading the file can take a while on network storage, and parsing it is not free either, so both happen on a worker thread.
+ModuleSource *QueuePlayer::Load(const QString &fileName)
+{
+	QByteArray content;
+	if(!ModuleCache::Instance().Load(fileName, content))
+	{
+		return nullptr;
+	}
+	try
+	{
+		return new ModuleSource(content, false);
+	} catch(const openmpt::exception &)
+	{
+		return nullptr;
+	}
+}
+
+
+void QueuePlayer::LoadNext()
+{
+	if(loadIndex >= ids.size())
+	{
+		// Nothing left to load. Once the last module has finished playing, we are done.
+		if(currentId == 0 && queuedId == 0)
+		{
+			Stop();
+		}
+		return;
+	}
+	loadFileName = ModDatabase::Instance().GetFileName(ids[loadIndex]);
+	loadPending = true;
+	loadGeneration = listGeneration;
+	loader.setFuture(QtConcurrent::run(&QueuePlayer::Load, loadFileName));
+}
+
+
+void QueuePlayer::OnLoaded()
+{
+	if(!loadPending)
+	{
+		return;
+	}
+	loadPending = false;
+	std::unique_ptr<AudioSource> source(loader.result());
+	if(!playing)
+	{
+		return;
+	}
+	if(loadGeneration != listGeneration)
+	{
+		// Restarted with a new list while loading
+		LoadNext();
+		return;
+	}
+	if(source == nullptr)
+	{
+		loadIndex++;
+		LoadNext();
+		return;
+	}
+
+	AudioEngine &engine = AudioEngine::Instance();
+	if(currentId == 0)
+	{
+		// Nothing is playing yet (or the previous module ended before this one was ready)
+		currentId = engine.Play(std::move(source));
+		if(currentId == 0)
+		{
+			Stop();
+			return;
+		}
+		SetCurrent(loadIndex++, loadFileName);
+		LoadNext();
+	} else
+	{
+		// Only one module is kept ready ahead of the current one. The one after it is loaded once this one has started.
+		queuedId = engine.Queue(currentId, std::move(source), SettingsDialog::GetCrossfadeSeconds());
+		queuedIndex = loadIndex++;
+		queuedFileName = loadFileName;
+	}
+}
+
+
+void QueuePlayer::OnStarted(quint64 id)
+{
+	if(id != 0 && id == queuedId)
+	{
+		currentId = queuedId;
+		queuedId = 0;
+		SetCurrent(queuedIndex, queuedFileName);
+		if(!loadPending)
+		{
+			LoadNext();
+		}
+	}
+}
+
+
+void QueuePlayer::OnFinished(quint64 id, bool replaced)
+{
+	if(id == 0)
+	{
+		return;
+	}
+	if(id == queuedId)
+	{
+		// The queued module was dropped because something else has been played in the meantime
+		Stop();
+	} else if(id == currentId && queuedId == 0)
+	{
+		currentId = 0;
+		if(replaced || !loadPending)
+		{
+			// Either something else (e.g. a preview) has taken over, which the next module must not cut off, or there is nothing left to play
+			Stop();
+		}
+		// Otherwise the next module starts playing as soon as it has been loaded
+	}
+}
+
+
+void QueuePlayer::SetCurrent(size_t index, const QString &fileName)
+{
+	currentIndex = index;
+	emit TrackStarted(static_cast<int>(index), static_cast<int>(ids.size()), fileName);
+}
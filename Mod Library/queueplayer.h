@@ -0,0 +1,58 @@
+/*
+ * queueplayer.h
+ * -------------
+ * Purpose: Plays a list of modules one after another without gaps.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QFutureWatcher>
+#include <QString>
+#include <cstdint>
+#include <vector>
+
+class ModuleSource;
+
+// While one module is playing, the next one is read and parsed on a worker thread and handed to the
+// audio engine, which switches over (or crossfades) within the same stream once the current module ends.
+// Files that cannot be loaded are skipped.
+class QueuePlayer : public QObject
+{
+	Q_OBJECT
+
+protected:
+	std::vector<int64_t> ids;	// Library rowids in playing order
+	size_t currentIndex = 0, queuedIndex = 0, loadIndex = 0;
+	uint64_t currentId = 0, queuedId = 0;	// Playbacks in the audio engine
+	QString queuedFileName, loadFileName;
+	int listGeneration = 0, loadGeneration = 0;	// Tells if a finished load still belongs to the current list
+	bool playing = false, loadPending = false;
+	QFutureWatcher<ModuleSource *> loader;
+
+public:
+	QueuePlayer(QObject *parent = nullptr);
+	~QueuePlayer();
+
+	// Start playing the given modules, beginning with the one at index first
+	void Start(std::vector<int64_t> ids, size_t first);
+	void Stop();
+	bool IsPlaying() const { return playing; }
+
+signals:
+	void TrackStarted(int index, int count, const QString &fileName);
+	void Stopped();
+
+protected slots:
+	void OnLoaded();
+	void OnStarted(quint64 id);
+	void OnFinished(quint64 id, bool replaced);
+
+protected:
+	void LoadNext();
+	void SetCurrent(size_t index, const QString &fileName);
+	static ModuleSource *Load(const QString &fileName);
+};
@@ -0,0 +1,86 @@
+/*
+ * resultcache.cpp
+ * ---------------
+ * Purpose: Keeps the results of recent searches, so that repeating a search does not have to query the database again.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "resultcache.h"
+#include "searchworker.h"
+#include <QCryptographicHash>
+#include <QDataStream>
+
+
+// The rowids a search may be restricted to don't take part, as refining a search yields the same results as running it on the whole table.
+QByteArray ResultCache::Key(const SearchRequest &request)
+{
+	QByteArray data;
+	QDataStream stream(&data, QIODevice::WriteOnly);
+	stream << request.select << request.where << request.orderBy << request.maxMatches;
+	for(const auto &value : request.bindValues)
+	{
+		stream << value.first << value.second;
+	}
+	stream.writeRawData(reinterpret_cast<const char *>(request.fingerprint.data()), static_cast<int>(request.fingerprint.size() * sizeof(uint32_t)));
+	return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
+
+
+const QVector<TableModel::Row> *ResultCache::Find(const QByteArray &key, uint64_t dbGeneration)
+{
+	Validate(dbGeneration);
+	const auto it = lookup.find(key);
+	if(it == lookup.end())
+	{
+		return nullptr;
+	}
+	entries.splice(entries.begin(), entries, it.value());
+	return &it.value()->rows;
+}
+
+
+void ResultCache::Insert(const QByteArray &key, uint64_t dbGeneration, const QVector<TableModel::Row> &rows)
+{
+	Validate(dbGeneration);
+	const size_t size = static_cast<size_t>(rows.size());
+	if(size > MAX_ROWS)
+	{
+		return;
+	}
+	const auto existing = lookup.find(key);
+	if(existing != lookup.end())
+	{
+		numRows -= static_cast<size_t>(existing.value()->rows.size());
+		entries.erase(existing.value());
+		lookup.erase(existing);
+	}
+	while(!entries.empty() && (entries.size() >= MAX_ENTRIES || numRows + size > MAX_ROWS))
+	{
+		numRows -= static_cast<size_t>(entries.back().rows.size());
+		lookup.remove(entries.back().key);
+		entries.pop_back();
+	}
+	entries.push_front({ key, rows });
+	lookup.insert(key, entries.begin());
+	numRows += size;
+}
+
+
+void ResultCache::Clear()
+{
+	entries.clear();
+	lookup.clear();
+	numRows = 0;
+}
+
+
+void ResultCache::Validate(uint64_t dbGeneration)
+{
+	if(dbGeneration != generation)
+	{
+		Clear();
+		generation = dbGeneration;
+	}
+}
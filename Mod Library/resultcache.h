@@ -0,0 +1,52 @@
+/*
+ * resultcache.h
+ * -------------
+ * Purpose: Keeps the results of recent searches, so that repeating a search does not have to query the database again.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+#include <cstdint>
+#include <list>
+#include "tablemodel.h"
+
+struct SearchRequest;
+
+// Least recently used result sets, keyed by a digest of everything that determines a search's outcome.
+// All results are dropped as soon as the database has been modified.
+class ResultCache
+{
+public:
+	static constexpr size_t MAX_ENTRIES = 16;
+	// Total number of rows kept over all entries
+	static constexpr size_t MAX_ROWS = 2000000;
+
+protected:
+	struct Entry
+	{
+		QByteArray key;
+		QVector<TableModel::Row> rows;
+	};
+
+	std::list<Entry> entries;	// Most recently used first
+	QHash<QByteArray, std::list<Entry>::iterator> lookup;
+	size_t numRows = 0;
+	uint64_t generation = 0;
+
+public:
+	static QByteArray Key(const SearchRequest &request);
+
+	// Returns nullptr if the search is not cached or the database has changed since.
+	const QVector<TableModel::Row> *Find(const QByteArray &key, uint64_t dbGeneration);
+	void Insert(const QByteArray &key, uint64_t dbGeneration, const QVector<TableModel::Row> &rows);
+	void Clear();
+
+protected:
+	void Validate(uint64_t dbGeneration);
+};
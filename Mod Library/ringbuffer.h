@@ -0,0 +1,92 @@
+/*
+ * ringbuffer.h
+ * ------------
+ * Purpose: Lock-free single-producer, single-consumer ring buffer.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// Exactly one thread may write to the buffer and exactly one other thread may read from it.
+// Neither side ever blocks or allocates, so the reading side can be a real-time audio callback.
+// Positions keep counting up and are only wrapped when accessing the storage, so a full buffer
+// can be told apart from an empty one without wasting an element.
+template<typename T>
+class SpscRingBuffer
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Elements are copied around as plain memory");
+
+protected:
+	std::vector<T> buffer;
+	const size_t mask;
+	alignas(64) std::atomic<size_t> readPos{ 0 };
+	alignas(64) std::atomic<size_t> writePos{ 0 };
+
+public:
+	// The capacity is rounded up to a power of two
+	explicit SpscRingBuffer(size_t minCapacity) : buffer(RoundUp(minCapacity)), mask(buffer.size() - 1) { }
+
+	size_t Capacity() const { return buffer.size(); }
+
+	// Producer side
+	size_t WriteAvailable() const { return Capacity() - (writePos.load(std::memory_order_relaxed) - readPos.load(std::memory_order_acquire)); }
+	size_t WritePosition() const { return writePos.load(std::memory_order_relaxed); }
+
+	size_t Write(const T *data, size_t count)
+	{
+		const size_t pos = writePos.load(std::memory_order_relaxed);
+		count = std::min(count, WriteAvailable());
+		const size_t first = std::min(count, Capacity() - (pos & mask));
+		std::copy(data, data + first, buffer.data() + (pos & mask));
+		std::copy(data + first, data + count, buffer.data());
+		writePos.store(pos + count, std::memory_order_release);
+		return count;
+	}
+
+	bool Push(const T &value) { return Write(&value, 1) == 1; }
+
+	// Consumer side
+	size_t ReadAvailable() const { return writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_relaxed); }
+
+	size_t Read(T *data, size_t count)
+	{
+		const size_t pos = readPos.load(std::memory_order_relaxed);
+		count = std::min(count, ReadAvailable());
+		const size_t first = std::min(count, Capacity() - (pos & mask));
+		std::copy(buffer.data() + (pos & mask), buffer.data() + (pos & mask) + first, data);
+		std::copy(buffer.data(), buffer.data() + count - first, data + first);
+		readPos.store(pos + count, std::memory_order_release);
+		return count;
+	}
+
+	bool Pop(T &value) { return Read(&value, 1) == 1; }
+
+	// Drop everything written before the given write position (as returned by WritePosition) that has not been read yet
+	void DiscardUntil(size_t position)
+	{
+		const size_t pos = readPos.load(std::memory_order_relaxed);
+		if(position - pos <= Capacity())
+		{
+			readPos.store(position, std::memory_order_release);
+		}
+	}
+
+protected:
+	static size_t RoundUp(size_t size)
+	{
+		size_t capacity = 1;
+		while(capacity < size)
+		{
+			capacity *= 2;
+		}
+		return capacity;
+	}
+};
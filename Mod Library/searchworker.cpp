@@ -0,0 +1,248 @@
+/*
+ * searchworker.cpp
+ * ----------------
+ * Purpose: Runs library searches on a background thread with its own database connection.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "searchworker.h"
+#include "database.h"
+#include "fingerprint.h"
+#include "sqlregexp.h"
+#include <QDebug>
+#include <QtSql/QSqlQuery>
+#include <QStringList>
+#include <algorithm>
+#include <chromaprint.h>
+#include <sqlite3.h>
+
+
+// Fingerprint lookups only fully compare the best candidates found in the sub-fingerprint index
+static constexpr size_t MAX_FINGERPRINT_CANDIDATES = 1000;
+static constexpr int MIN_FINGERPRINT_HITS = 2;
+// Number of virtual machine instructions between cancellation checks inside of a running SQL statement
+static constexpr int PROGRESS_INSTRUCTIONS = 10000;
+
+static const QString CONNECTION_NAME = "search";
+
+enum SearchColumns { ID_COLUMN = 0, FINGERPRINT_COLUMN = 1, };
+
+
+template<typename Container, typename GetId>
+static QString RowidCondition(const Container &rows, GetId getId)
+{
+	QStringList ids;
+	ids.reserve(static_cast<int>(rows.size()));
+	for(const auto &row : rows)
+	{
+		ids.push_back(QString::number(getId(row)));
+	}
+	return "`rowid` IN (" + ids.join(',') + ") ";
+}
+
+
+SearchWorker::SearchWorker(const QString &databaseName) : databaseName(databaseName)
+{
+	qRegisterMetaType<QVector<TableModel::Row>>();
+	qRegisterMetaType<FacetCounts::Counts>();
+}
+
+
+SearchWorker::~SearchWorker()
+{
+	if(db.isValid())
+	{
+		db.close();
+		db = QSqlDatabase();
+		QSqlDatabase::removeDatabase(CONNECTION_NAME);
+	}
+}
+
+
+int SearchWorker::Start(const SearchRequest &request)
+{
+	const int generation = ++latestGeneration;
+	QMetaObject::invokeMethod(this, [this, generation, request]() { Run(generation, request); }, Qt::QueuedConnection);
+	return generation;
+}
+
+
+int SearchWorker::StartFacets(const std::vector<int64_t> &ids)
+{
+	const int generation = ++latestGeneration;
+	QMetaObject::invokeMethod(this, [this, generation, ids]() { RunFacets(generation, ids); }, Qt::QueuedConnection);
+	return generation;
+}
+
+
+bool SearchWorker::Open()
+{
+	// Database connections can only be used from the thread that created them, so this happens on the worker thread.
+	if(db.isOpen())
+	{
+		return true;
+	}
+	db = QSqlDatabase::addDatabase("QSQLITE", CONNECTION_NAME);
+	db.setDatabaseName(databaseName);
+	db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+	if(!db.open())
+	{
+		return false;
+	}
+
+	// Without the progress handler, a superseded search only stops once its statement returns the first row
+	if(sqlite3 *handle = ModDatabase::NativeHandle(db))
+	{
+		sqlite3_progress_handler(handle, PROGRESS_INSTRUCTIONS, ProgressHandler, this);
+	}
+	if(!SqlRegexp::Register(db))
+	{
+		qWarning() << "Regular expression search is not available on the search connection";
+	}
+	return true;
+}
+
+
+// Returning non-zero interrupts the current statement as soon as a newer search has been requested.
+int SearchWorker::ProgressHandler(void *worker)
+{
+	return static_cast<SearchWorker *>(worker)->IsCanceled() ? 1 : 0;
+}
+
+
+void SearchWorker::Run(int generation, const SearchRequest &request)
+{
+	runningGeneration = generation;
+	if(IsCanceled() || !Open())
+	{
+		// A newer search has been queued in the meantime
+		emit Finished(generation, 0, IsCanceled());
+		return;
+	}
+
+	const uint32_t *fingerprint = request.fingerprint.data();
+	const int fingerprintSize = static_cast<int>(request.fingerprint.size());
+	QString where = request.where;
+	if(fingerprintSize)
+	{
+		// Only modules sharing enough sub-fingerprints at a consistent offset are worth a full comparison.
+		auto &index = FingerprintIndex::Instance();
+		index.Build(db);
+		const auto candidates = index.Query(fingerprint, fingerprintSize, MAX_FINGERPRINT_CANDIDATES, MIN_FINGERPRINT_HITS);
+		if(!where.isEmpty())
+			where += "AND ";
+		where += RowidCondition(candidates, [](const auto &candidate) { return candidate.id; });
+	}
+	if(request.restrictToIds)
+	{
+		// SQLite looks up the listed rowids directly instead of scanning the table
+		if(!where.isEmpty())
+			where += "AND ";
+		where += RowidCondition(request.ids, [](int64_t id) { return id; });
+	}
+
+	QSqlQuery query(db);
+	query.setForwardOnly(true);
+	query.prepare(request.select + (where.isEmpty() ? QString() : "WHERE " + where) + request.orderBy);
+	for(const auto &value : request.bindValues)
+	{
+		query.bindValue(value.first, value.second);
+	}
+	if(!query.exec())
+	{
+		// Also happens if the statement was interrupted by the progress handler
+		emit Finished(generation, 0, IsCanceled());
+		return;
+	}
+
+	const FingerprintMatcher matcher(fingerprint, fingerprintSize);
+	const auto compare = [&query, &matcher](int minMatch)
+	{
+		const QByteArray modFingerprint = query.value(FINGERPRINT_COLUMN).toByteArray();
+		uint32_t *modRawFingerprint = nullptr;
+		int modRawFingerprintSize = 0;
+		chromaprint_decode_fingerprint(modFingerprint.constData(), modFingerprint.size(), &modRawFingerprint, &modRawFingerprintSize, nullptr, 0);
+		const int match = matcher.Compare(modRawFingerprint, modRawFingerprintSize, minMatch);
+		chromaprint_dealloc(modRawFingerprint);
+		return match;
+	};
+
+	int numResults = 0;
+	QVector<TableModel::Row> chunk;
+	if(fingerprintSize && request.maxMatches > 0)
+	{
+		// Top-K search: Keep a bounded min-heap of the best matches seen so far. Every further row only
+		// has to beat the worst of them, so most comparisons can be abandoned after a few blocks.
+		const size_t maxMatches = static_cast<size_t>(request.maxMatches);
+		const auto isBetter = [](const TableModel::Row &a, const TableModel::Row &b) { return a.match > b.match; };
+		std::vector<TableModel::Row> best;
+		best.reserve(std::min(maxMatches, MAX_FINGERPRINT_CANDIDATES));
+		while(!IsCanceled() && query.next())
+		{
+			const int minMatch = (best.size() < maxMatches) ? 0 : best.front().match + 1;
+			if(minMatch > 100)
+			{
+				break;
+			}
+			const int match = compare(minMatch);
+			if(match < minMatch)
+			{
+				continue;
+			}
+
+			if(best.size() == maxMatches)
+			{
+				std::pop_heap(best.begin(), best.end(), isBetter);
+				best.pop_back();
+			}
+			best.push_back({ query.value(ID_COLUMN).toLongLong(), match });
+			std::push_heap(best.begin(), best.end(), isBetter);
+		}
+		std::sort_heap(best.begin(), best.end(), isBetter);
+		chunk = QVector<TableModel::Row>(best.begin(), best.end());
+		numResults = chunk.size();
+	} else
+	{
+		// Only rowids are transferred, the model fetches everything else once it is displayed.
+		chunk.reserve(CHUNK_SIZE);
+		while(!IsCanceled() && query.next())
+		{
+			TableModel::Row row;
+			row.id = query.value(ID_COLUMN).toLongLong();
+			if(fingerprintSize)
+			{
+				row.match = compare(0);
+			}
+			chunk.push_back(row);
+			if(chunk.size() == CHUNK_SIZE)
+			{
+				numResults += chunk.size();
+				emit ResultsReady(generation, chunk);
+				chunk.clear();
+			}
+		}
+		numResults += chunk.size();
+	}
+	if(!chunk.isEmpty() && !IsCanceled())
+	{
+		emit ResultsReady(generation, chunk);
+	}
+	emit Finished(generation, numResults, IsCanceled());
+}
+
+
+void SearchWorker::RunFacets(int generation, const std::vector<int64_t> &ids)
+{
+	runningGeneration = generation;
+	if(IsCanceled() || !Open())
+	{
+		return;
+	}
+	const FacetCounts::Counts counts = FacetCounts::Compute(db, ids, [this]() { return IsCanceled(); });
+	if(!IsCanceled())
+	{
+		emit FacetsReady(generation, counts);
+	}
+}
@@ -0,0 +1,72 @@
+/*
+ * searchworker.h
+ * --------------
+ * Purpose: Runs library searches on a background thread with its own database connection.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QVariant>
+#include <QVector>
+#include <QtSql/QSqlDatabase>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "tablemodel.h"
+#include "facets.h"
+
+struct SearchRequest
+{
+	QString select;	// Column list and FROM clause. The rowid must be the first column, followed by the fingerprint for audio searches.
+	QString where;	// Filter conditions without the WHERE keyword, may be empty
+	QString orderBy;	// Complete ORDER BY clause, may be empty
+	std::vector<std::pair<QString, QVariant>> bindValues;
+	std::vector<uint32_t> fingerprint;	// Raw fingerprint for audio searches
+	int maxMatches = 0;	// Number of best fingerprint matches to keep
+	bool restrictToIds = false;	// Only consider the rows listed in ids, e.g. the results of a search that this one refines
+	std::vector<int64_t> ids;
+};
+
+
+class SearchWorker : public QObject
+{
+	Q_OBJECT
+
+public:
+	// Results are handed to the GUI in chunks of this many rows
+	static constexpr int CHUNK_SIZE = 10000;
+
+protected:
+	QString databaseName;
+	QSqlDatabase db;
+	std::atomic<int> latestGeneration{ 0 };
+	int runningGeneration = 0;
+
+public:
+	SearchWorker(const QString &databaseName);
+	~SearchWorker();
+
+	// Thread-safe: Queue a new search, superseding any search that is still running. Returns the search's generation.
+	int Start(const SearchRequest &request);
+	// Thread-safe: Count the facet values of a search result. Like a search, this is superseded by any later request.
+	int StartFacets(const std::vector<int64_t> &ids);
+	// Thread-safe: Abort the running search.
+	void Cancel() { latestGeneration++; }
+
+signals:
+	void ResultsReady(int generation, const QVector<TableModel::Row> &rows);
+	void Finished(int generation, int numResults, bool canceled);
+	void FacetsReady(int generation, const FacetCounts::Counts &counts);
+
+protected:
+	void Run(int generation, const SearchRequest &request);
+	void RunFacets(int generation, const std::vector<int64_t> &ids);
+	bool Open();
+	bool IsCanceled() const { return latestGeneration.load(std::memory_order_relaxed) != runningGeneration; }
+	static int ProgressHandler(void *worker);
+};
@@ -8,8 +8,55 @@
  */
 
 #include "settings.h"
+#include "modulecache.h"
+#include <QSettings>
 
 SettingsDialog::SettingsDialog(QWidget *parent) : QDialog(parent)
 {
 	ui.setupUi(this);
+	ui.fingerprintMatches->setValue(GetMaxFingerprintMatches());
+	ui.previewOnHover->setChecked(GetPreviewOnHover());
+	ui.crossfade->setValue(GetCrossfadeSeconds());
+	ui.moduleCacheSize->setValue(GetModuleCacheSize());
+}
+
+
+int SettingsDialog::GetMaxFingerprintMatches()
+{
+	return QSettings().value("Search/fingerprintmatches", DEFAULT_FINGERPRINT_MATCHES).toInt();
+}
+
+
+bool SettingsDialog::GetPreviewOnHover()
+{
+	return QSettings().value("Playback/previewonhover", false).toBool();
+}
+
+
+double SettingsDialog::GetCrossfadeSeconds()
+{
+	return QSettings().value("Playback/crossfade", 0.0).toDouble();
+}
+
+
+int SettingsDialog::GetModuleCacheSize()
+{
+	return QSettings().value("Library/modulecachesize", ModuleCache::DEFAULT_BUDGET_MB).toInt();
+}
+
+
+void SettingsDialog::accept()
+{
+	QSettings settings;
+	settings.beginGroup("Search");
+	settings.setValue("fingerprintmatches", ui.fingerprintMatches->value());
+	settings.endGroup();
+	settings.beginGroup("Playback");
+	settings.setValue("previewonhover", ui.previewOnHover->isChecked());
+	settings.setValue("crossfade", ui.crossfade->value());
+	settings.endGroup();
+	settings.beginGroup("Library");
+	settings.setValue("modulecachesize", ui.moduleCacheSize->value());
+	settings.endGroup();
+	QDialog::accept();
 }
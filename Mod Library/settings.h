@@ -17,8 +17,19 @@ class SettingsDialog : public QDialog
 	Q_OBJECT
 
 public:
+	static constexpr int DEFAULT_FINGERPRINT_MATCHES = 100;
+
 	SettingsDialog(QWidget *parent = nullptr);
 
+	static int GetMaxFingerprintMatches();
+	static bool GetPreviewOnHover();
+	static double GetCrossfadeSeconds();
+	// In MiB
+	static int GetModuleCacheSize();
+
+public slots:
+	void accept() override;
+
 private:
 	Ui_Settings ui;
 };
@@ -0,0 +1,179 @@
+/*
+ * smartplaylists.cpp
+ * ------------------
+ * Purpose: Saved searches whose members are stored in the database and kept up to date as the library changes.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "smartplaylists.h"
+#include "database.h"
+
+
+void SmartPlaylists::Open(QSqlDatabase &database)
+{
+	db = database;
+	QSqlQuery query(db);
+	if(!query.exec("CREATE TABLE IF NOT EXISTS `modlib_playlists` (`id` INTEGER PRIMARY KEY, `name` TEXT UNIQUE, `condition` TEXT, `condition_version` INT)"))
+	{
+		throw ModDatabase::Exception("Cannot create playlist table: ", query.lastError());
+	}
+	// Playlists saved before conditions were versioned have a NULL version and are considered outdated.
+	if(!query.exec("SELECT `condition_version` FROM `modlib_playlists` LIMIT 0")
+		&& !query.exec("ALTER TABLE `modlib_playlists` ADD COLUMN `condition_version` INT"))
+	{
+		throw ModDatabase::Exception("Cannot update playlist table: ", query.lastError());
+	}
+	// Members are identified by file name, as rowids of the module table change when the database is compacted.
+	if(!query.exec("CREATE TABLE IF NOT EXISTS `modlib_playlist_members` (`playlist` INT, `filename` TEXT, PRIMARY KEY (`playlist`, `filename`)) WITHOUT ROWID")
+		|| !query.exec("CREATE INDEX IF NOT EXISTS `modlib_playlist_members_filename` ON `modlib_playlist_members` (`filename`)"))
+	{
+		throw ModDatabase::Exception("Cannot create playlist member table: ", query.lastError());
+	}
+
+	insertMemberQuery = QSqlQuery(db);
+	removeMemberQuery = QSqlQuery(db);
+	removeModuleQuery = QSqlQuery(db);
+	if(!insertMemberQuery.prepare("INSERT OR IGNORE INTO `modlib_playlist_members` (`playlist`, `filename`) VALUES (:playlist, :filename)")
+		|| !removeMemberQuery.prepare("DELETE FROM `modlib_playlist_members` WHERE `playlist` = :playlist AND `filename` = :filename")
+		|| !removeModuleQuery.prepare("DELETE FROM `modlib_playlist_members` WHERE `filename` = :filename"))
+	{
+		throw ModDatabase::Exception("Cannot prepare playlist queries: ", insertMemberQuery.lastError());
+	}
+
+	Load();
+}
+
+
+void SmartPlaylists::Load()
+{
+	playlists.clear();
+	QSqlQuery query(db);
+	query.exec("SELECT `id`, `name`, `condition`, `condition_version` FROM `modlib_playlists` ORDER BY `name`");
+	while(query.next())
+	{
+		Playlist playlist{ query.value(0).toInt(), query.value(1).toString(), query.value(2).toString(), QSqlQuery(), true };
+		// Outdated playlists are still listed, so that their last members can be viewed and the playlist can be deleted.
+		if(query.value(3).toInt() == CONDITION_VERSION && PrepareMatchQuery(playlist))
+			playlist.outdated = false;
+		else
+			playlist.matchQuery = QSqlQuery();
+		playlists.push_back(std::move(playlist));
+	}
+}
+
+
+// Checks a single module against the playlist's condition, using the primary key on the file name.
+bool SmartPlaylists::PrepareMatchQuery(Playlist &playlist)
+{
+	playlist.matchQuery = QSqlQuery(db);
+	return playlist.matchQuery.prepare("SELECT 1 FROM `modlib_modules` WHERE `filename` = :filename AND (" + playlist.condition + ")");
+}
+
+
+bool SmartPlaylists::Create(const QString &name, const QString &condition)
+{
+	// Also validates the condition
+	Playlist playlist{ 0, name, condition, QSqlQuery(), false };
+	if(!PrepareMatchQuery(playlist))
+	{
+		return false;
+	}
+
+	db.transaction();
+	QSqlQuery query(db);
+	query.prepare("DELETE FROM `modlib_playlist_members` WHERE `playlist` IN (SELECT `id` FROM `modlib_playlists` WHERE `name` = :name)");
+	query.bindValue(":name", name);
+	bool ok = query.exec();
+	query.prepare("DELETE FROM `modlib_playlists` WHERE `name` = :name");
+	query.bindValue(":name", name);
+	ok = ok && query.exec();
+
+	query.prepare("INSERT INTO `modlib_playlists` (`name`, `condition`, `condition_version`) VALUES (:name, :condition, :condition_version)");
+	query.bindValue(":name", name);
+	query.bindValue(":condition", condition);
+	query.bindValue(":condition_version", CONDITION_VERSION);
+	if(!ok || !query.exec())
+	{
+		db.rollback();
+		return false;
+	}
+	playlist.id = query.lastInsertId().toInt();
+
+	// The initial members are the only thing that requires a search through the whole library.
+	query.prepare("INSERT INTO `modlib_playlist_members` (`playlist`, `filename`) SELECT :playlist, `filename` FROM `modlib_modules` WHERE " + condition);
+	query.bindValue(":playlist", playlist.id);
+	if(!query.exec())
+	{
+		db.rollback();
+		return false;
+	}
+	db.commit();
+	Load();
+	return true;
+}
+
+
+bool SmartPlaylists::Remove(int id)
+{
+	db.transaction();
+	QSqlQuery query(db);
+	query.prepare("DELETE FROM `modlib_playlist_members` WHERE `playlist` = :playlist");
+	query.bindValue(":playlist", id);
+	bool ok = query.exec();
+	query.prepare("DELETE FROM `modlib_playlists` WHERE `id` = :playlist");
+	query.bindValue(":playlist", id);
+	ok = ok && query.exec();
+	if(!ok || !db.commit())
+	{
+		db.rollback();
+		return false;
+	}
+	Load();
+	return true;
+}
+
+
+std::vector<int64_t> SmartPlaylists::GetMembers(int id)
+{
+	std::vector<int64_t> ids;
+	QSqlQuery query(db);
+	query.setForwardOnly(true);
+	query.prepare("SELECT m.`rowid` FROM `modlib_playlist_members` p JOIN `modlib_modules` m ON m.`filename` = p.`filename` WHERE p.`playlist` = :playlist");
+	query.bindValue(":playlist", id);
+	query.exec();
+	while(query.next())
+	{
+		ids.push_back(query.value(0).toLongLong());
+	}
+	return ids;
+}
+
+
+void SmartPlaylists::UpdateModule(const QString &fileName)
+{
+	for(auto &playlist : playlists)
+	{
+		if(playlist.outdated)
+		{
+			continue;
+		}
+		QSqlQuery &matchQuery = playlist.matchQuery;
+		matchQuery.bindValue(":filename", fileName);
+		const bool matches = matchQuery.exec() && matchQuery.next();
+		matchQuery.finish();
+
+		QSqlQuery &memberQuery = matches ? insertMemberQuery : removeMemberQuery;
+		memberQuery.bindValue(":playlist", playlist.id);
+		memberQuery.bindValue(":filename", fileName);
+		memberQuery.exec();
+	}
+}
+
+
+void SmartPlaylists::RemoveModule(const QString &fileName)
+{
+	removeModuleQuery.bindValue(":filename", fileName);
+	removeModuleQuery.exec();
+}
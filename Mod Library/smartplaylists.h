@@ -0,0 +1,57 @@
+/*
+ * smartplaylists.h
+ * ----------------
+ * Purpose: Saved searches whose members are stored in the database and kept up to date as the library changes.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QtSql/QtSql>
+#include <cstdint>
+#include <vector>
+
+// Every smart playlist consists of a search condition and the list of modules currently matching it.
+// Whenever a module is added, updated or removed, only that module is checked against each condition,
+// so listing the members of a playlist never requires searching the whole library.
+class SmartPlaylists
+{
+public:
+	// The stored conditions are SQL as built by ModLibrary::DoSearch. Increase this whenever the columns or functions
+	// used by search conditions change in a way that makes older conditions invalid or give different results.
+	static constexpr int CONDITION_VERSION = 1;
+
+	struct Playlist
+	{
+		int id;
+		QString name;
+		QString condition;	// SQL expression on modlib_modules, without any bound parameters
+		QSqlQuery matchQuery;
+		bool outdated;	// The condition was saved by a different version or cannot be evaluated anymore. The members are no longer updated.
+	};
+
+protected:
+	QSqlDatabase db;
+	std::vector<Playlist> playlists;
+	QSqlQuery insertMemberQuery, removeMemberQuery, removeModuleQuery;
+
+public:
+	void Open(QSqlDatabase &database);
+
+	const std::vector<Playlist> &GetPlaylists() const { return playlists; }
+	// Save a search condition under the given name, replacing any existing playlist of the same name. Returns false if the condition is invalid.
+	bool Create(const QString &name, const QString &condition);
+	bool Remove(int id);
+	// rowids of all current members
+	std::vector<int64_t> GetMembers(int id);
+
+	// Incremental maintenance, called whenever a module is added, updated or removed.
+	void UpdateModule(const QString &fileName);
+	void RemoveModule(const QString &fileName);
+
+protected:
+	void Load();
+	bool PrepareMatchQuery(Playlist &playlist);
+};
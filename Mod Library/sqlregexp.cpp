@@ -0,0 +1,192 @@
+/*
+ * sqlregexp.cpp
+ * -------------
+ * Purpose: REGEXP operator for SQLite connections, based on QRegularExpression.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "sqlregexp.h"
+#include "database.h"
+#include <QRegularExpression>
+#include <memory>
+#include <sqlite3.h>
+
+
+static void DeleteRegex(void *regex)
+{
+	delete static_cast<QRegularExpression *>(regex);
+}
+
+
+// "X REGEXP Y" is evaluated as regexp(Y, X), so the pattern is the first argument.
+static void RegexpFunction(sqlite3_context *context, int, sqlite3_value **argv)
+{
+	if(sqlite3_value_type(argv[0]) == SQLITE_NULL || sqlite3_value_type(argv[1]) == SQLITE_NULL)
+	{
+		sqlite3_result_null(context);
+		return;
+	}
+
+	// The compiled pattern is attached to the statement and reused for all further rows
+	auto *regex = static_cast<QRegularExpression *>(sqlite3_get_auxdata(context, 0));
+	std::unique_ptr<QRegularExpression> newRegex;
+	if(regex == nullptr)
+	{
+		const auto *pattern = static_cast<const QChar *>(sqlite3_value_text16(argv[0]));
+		newRegex = std::make_unique<QRegularExpression>(QString(pattern, sqlite3_value_bytes16(argv[0]) / 2),
+			QRegularExpression::CaseInsensitiveOption | QRegularExpression::UseUnicodePropertiesOption);
+		if(!newRegex->isValid())
+		{
+			sqlite3_result_error(context, "Invalid regular expression", -1);
+			return;
+		}
+		newRegex->optimize();
+		regex = newRegex.get();
+	}
+
+	const auto *text = static_cast<const QChar *>(sqlite3_value_text16(argv[1]));
+	const QString subject = QString::fromRawData(text, sqlite3_value_bytes16(argv[1]) / 2);
+	sqlite3_result_int(context, regex->match(subject).hasMatch() ? 1 : 0);
+
+	if(newRegex)
+	{
+		// SQLite may delete the object right away, so this must happen last
+		sqlite3_set_auxdata(context, 0, newRegex.release(), DeleteRegex);
+	}
+}
+
+
+bool SqlRegexp::Register(QSqlDatabase &db)
+{
+	sqlite3 *handle = ModDatabase::NativeHandle(db);
+	return handle != nullptr
+		&& sqlite3_create_function_v2(handle, "regexp", 2, SQLITE_UTF16 | SQLITE_DETERMINISTIC, nullptr, RegexpFunction, nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+
+// Only plain runs of characters outside of groups and character classes are considered.
+// A quantifier that allows zero repetitions removes the preceding character from the run.
+// Anything that is not fully understood gives up, as a wrong literal would hide actual matches.
+QString SqlRegexp::RequiredLiteral(const QString &pattern)
+{
+	if(pattern.contains('|') || pattern.contains("\\Q"))
+	{
+		// Alternatives don't have any common required text in general, and quoted sequences may hide group and class delimiters
+		return QString();
+	}
+	// Escapes that stand for a character class or assertion and are not followed by any arguments
+	static const QString SIMPLE_ESCAPES = "dDwWsSbBAzZGhHvVRX";
+
+	QString best, current;
+	const auto endRun = [&best, &current]()
+	{
+		if(current.size() > best.size())
+			best = current;
+		current.clear();
+	};
+
+	for(int i = 0; i < pattern.size(); i++)
+	{
+		const QChar c = pattern[i];
+		switch(c.unicode())
+		{
+		case '\\':
+			if(i + 1 >= pattern.size())
+			{
+				return QString();
+			} else if(!pattern[i + 1].isLetterOrNumber())
+			{
+				// Escaped punctuation is literal
+				if(pattern[i + 1].unicode() >= 0x80)
+					endRun();
+				else
+					current += pattern[i + 1];
+				i++;
+			} else if(SIMPLE_ESCAPES.contains(pattern[i + 1]))
+			{
+				endRun();
+				i++;
+			} else
+			{
+				// Hex, octal and control characters, back-references, named references, Unicode properties, ...
+				return QString();
+			}
+			break;
+		case '?':
+		case '*':
+		case '{':
+			// The previous character is optional
+			if(!current.isEmpty())
+				current.chop(1);
+			endRun();
+			if(c == '{')
+			{
+				while(i < pattern.size() && pattern[i] != '}')
+					i++;
+			}
+			break;
+		case '+':
+			// The previous character is required at least once, but what follows it isn't adjacent anymore
+			endRun();
+			break;
+		case '[':
+			endRun();
+			for(i++; i < pattern.size() && pattern[i] != ']'; i++)
+			{
+				if(pattern[i] == '\\')
+					i++;
+			}
+			break;
+		case '(':
+		{
+			// Inline options such as (?x) or (?i) change the meaning of the rest of the pattern
+			if(i + 2 < pattern.size() && pattern[i + 1] == '?' && (pattern[i + 2].isLetter() || pattern[i + 2] == '-' || pattern[i + 2] == '^'))
+			{
+				return QString();
+			}
+			// Skip the whole group, it may be optional or repeated
+			endRun();
+			int depth = 1;
+			for(i++; i < pattern.size() && depth > 0; i++)
+			{
+				if(pattern[i] == '\\')
+					i++;
+				else if(pattern[i] == '(')
+					depth++;
+				else if(pattern[i] == ')')
+					depth--;
+			}
+			// Quantifiers following the group
+			if(i < pattern.size() && (pattern[i] == '?' || pattern[i] == '*' || pattern[i] == '+' || pattern[i] == '{'))
+			{
+				if(pattern[i] == '{')
+				{
+					while(i < pattern.size() && pattern[i] != '}')
+						i++;
+				}
+			} else
+			{
+				i--;
+			}
+			break;
+		}
+		case '.':
+		case '^':
+		case '$':
+		case ')':
+			endRun();
+			break;
+		default:
+			// LIKE only ignores the case of ASCII characters, but the regular expression ignores it for all of them
+			if(c.unicode() >= 0x80)
+				endRun();
+			else
+				current += c;
+			break;
+		}
+	}
+	endRun();
+	return best;
+}
@@ -0,0 +1,25 @@
+/*
+ * sqlregexp.h
+ * -----------
+ * Purpose: REGEXP operator for SQLite connections, based on QRegularExpression.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QString>
+#include <QtSql/QSqlDatabase>
+
+class SqlRegexp
+{
+public:
+	// Makes "X REGEXP pattern" available on the connection. Matching is case-insensitive, just like LIKE.
+	// Each statement compiles its pattern only once.
+	static bool Register(QSqlDatabase &db);
+
+	// Returns the longest piece of text that every match of the pattern has to contain, or an empty string if there is none.
+	// Searching for it with LIKE first means that most rows never have to be run through the regular expression.
+	static QString RequiredLiteral(const QString &pattern);
+};
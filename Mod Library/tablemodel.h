@@ -9,170 +9,277 @@
 
 #pragma once
 #include <QAbstractTableModel>
+#include <QtSql/QSqlDatabase>
 #include <QtSql/QSqlQuery>
+#include <QTimer>
+#include <array>
 #include <cstdint>
 #include <algorithm>
-#include <chromaprint.h>
+#include <list>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
 #include <QCollator>
+#include <QStringList>
 #include <QDateTime>
 #include <QFileInfo>
 #include <QSize>
+#include <QByteArray>
+#include <QVector>
+#include "parallelsort.h"
 
 
-static const uint8_t BitsSetTable256[256] =
-{
-#	define B2(n) n,     n+1,     n+1,     n+2
-#	define B4(n) B2(n), B2(n+1), B2(n+1), B2(n+2)
-#	define B6(n) B4(n), B4(n+1), B4(n+1), B4(n+2)
-	B6(0), B6(1), B6(1), B6(2)
-};
-
+// Only the rowids of the results are kept in memory. The displayed information is fetched
+// from the database in fixed-size windows of consecutive rows, of which only the most recently
+// used ones are kept, so that memory use stays flat no matter how large the result is.
+// All per-row data is stored column by column in flat arrays, so that sorting only touches the column it needs.
 class TableModel : public QAbstractTableModel
 {
 	Q_OBJECT
 
 public:
-	struct Entry
+	struct Row
 	{
-		QString fileName, title, dateStr, sizeStr;
-		uint fileDate;
-		int fileSize;
-		int match;	// Fingerprint match quality and cache flag at the same time (-1 = not cached yet)
+		int64_t id;	// rowid in modlib_modules
+		int match = 0;	// Fingerprint match quality or cluster similarity
+		int cluster = 0;
+	};
+
+	// Database columns of a window query
+	enum DBColumns { ID_COLUMN = 0, FILENAME_COLUMN = 1, TITLE_COLUMN = 2, FILESIZE_COLUMN = 3, FILEDATE_COLUMN = 4, THUMBNAIL_COLUMN = 5, };
+	// Database columns of a cluster listing
+	enum ClusterColumns { CLUSTER_ID_COLUMN = 0, CLUSTER_COLUMN = 1, SIMILARITY_COLUMN = 2, };
+	enum TableColumns { TITLE_TABLE = 0, FILESIZE_TABLE = 1, FILEDATE_TABLE = 2, FINGERPRINT_TABLE = 3, CLUSTER_TABLE = 4, };
+	// The encoded waveform thumbnail of a row, drawn by ThumbnailDelegate in the last column
+	static constexpr int THUMBNAIL_ROLE = Qt::UserRole + 1;
 
-		Entry() : match(-1) { }
+	static constexpr int WINDOW_SIZE = 256;
+	static constexpr size_t MAX_WINDOWS = 64;
+	// Results up to this size read their sort columns by rowid; larger results scan the whole table or index instead.
+	static constexpr size_t MAX_ID_LIST = 10000;
+
+	bool hasFingerprint;
+	bool grouped;
+
+protected:
+	struct StringRef
+	{
+		uint32_t offset = 0, length = 0;
 	};
 
-	// Database columns
-	enum DBColumns { FILENAME_COLUMN = 0, TITLE_COLUMN = 1, FILESIZE_COLUMN = 2, FILEDATE_COLUMN = 3, FINGERPRINT_COLUMN = 4, };
-	enum TableColumns { TITLE_TABLE = 0, FILESIZE_TABLE = 1, FILEDATE_TABLE = 2, FINGERPRINT_TABLE = 3, };
+	// The strings of all rows are stored back to back in a single buffer
+	struct Window
+	{
+		QString strings;
+		std::vector<StringRef> fileNames, titles;	// An empty file name means that the module has vanished from the database
+		std::vector<uint32_t> fileDates;
+		std::vector<int32_t> fileSizes;
+		std::vector<QByteArray> thumbnails;
+		std::list<int>::iterator lruPos;
 
-	mutable QSqlQuery query;
-	std::vector<Entry> modules;
-	std::vector<Entry *> modulesSorted;	// Module order according to current sorting scheme
+		QString GetString(StringRef ref) const { return QString(strings.constData() + ref.offset, ref.length); }
+		StringRef AddString(const QString &str)
+		{
+			const StringRef ref{ static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(str.size()) };
+			strings += str;
+			return ref;
+		}
+	};
+
+	// Direct-mapped cache of formatted cell values. The view requests every visible cell many times
+	// while scrolling, and neighbouring rows often share the same value anyway.
+	class StringCache
+	{
+		static constexpr int CACHE_BITS = 8;
+		std::array<std::pair<int64_t, QString>, size_t(1) << CACHE_BITS> entries;
+
+	public:
+		StringCache() { for(auto &slot : entries) slot.first = -1; }
+
+		template<typename Func>
+		const QString &Get(int64_t key, Func format)
+		{
+			auto &slot = entries[(static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull) >> (64 - CACHE_BITS)];
+			if(slot.first != key)
+			{
+				slot.first = key;
+				slot.second = format(key);
+			}
+			return slot.second;
+		}
+	};
 
-	uint32_t *rawFingerprint;
-	int rawFingerprintSize;
-	int numRows;
-#ifdef _MSC_VER
-	bool hasPopCnt;
-#endif
+	QSqlDatabase db;
+	mutable QSqlQuery windowQuery;
+	// In display order. The match quality is only stored for fingerprint searches and cluster listings, the cluster only for the latter.
+	std::vector<int64_t> ids;
+	std::vector<int32_t> matches, clusters;
+	std::vector<QCollatorSortKey> titleKeys;	// Computed on first sort by title, in the same order as ids
+	int sortColumn = -1;
+	Qt::SortOrder sortOrder = Qt::AscendingOrder;
+	bool presorted = false;
+	mutable std::unordered_map<int, Window> windows;
+	mutable std::list<int> lru;	// Most recently used window first
+	mutable StringCache dateStrings, sizeStrings;
 
-	TableModel(QSqlQuery &query, uint32_t *fp, int fpsize) : query(query), numRows(0), rawFingerprint(fp), rawFingerprintSize(fpsize)
+public:
+	// An empty model that is filled with search results as they arrive.
+	// A grouped model lists similarity clusters, with the similarity taking the place of the match quality.
+	TableModel(QSqlDatabase &db, bool hasFingerprint = false, bool grouped = false) : hasFingerprint(hasFingerprint), grouped(grouped), db(db), windowQuery(db)
 	{
-#ifdef _MSC_VER
-		int CPUInfo[4];
-		__cpuid(CPUInfo, 1);
-		hasPopCnt = (CPUInfo[2] & (1 << 23)) != 0;
-#endif
+		// Thumbnails are fetched along with the rest of the window, so that drawing them never requires another query
+		QString queryStr = "SELECT m.`rowid`, m.`filename`, m.`title`, m.`filesize`, m.`filedate`, t.`thumbnail` FROM `modlib_modules` m"
+			" LEFT JOIN `modlib_thumbnails` t ON t.`filename` = m.`filename` WHERE m.`rowid` IN (?";
+		for(int i = 1; i < WINDOW_SIZE; i++)
+		{
+			queryStr += ",?";
+		}
+		windowQuery.setForwardOnly(true);
+		windowQuery.prepare(queryStr + ")");
+	}
 
+	// Load all results of a cluster listing at once
+	TableModel(QSqlDatabase &db, QSqlQuery &query) : TableModel(db, false, true)
+	{
+		query.setForwardOnly(true);
 		query.exec();
-		// SQLite doesn't have query.size()...
 		while(query.next())
 		{
-			numRows++;
+			ids.push_back(query.value(CLUSTER_ID_COLUMN).toLongLong());
+			clusters.push_back(query.value(CLUSTER_COLUMN).toInt());
+			matches.push_back(query.value(SIMILARITY_COLUMN).toInt());
 		}
-		modules.resize(numRows);
-		modulesSorted.resize(numRows);
-		for(int i = 0; i < numRows; i++)
+	}
+
+	int rowCount(const QModelIndex & = QModelIndex()) const { return static_cast<int>(ids.size()); }
+	const std::vector<int64_t> &GetIds() const { return ids; }
+
+	// All rows in display order, in the form delivered by a search
+	QVector<Row> GetRows() const
+	{
+		QVector<Row> result(static_cast<int>(ids.size()));
+		for(size_t i = 0; i < ids.size(); i++)
 		{
-			modulesSorted[i] = &modules[i];
+			Row &row = result[static_cast<int>(i)];
+			row.id = ids[i];
+			if(!matches.empty())
+				row.match = matches[i];
+			if(!clusters.empty())
+				row.cluster = clusters[i];
 		}
+		return result;
 	}
+	int columnCount(const QModelIndex & = QModelIndex()) const { return grouped ? 6 : (hasFingerprint ? 5 : 4); }
+	// The thumbnail always comes last, so that the other columns keep their positions
+	int ThumbnailColumn() const { return columnCount() - 1; }
 
-	~TableModel()
+	// Results that arrive while the search is still running are appended at the end, regardless of the sort order.
+	void AppendRows(const QVector<Row> &newRows)
 	{
-		chromaprint_dealloc(rawFingerprint);
+		if(newRows.isEmpty())
+		{
+			return;
+		}
+		const int first = rowCount();
+		beginInsertRows(QModelIndex(), first, first + newRows.size() - 1);
+		ids.reserve(ids.size() + newRows.size());
+		for(const auto &row : newRows)
+		{
+			ids.push_back(row.id);
+			if(hasFingerprint || grouped)
+				matches.push_back(row.match);
+			if(grouped)
+				clusters.push_back(row.cluster);
+		}
+		titleKeys.clear();
+		if(!presorted)
+			sortColumn = -1;
+		// The last window may have been incomplete
+		DropWindow(first / WINDOW_SIZE);
+		endInsertRows();
 	}
 
-	int rowCount(const QModelIndex & = QModelIndex()) const { return numRows; }
-	int columnCount(const QModelIndex & = QModelIndex()) const { return rawFingerprintSize ? 4 : 3; }
+	// Results are delivered in this order already, e.g. because the sorting happened in the database.
+	void SetPresorted(int column, Qt::SortOrder order)
+	{
+		sortColumn = column;
+		sortOrder = order;
+		presorted = true;
+	}
 
-	bool CacheEntry(Entry &entry) const
+	// Sorting on these columns can be done through an index in the database
+	static const char *IndexedSortColumn(int column)
 	{
-		entry.match = 0;
-		if(!query.seek(&entry - modules.data()))
+		switch(column)
 		{
-			return false;
+		case FILESIZE_TABLE:
+			return "filesize";
+		case FILEDATE_TABLE:
+			return "filedate";
 		}
+		return nullptr;
+	}
 
-		entry.fileName = query.value(FILENAME_COLUMN).toString();
-		entry.title = query.value(TITLE_COLUMN).toString();
-		if(entry.title.isEmpty()) entry.title = QFileInfo(entry.fileName).fileName();
-		entry.fileSize = query.value(FILESIZE_COLUMN).toInt();
-		entry.fileDate = query.value(FILEDATE_COLUMN).toInt();
-		entry.dateStr = QLocale::system().toString(QDateTime::fromSecsSinceEpoch(entry.fileDate), QLocale::ShortFormat);
-
-		if(entry.fileSize < 1024)
-			entry.sizeStr = QString::number(entry.fileSize) + " B";
-		else if(entry.fileSize < 1024 * 1024)
-			entry.sizeStr = QString::number(entry.fileSize / 1024) + " KiB";
+	static QString FormatSize(int64_t size)
+	{
+		if(size < 1024)
+			return QString::number(size) + " B";
+		else if(size < 1024 * 1024)
+			return QString::number(size / 1024) + " KiB";
 		else
-			entry.sizeStr = QString("%1.%2 MiB").arg(entry.fileSize / (1024 * 1024)).arg((((entry.fileSize / 1024) % 1024) * 100) / 1024, 2, 10, QChar('0'));
+			return QString("%1.%2 MiB").arg(size / (1024 * 1024)).arg((((size / 1024) % 1024) * 100) / 1024, 2, 10, QChar('0'));
+	}
 
-		if(rawFingerprintSize)
-		{
-			auto modFingerprint = query.value(FINGERPRINT_COLUMN).toByteArray();
-			uint32_t *modRawFingerprint = nullptr;
-			int modRawFingerprintSize = 0;
-			chromaprint_decode_fingerprint(modFingerprint.data(), modFingerprint.size(), &modRawFingerprint, &modRawFingerprintSize, nullptr, 0);
-			const int compareLength = std::min(rawFingerprintSize, modRawFingerprintSize);
-			const int maxMatches = 32 * std::max(rawFingerprintSize, modRawFingerprintSize);
-			int bestDifference = INT_MAX;
+	static QString FormatDate(int64_t date)
+	{
+		return QLocale::system().toString(QDateTime::fromSecsSinceEpoch(date), QLocale::ShortFormat);
+	}
 
-			for(int offset = 0; offset < 32 && bestDifference > 0; offset++)
+	// Returns the window containing the given row, loading it if necessary
+	const Window &GetWindow(int row) const
+	{
+		const int window = row / WINDOW_SIZE;
+		auto it = windows.find(window);
+		if(it == windows.end())
+		{
+			it = LoadWindow(window);
+			// Prefetch the surrounding windows once the current request has been answered
+			QTimer::singleShot(0, this, [this, window]()
 			{
-				const int thisLength = compareLength - offset;
-				int differences = 32 * std::abs(rawFingerprintSize - modRawFingerprintSize);
-#ifdef _MSC_VER
-				if(hasPopCnt)
-				{
-					for(int i = 0; i < thisLength; i++)
-					{
-						differences += _mm_popcnt_u32(rawFingerprint[offset + i] ^ modRawFingerprint[i]);
-					}
-				} else
-#elif defined(__GNUC__)
-				for(int i = 0; i < thisLength; i++)
-				{
-					differences += __builtin_popcount(rawFingerprint[offset + i] ^ modRawFingerprint[i]);
-				}
-				if(0)
-#endif
+				for(const int w : { window + 1, window - 1 })
 				{
-					for(int i = 0; i < thisLength; i++)
-					{
-						union { uint32_t u32; uint8_t u8[4]; } v;
-						v.u32 = rawFingerprint[offset + i] ^ modRawFingerprint[i];
-						differences += BitsSetTable256[v.u8[0]]
-						+ BitsSetTable256[v.u8[1]]
-						+ BitsSetTable256[v.u8[2]]
-						+ BitsSetTable256[v.u8[3]];
-					}
+					if(w >= 0 && w * WINDOW_SIZE < rowCount() && !windows.count(w))
+						LoadWindow(w);
 				}
-				bestDifference = std::min(differences, bestDifference);
-			}
-
-			entry.match = (100 * (maxMatches - bestDifference)) / maxMatches;
-			chromaprint_dealloc(modRawFingerprint);
+			});
+		} else
+		{
+			lru.splice(lru.begin(), lru, it->second.lruPos);
 		}
-		return true;
+		return it->second;
 	}
 
 	QVariant data(const QModelIndex &index, int role) const
 	{
-		if(size_t(index.row()) >= modules.size())
+		if(size_t(index.row()) >= ids.size())
 		{
 			return QVariant();
 		}
-		Entry &entry = *modulesSorted[index.row()];
+		const Window &window = GetWindow(index.row());
+		const int pos = index.row() % WINDOW_SIZE;
+		const StringRef fileName = window.fileNames[pos];
+		if(!fileName.length)
+		{
+			return role == Qt::DisplayRole ? QVariant("n/a") : QVariant();
+		}
 
-		if(entry.match == -1)
+		if(index.column() == ThumbnailColumn())
 		{
-			// Entry isn't cached yet, generate info
-			if(!CacheEntry(entry))
-			{
-				return "n/a";
-			}
+			if(role == THUMBNAIL_ROLE)
+				return window.thumbnails[pos];
+			else if(role == Qt::ToolTipRole || role == Qt::UserRole)
+				return window.GetString(fileName);
+			return QVariant();
 		}
 
 		if(role == Qt::DisplayRole)
@@ -180,17 +287,21 @@ public:
 			switch(index.column())
 			{
 			case TITLE_TABLE:
-				return entry.title;
+				if(window.titles[pos].length)
+					return window.GetString(window.titles[pos]);
+				return QFileInfo(window.GetString(fileName)).fileName();
 			case FILESIZE_TABLE:
-				return entry.sizeStr;
+				return sizeStrings.Get(window.fileSizes[pos], FormatSize);
 			case FILEDATE_TABLE:
-				return entry.dateStr;
+				return dateStrings.Get(window.fileDates[pos], FormatDate);
 			case FINGERPRINT_TABLE:
-				return entry.match;
+				return matches[index.row()];
+			case CLUSTER_TABLE:
+				return clusters[index.row()];
 			}
 		} else if(role == Qt::ToolTipRole || role == Qt::UserRole)
 		{
-			return entry.fileName;
+			return window.GetString(fileName);
 		}
 		return QVariant();
 	}
@@ -199,6 +310,8 @@ public:
 	{
 		if(role == Qt::DisplayRole && orientation == Qt::Horizontal)
 		{
+			if(section == ThumbnailColumn())
+				return tr("Waveform");
 			switch(section)
 			{
 			case TITLE_TABLE:
@@ -208,7 +321,9 @@ public:
 			case FILEDATE_TABLE:
 				return tr("Last Modified");
 			case FINGERPRINT_TABLE:
-				return tr("Match %");
+				return grouped ? tr("Similarity %") : tr("Match %");
+			case CLUSTER_TABLE:
+				return tr("Group");
 			}
 		}
 		return QVariant();
@@ -216,40 +331,255 @@ public:
 
 	void sort(int column, Qt::SortOrder order = Qt::AscendingOrder)
 	{
-		// Complete table needs to be cached for sorting, obviously.
-		for(auto &m : modules)
+		if(ids.empty() || (column == sortColumn && order == sortOrder) || column == ThumbnailColumn())
 		{
-			if(m.match == -1)
-			{
-				CacheEntry(m);
-			}
+			return;
 		}
+		emit layoutAboutToBeChanged();
 
-		QCollator collator;
-		collator.setNumericMode(true);
-		collator.setCaseSensitivity(Qt::CaseInsensitive);
-
+		// Ties are broken by the current position, so that the comparison is a strict total order.
+		const bool descending = (order == Qt::DescendingOrder);
+		std::vector<uint32_t> permutation(ids.size());
+		std::iota(permutation.begin(), permutation.end(), 0u);
 		switch(column)
 		{
 		case TITLE_TABLE:
-			std::sort(modulesSorted.begin(), modulesSorted.end(), [&collator](const Entry *a, const Entry *b) { return collator.compare(a->title, b->title) < 0; });
+			ComputeTitleKeys();
+			ParallelSort(permutation.begin(), permutation.end(), [this, descending](uint32_t a, uint32_t b)
+			{
+				const int result = titleKeys[a].compare(titleKeys[b]);
+				return result ? ((result < 0) != descending) : a < b;
+			});
 			break;
 		case FILESIZE_TABLE:
-			std::sort(modulesSorted.begin(), modulesSorted.end(), [](const Entry *a, const Entry *b) { return a->fileSize < b->fileSize; });
-			break;
 		case FILEDATE_TABLE:
-			std::sort(modulesSorted.begin(), modulesSorted.end(), [](const Entry *a, const Entry *b) { return a->fileDate < b->fileDate; });
+			SortByDatabaseColumn(IndexedSortColumn(column), descending, permutation);
 			break;
 		case FINGERPRINT_TABLE:
-			std::sort(modulesSorted.begin(), modulesSorted.end(), [](const Entry *a, const Entry *b) { return a->match < b->match; });
+			ParallelSort(permutation.begin(), permutation.end(), [this, descending](uint32_t a, uint32_t b)
+			{
+				const int x = matches[a], y = matches[b];
+				return x != y ? ((x < y) != descending) : a < b;
+			});
+			break;
+		case CLUSTER_TABLE:
+			// Keep the members of each group ordered by their similarity
+			ParallelSort(permutation.begin(), permutation.end(), [this, descending](uint32_t a, uint32_t b)
+			{
+				if(clusters[a] != clusters[b])
+					return (clusters[a] < clusters[b]) != descending;
+				return matches[a] != matches[b] ? matches[a] > matches[b] : a < b;
+			});
 			break;
 		}
-		if(order == Qt::DescendingOrder)
+		Reorder(permutation);
+		sortColumn = column;
+		sortOrder = order;
+		presorted = false;
+
+		// Windows refer to display positions
+		windows.clear();
+		lru.clear();
+		emit layoutChanged();
+	}
+
+protected:
+	std::unordered_map<int, Window>::iterator LoadWindow(int window) const
+	{
+		if(windows.size() >= MAX_WINDOWS)
+		{
+			windows.erase(lru.back());
+			lru.pop_back();
+		}
+
+		const int first = window * WINDOW_SIZE;
+		const int count = std::min(WINDOW_SIZE, rowCount() - first);
+		std::unordered_map<int64_t, int> positions;
+		for(int i = 0; i < WINDOW_SIZE; i++)
+		{
+			// Unused placeholders are bound to a rowid that cannot exist
+			const qlonglong id = (i < count) ? ids[first + i] : -1;
+			windowQuery.bindValue(i, id);
+			if(i < count)
+				positions[id] = i;
+		}
+
+		Window &w = windows[window];
+		w.strings.reserve(count * 64);
+		w.fileNames.resize(count);
+		w.titles.resize(count);
+		w.fileDates.resize(count);
+		w.fileSizes.resize(count);
+		w.thumbnails.resize(count);
+		lru.push_front(window);
+		w.lruPos = lru.begin();
+		if(windowQuery.exec())
+		{
+			while(windowQuery.next())
+			{
+				const auto pos = positions.find(windowQuery.value(ID_COLUMN).toLongLong());
+				if(pos == positions.end())
+				{
+					continue;
+				}
+				const int i = pos->second;
+				w.fileNames[i] = w.AddString(windowQuery.value(FILENAME_COLUMN).toString());
+				w.titles[i] = w.AddString(windowQuery.value(TITLE_COLUMN).toString());
+				w.fileSizes[i] = windowQuery.value(FILESIZE_COLUMN).toInt();
+				w.fileDates[i] = windowQuery.value(FILEDATE_COLUMN).toUInt();
+				w.thumbnails[i] = windowQuery.value(THUMBNAIL_COLUMN).toByteArray();
+			}
+		}
+		w.strings.squeeze();
+		windowQuery.finish();
+		return windows.find(window);
+	}
+
+	void DropWindow(int window)
+	{
+		auto it = windows.find(window);
+		if(it != windows.end())
+		{
+			lru.erase(it->second.lruPos);
+			windows.erase(it);
+		}
+	}
+
+	// Calls func(position, query) for every row of the result, with the requested columns following the rowid.
+	template<typename Func>
+	void ReadColumns(const QString &columns, Func func) const
+	{
+		std::unordered_map<int64_t, uint32_t> positions;
+		positions.reserve(ids.size());
+		for(uint32_t i = 0; i < ids.size(); i++)
+		{
+			positions[ids[i]] = i;
+		}
+
+		QString queryStr = "SELECT `rowid`, " + columns + " FROM `modlib_modules`";
+		if(ids.size() <= MAX_ID_LIST)
+		{
+			QStringList idList;
+			idList.reserve(static_cast<int>(ids.size()));
+			for(const auto id : ids)
+			{
+				idList.push_back(QString::number(id));
+			}
+			queryStr += " WHERE `rowid` IN (" + idList.join(',') + ")";
+		}
+		QSqlQuery query(db);
+		query.setForwardOnly(true);
+		query.exec(queryStr);
+		while(query.next())
+		{
+			const auto pos = positions.find(query.value(0).toLongLong());
+			if(pos != positions.end())
+				func(pos->second, query);
+		}
+	}
+
+	// Sort keys are computed once and in parallel, each thread with its own collator.
+	void ComputeTitleKeys()
+	{
+		if(!titleKeys.empty())
+		{
+			return;
+		}
+		std::vector<QString> titles(ids.size());
+		ReadColumns("`title`, `filename`", [&titles](uint32_t pos, const QSqlQuery &query)
+		{
+			titles[pos] = query.value(1).toString();
+			if(titles[pos].isEmpty()) titles[pos] = QFileInfo(query.value(2).toString()).fileName();
+		});
+
+		const int numChunks = std::max(1, QThread::idealThreadCount());
+		std::vector<std::vector<QCollatorSortKey>> parts(numChunks);
+		std::vector<int> chunks(numChunks);
+		std::iota(chunks.begin(), chunks.end(), 0);
+		QtConcurrent::blockingMap(chunks, [&titles, &parts, numChunks](int chunk)
+		{
+			QCollator collator;
+			collator.setNumericMode(true);
+			collator.setCaseSensitivity(Qt::CaseInsensitive);
+			const size_t begin = (titles.size() * chunk) / numChunks, end = (titles.size() * (chunk + 1)) / numChunks;
+			parts[chunk].reserve(end - begin);
+			for(size_t i = begin; i < end; i++)
+			{
+				parts[chunk].push_back(collator.sortKey(titles[i]));
+			}
+		});
+		titleKeys.reserve(ids.size());
+		for(auto &part : parts)
+		{
+			titleKeys.insert(titleKeys.end(), part.begin(), part.end());
+		}
+	}
+
+	// Large results are ordered by walking the column's index, so that no sorting is required at all.
+	void SortByDatabaseColumn(const char *column, bool descending, std::vector<uint32_t> &permutation) const
+	{
+		if(ids.size() <= MAX_ID_LIST)
+		{
+			std::vector<int64_t> values(ids.size());
+			ReadColumns(QString("`") + column + "`", [&values](uint32_t pos, const QSqlQuery &query) { values[pos] = query.value(1).toLongLong(); });
+			std::sort(permutation.begin(), permutation.end(), [&values, descending](uint32_t a, uint32_t b)
+			{
+				return values[a] != values[b] ? ((values[a] < values[b]) != descending) : a < b;
+			});
+			return;
+		}
+
+		std::unordered_map<int64_t, uint32_t> positions;
+		positions.reserve(ids.size());
+		for(uint32_t i = 0; i < ids.size(); i++)
 		{
-			std::reverse(modulesSorted.begin(), modulesSorted.end());
+			positions[ids[i]] = i;
 		}
+		std::vector<bool> found(ids.size(), false);
+		permutation.clear();
+		QSqlQuery query(db);
+		query.setForwardOnly(true);
+		query.exec(QString("SELECT `rowid` FROM `modlib_modules` ORDER BY `") + column + (descending ? "` DESC" : "`"));
+		while(query.next())
+		{
+			const auto pos = positions.find(query.value(0).toLongLong());
+			if(pos != positions.end())
+			{
+				permutation.push_back(pos->second);
+				found[pos->second] = true;
+			}
+		}
+		// Modules that have vanished from the database go last
+		for(uint32_t i = 0; i < ids.size(); i++)
+		{
+			if(!found[i])
+				permutation.push_back(i);
+		}
+	}
 
-		emit dataChanged(QAbstractItemModel::createIndex(0, 0), QAbstractItemModel::createIndex(rowCount() - 1, columnCount() - 1));
+	void Reorder(const std::vector<uint32_t> &permutation)
+	{
+		Permute(ids, permutation);
+		Permute(matches, permutation);
+		Permute(clusters, permutation);
+		Permute(titleKeys, permutation);
+	}
+
+	template<typename T>
+	static void Permute(std::vector<T> &column, const std::vector<uint32_t> &permutation)
+	{
+		if(column.empty())
+		{
+			return;
+		}
+		std::vector<T> sorted;
+		sorted.reserve(column.size());
+		for(const auto i : permutation)
+		{
+			sorted.push_back(std::move(column[i]));
+		}
+		column = std::move(sorted);
 	}
 };
 
+Q_DECLARE_METATYPE(TableModel::Row)
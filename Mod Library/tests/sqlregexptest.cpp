@@ -0,0 +1,82 @@
+/*
+ * sqlregexptest.cpp
+ * -----------------
+ * Purpose: Tests of the literal prefilter that is extracted from REGEXP search patterns.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include <QTextStream>
+#include <iterator>
+#include "sqlregexp.h"
+
+struct TestCase
+{
+	const char *pattern;
+	const char *literal;
+};
+
+// A literal that is too short only costs time, but a wrong one hides matches. Every syntax that is not understood must give up.
+static const TestCase TEST_CASES[] =
+{
+	// Plain text and escaped punctuation
+	{ "tune", "tune" },
+	{ "^abc$", "abc" },
+	{ "foo\\.bar", "foo.bar" },
+	{ "\\+\\*", "+*" },
+	{ "", "" },
+	// Only the longest run that every match has to contain
+	{ "a.b", "a" },
+	{ "abc\\d+defg", "defg" },
+	{ "x\\wyz", "yz" },
+	{ "\\d+", "" },
+	// Quantifiers
+	{ "colou?r", "colo" },
+	{ "a{2,3}bc", "bc" },
+	{ "abc+d", "abc" },
+	// Groups and character classes are skipped
+	{ "ab(cd)?ef", "ab" },
+	{ "(a(b)c)+xy", "xy" },
+	{ "(?:abc)de", "de" },
+	{ "[abc]def", "def" },
+	{ "[a\\]b]cd", "cd" },
+	// LIKE only ignores the case of ASCII characters
+	{ "\xC3\xA4" "bcd", "bcd" },
+	{ "a\xC3\xA4" "b", "a" },
+	// Escapes with arguments
+	{ "\\x41abc", "" },
+	{ "\\012", "" },
+	{ "\\cA", "" },
+	{ "\\1abc", "" },
+	{ "\\k<name>", "" },
+	{ "\\p{L}", "" },
+	{ "\\N{U+41}", "" },
+	{ "abc\\", "" },
+	// Quoted sequences, inline options and alternatives
+	{ "\\Qa.b\\E", "" },
+	{ "(?x)a b", "" },
+	{ "(?i)abc", "" },
+	{ "(?-i)abc", "" },
+	{ "a|b", "" },
+};
+static constexpr int NUM_TEST_CASES = static_cast<int>(std::size(TEST_CASES));
+
+
+int main()
+{
+	QTextStream out(stdout);
+	int failures = 0;
+	for(const auto &test : TEST_CASES)
+	{
+		const QString pattern = QString::fromUtf8(test.pattern);
+		const QString literal = SqlRegexp::RequiredLiteral(pattern);
+		if(literal != QString::fromUtf8(test.literal))
+		{
+			out << "RequiredLiteral(\"" << pattern << "\") returned \"" << literal << "\", expected \"" << QString::fromUtf8(test.literal) << "\"\n";
+			failures++;
+		}
+	}
+	out << (NUM_TEST_CASES - failures) << " of " << NUM_TEST_CASES << " tests passed\n";
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * thumbnaildelegate.cpp
+ * ---------------------
+ * Purpose: Draws the waveform and spectrogram thumbnails of modules in the result table.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "thumbnaildelegate.h"
+#include "tablemodel.h"
+#include "thumbnails.h"
+#include <QPainter>
+#include <QPixmap>
+#include <QPixmapCache>
+#include <algorithm>
+
+// Height of the waveform in decoded thumbnails. Every spectrogram band is one pixel high.
+static constexpr int ENVELOPE_HEIGHT = 16;
+
+
+QImage ThumbnailDelegate::Decode(const QByteArray &thumbnail)
+{
+	if(thumbnail.size() < ThumbnailCapture::HEADER_SIZE)
+	{
+		return QImage();
+	}
+	const uint8_t *in = reinterpret_cast<const uint8_t *>(thumbnail.constData());
+	const int points = in[1], frames = in[2], bands = in[3];
+	if(in[0] != ThumbnailCapture::FORMAT_VERSION || !points || !frames || !bands || thumbnail.size() < ThumbnailCapture::HEADER_SIZE + points * 2 + frames * bands)
+	{
+		return QImage();
+	}
+	const int8_t *envelope = reinterpret_cast<const int8_t *>(in + ThumbnailCapture::HEADER_SIZE);
+	const uint8_t *spectrogram = in + ThumbnailCapture::HEADER_SIZE + points * 2;
+
+	// Waveform on top, spectrogram with the lowest band at the bottom below it
+	QImage image(points, ENVELOPE_HEIGHT + bands, QImage::Format_ARGB32_Premultiplied);
+	image.fill(Qt::transparent);
+	const QRgb waveColor = qRgb(60, 130, 200);
+	for(int x = 0; x < points; x++)
+	{
+		const int top = (127 - envelope[x * 2 + 1]) * (ENVELOPE_HEIGHT - 1) / 255;
+		const int bottom = (127 - envelope[x * 2]) * (ENVELOPE_HEIGHT - 1) / 255;
+		for(int y = top; y <= bottom; y++)
+		{
+			image.setPixel(x, y, waveColor);
+		}
+	}
+	for(int b = 0; b < bands; b++)
+	{
+		QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(ENVELOPE_HEIGHT + bands - 1 - b));
+		for(int x = 0; x < points; x++)
+		{
+			const int level = spectrogram[(x * frames / points) * bands + b];
+			line[x] = qRgb(std::min(level * 2, 255), std::max(level * 2 - 255, 0), level < 128 ? level : 255 - level);
+		}
+	}
+	return image;
+}
+
+
+void ThumbnailDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+	// Selection and focus
+	QStyledItemDelegate::paint(painter, option, index);
+
+	const QByteArray thumbnail = index.data(TableModel::THUMBNAIL_ROLE).toByteArray();
+	if(thumbnail.isEmpty())
+	{
+		return;
+	}
+	const QString key = QStringLiteral("modlib_thumbnail_%1_%2").arg(qHash(thumbnail), 0, 16).arg(thumbnail.size());
+	QPixmap pixmap;
+	if(!QPixmapCache::find(key, &pixmap))
+	{
+		const QImage image = Decode(thumbnail);
+		if(image.isNull())
+		{
+			return;
+		}
+		pixmap = QPixmap::fromImage(image);
+		QPixmapCache::insert(key, pixmap);
+	}
+	painter->drawPixmap(option.rect.adjusted(MARGIN, MARGIN, -MARGIN, -MARGIN), pixmap);
+}
+
+
+QSize ThumbnailDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+	return QSize(ThumbnailCapture::ENVELOPE_POINTS + 2 * MARGIN, QStyledItemDelegate::sizeHint(option, index).height());
+}
@@ -0,0 +1,30 @@
+/*
+ * thumbnaildelegate.h
+ * -------------------
+ * Purpose: Draws the waveform and spectrogram thumbnails of modules in the result table.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QImage>
+#include <QtWidgets/QStyledItemDelegate>
+
+// Draws the thumbnail stored in the model's THUMBNAIL_ROLE. Decoded thumbnails are kept in the global pixmap cache,
+// so that scrolling back and forth does not decode them again.
+class ThumbnailDelegate : public QStyledItemDelegate
+{
+public:
+	static constexpr int MARGIN = 2;
+
+	ThumbnailDelegate(QObject *parent = nullptr) : QStyledItemDelegate(parent) { }
+
+	void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+	QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+
+	// Returns a null image if the thumbnail cannot be decoded
+	static QImage Decode(const QByteArray &thumbnail);
+};
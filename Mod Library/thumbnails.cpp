@@ -0,0 +1,187 @@
+/*
+ * thumbnails.cpp
+ * --------------
+ * Purpose: Waveform and spectrogram thumbnails of modules, computed while analyzing them and drawn in the result table.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#include "thumbnails.h"
+#include "database.h"
+#include <QtSql/QSqlError>
+#include <algorithm>
+#include <cmath>
+
+static constexpr double PI = 3.14159265358979323846;
+// Lower edge of the lowest spectrogram band in Hz
+static constexpr double MIN_FREQUENCY = 80.0;
+// Band levels are stored from this level in dBFS to 0 dBFS
+static constexpr double MIN_LEVEL = -90.0;
+
+
+void ThumbnailCapture::Start(openmpt::module &mod, int32_t sampleRate)
+{
+	const int64_t length = std::max(int64_t(1), static_cast<int64_t>(mod.get_duration_seconds() * sampleRate));
+	pointLength = std::max(int64_t(1), (length + ENVELOPE_POINTS - 1) / ENVELOPE_POINTS);
+	frameLength = std::max(int64_t(1), (length + SPECTROGRAM_FRAMES - 1) / SPECTROGRAM_FRAMES);
+	envelopeMin.assign(ENVELOPE_POINTS, 0);
+	envelopeMax.assign(ENVELOPE_POINTS, 0);
+	bandPower.assign(SPECTROGRAM_FRAMES * SPECTROGRAM_BANDS, 0.0);
+	framesAnalyzed.assign(SPECTROGRAM_FRAMES, 0);
+
+	window.resize(FFT_SIZE);
+	double windowEnergy = 0.0;
+	for(int i = 0; i < FFT_SIZE; i++)
+	{
+		window[i] = static_cast<float>(0.5 - 0.5 * std::cos(2.0 * PI * i / FFT_SIZE));
+		windowEnergy += window[i] * window[i];
+	}
+	// Scaled so that a full-scale sine wave is at 0 dBFS
+	spectrumScale = 4.0 / (FFT_SIZE * windowEnergy);
+	twiddles.resize(FFT_SIZE / 2);
+	for(int i = 0; i < FFT_SIZE / 2; i++)
+	{
+		twiddles[i] = std::polar(1.0f, static_cast<float>(-2.0 * PI * i / FFT_SIZE));
+	}
+	fftInput.resize(FFT_SIZE);
+	fftBuffer.resize(FFT_SIZE);
+
+	// Logarithmically spaced bands from MIN_FREQUENCY to the Nyquist frequency, each at least one bin wide
+	const double binWidth = static_cast<double>(sampleRate) / FFT_SIZE, maxFrequency = sampleRate / 2.0;
+	bandStart.resize(SPECTROGRAM_BANDS + 1);
+	for(int b = 0; b <= SPECTROGRAM_BANDS; b++)
+	{
+		const double frequency = MIN_FREQUENCY * std::pow(maxFrequency / MIN_FREQUENCY, static_cast<double>(b) / SPECTROGRAM_BANDS);
+		int bin = static_cast<int>(std::lround(frequency / binWidth));
+		if(b > 0)
+			bin = std::max(bin, bandStart[b - 1] + 1);
+		bandStart[b] = std::min(bin, FFT_SIZE / 2);
+	}
+}
+
+
+void ThumbnailCapture::Feed(openmpt::module &, const int16_t *data, size_t count)
+{
+	size_t i = 0;
+	while(i < count)
+	{
+		// Process the samples up to the end of the current envelope point or FFT window, whichever comes first
+		const int64_t point = std::min(position / pointLength, int64_t(ENVELOPE_POINTS - 1));
+		size_t chunk = std::min(count - i, static_cast<size_t>(FFT_SIZE - fftFill));
+		if(point < ENVELOPE_POINTS - 1)
+			chunk = std::min(chunk, static_cast<size_t>((point + 1) * pointLength - position));
+
+		int8_t &minValue = envelopeMin[point], &maxValue = envelopeMax[point];
+		for(size_t j = i; j < i + chunk; j++)
+		{
+			const int8_t value = static_cast<int8_t>(data[j] >> 8);
+			minValue = std::min(minValue, value);
+			maxValue = std::max(maxValue, value);
+			fftInput[fftFill++] = data[j] * (1.0f / 32768.0f);
+		}
+		i += chunk;
+		position += chunk;
+		if(fftFill == FFT_SIZE)
+		{
+			AnalyzeWindow(position - FFT_SIZE);
+			fftFill = 0;
+		}
+	}
+}
+
+
+void ThumbnailCapture::AnalyzeWindow(int64_t windowStart)
+{
+	// Iterative radix-2 FFT
+	for(int i = 0, j = 0; i < FFT_SIZE; i++)
+	{
+		fftBuffer[j] = fftInput[i] * window[i];
+		for(int bit = FFT_SIZE >> 1; (j ^= bit) < bit; bit >>= 1);
+	}
+	for(int size = 2; size <= FFT_SIZE; size <<= 1)
+	{
+		const int half = size / 2, step = FFT_SIZE / size;
+		for(int start = 0; start < FFT_SIZE; start += size)
+		{
+			for(int k = 0; k < half; k++)
+			{
+				const std::complex<float> t = fftBuffer[start + k + half] * twiddles[k * step];
+				fftBuffer[start + k + half] = fftBuffer[start + k] - t;
+				fftBuffer[start + k] += t;
+			}
+		}
+	}
+
+	const int frame = static_cast<int>(std::min(windowStart / frameLength, int64_t(SPECTROGRAM_FRAMES - 1)));
+	double *power = bandPower.data() + frame * SPECTROGRAM_BANDS;
+	for(int b = 0; b < SPECTROGRAM_BANDS; b++)
+	{
+		double sum = 0.0;
+		for(int k = bandStart[b]; k < bandStart[b + 1]; k++)
+		{
+			sum += std::norm(fftBuffer[k]);
+		}
+		power[b] += sum * spectrumScale;
+	}
+	framesAnalyzed[frame]++;
+}
+
+
+QByteArray ThumbnailCapture::Encode() const
+{
+	QByteArray thumbnail(HEADER_SIZE + ENVELOPE_POINTS * 2 + SPECTROGRAM_FRAMES * SPECTROGRAM_BANDS, '\0');
+	uint8_t *out = reinterpret_cast<uint8_t *>(thumbnail.data());
+	*out++ = FORMAT_VERSION;
+	*out++ = ENVELOPE_POINTS;
+	*out++ = SPECTROGRAM_FRAMES;
+	*out++ = SPECTROGRAM_BANDS;
+	for(int i = 0; i < ENVELOPE_POINTS; i++)
+	{
+		*out++ = static_cast<uint8_t>(envelopeMin[i]);
+		*out++ = static_cast<uint8_t>(envelopeMax[i]);
+	}
+	for(int frame = 0; frame < SPECTROGRAM_FRAMES; frame++)
+	{
+		for(int b = 0; b < SPECTROGRAM_BANDS; b++)
+		{
+			const double power = bandPower[frame * SPECTROGRAM_BANDS + b] / std::max(framesAnalyzed[frame], 1);
+			const double level = (power > 0.0) ? 10.0 * std::log10(power) : MIN_LEVEL;
+			*out++ = static_cast<uint8_t>(std::lround(std::clamp((level - MIN_LEVEL) * 255.0 / -MIN_LEVEL, 0.0, 255.0)));
+		}
+	}
+	return thumbnail;
+}
+
+
+void ThumbnailStore::Open(QSqlDatabase &db)
+{
+	QSqlQuery query(db);
+	if(!query.exec("CREATE TABLE IF NOT EXISTS `modlib_thumbnails` (`filename` TEXT PRIMARY KEY, `thumbnail` BLOB) WITHOUT ROWID"))
+	{
+		throw ModDatabase::Exception("Cannot create thumbnail table: ", query.lastError());
+	}
+
+	storeQuery = QSqlQuery(db);
+	removeQuery = QSqlQuery(db);
+	if(!storeQuery.prepare("INSERT OR REPLACE INTO `modlib_thumbnails` (`filename`, `thumbnail`) VALUES (:filename, :thumbnail)")
+		|| !removeQuery.prepare("DELETE FROM `modlib_thumbnails` WHERE `filename` = :filename"))
+	{
+		throw ModDatabase::Exception("Cannot prepare thumbnail queries: ", storeQuery.lastError());
+	}
+}
+
+
+void ThumbnailStore::Store(const QString &fileName, const QByteArray &thumbnail)
+{
+	storeQuery.bindValue(":filename", fileName);
+	storeQuery.bindValue(":thumbnail", thumbnail);
+	storeQuery.exec();
+}
+
+
+void ThumbnailStore::Remove(const QString &fileName)
+{
+	removeQuery.bindValue(":filename", fileName);
+	removeQuery.exec();
+}
@@ -0,0 +1,66 @@
+/*
+ * thumbnails.h
+ * ------------
+ * Purpose: Waveform and spectrogram thumbnails of modules, computed while analyzing them and stored in the library.
+ * Notes  : (currently none)
+ * Authors: Johannes Schultz
+ * The Mod Library source code is released under the BSD license. Read LICENSE for more details.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+#include <complex>
+#include <cstdint>
+#include <vector>
+#include "analyzers.h"
+
+// Builds a min/max envelope of the whole song and a coarse spectrogram with logarithmically spaced bands.
+// Stored thumbnail layout: 8-bit format version, 8-bit number of envelope points, 8-bit number of spectrogram frames,
+// 8-bit number of bands, followed by the signed 8-bit minimum and maximum of every envelope point,
+// and the 8-bit level of every band of every frame (lowest band first), which is about 1 KB in total.
+class ThumbnailCapture : public AudioAnalyzer
+{
+public:
+	static constexpr int ENVELOPE_POINTS = 128;
+	static constexpr int SPECTROGRAM_FRAMES = 64;
+	static constexpr int SPECTROGRAM_BANDS = 12;
+	static constexpr int FFT_SIZE = 512;
+	static constexpr int FORMAT_VERSION = 1;
+	static constexpr int HEADER_SIZE = 4;
+
+protected:
+	std::vector<int8_t> envelopeMin, envelopeMax;
+	std::vector<double> bandPower;	// SPECTROGRAM_FRAMES * SPECTROGRAM_BANDS
+	std::vector<int> framesAnalyzed;
+	std::vector<int> bandStart;	// First FFT bin of every band, plus the end of the last band
+	std::vector<float> window, fftInput;
+	std::vector<std::complex<float>> fftBuffer, twiddles;
+	double spectrumScale = 1.0;
+	int64_t position = 0, pointLength = 1, frameLength = 1;
+	int fftFill = 0;
+
+public:
+	void Start(openmpt::module &mod, int32_t sampleRate) override;
+	void Feed(openmpt::module &mod, const int16_t *data, size_t count) override;
+	QByteArray Encode() const;
+
+protected:
+	void AnalyzeWindow(int64_t windowStart);
+};
+
+
+// Thumbnails are small enough to live in the library itself, where the result table can fetch them together with the other columns.
+class ThumbnailStore
+{
+protected:
+	QSqlQuery storeQuery, removeQuery;
+
+public:
+	void Open(QSqlDatabase &db);
+
+	void Store(const QString &fileName, const QByteArray &thumbnail);
+	void Remove(const QString &fileName);
+};